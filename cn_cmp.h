@@ -45,6 +45,12 @@ CNC_COMP cn_cmp_ushort (void* , void* ); //Unsigned Short Comparison
 CNC_COMP cn_cmp_ulong  (void* , void* ); //Unsigned Long Comparison
 CNC_COMP cn_cmp_ull    (void* , void* ); //Unsigned Long Long Comparison
 
+//Inline comparisons by value. These are for CN_MAP_DEFINE (see cn_map_typed.h)
+//and are expressions rather than functions, so they compile down to a couple
+//of instructions. CN_CMP_NUM covers every real type above, signed or not.
+#define CN_CMP_NUM(a, b)  (((a) > (b)) - ((a) < (b)))
+#define CN_CMP_CSTR(a, b) strcmp((a), (b))
+
 //Macros just if you want to cheat (Or rather... if you "can")
 #define cn_cmp_real(type, a, b) \
 	(_CN_CMP_LESS    * (*(type*)a < *(type*)b)) + \
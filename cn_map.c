@@ -23,9 +23,287 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
 
 #include "cn_map.h"
 
+/*
+ * Pool chunk sizing. The first chunk holds CNM_POOL_CHUNK_MIN slots, and each
+ * chunk after that doubles in size until CNM_POOL_CHUNK_MAX is reached.
+ */
+
+#define CNM_POOL_CHUNK_MIN 64
+#define CNM_POOL_CHUNK_MAX 65536
+
+#define CNM_ALIGN(x, a) (((x) + (a) - 1) / (a) * (a))
+
+/*
+ * Owned string keys are copied into arena chunks of at least CNM_ARENA_CHUNK
+ * bytes. Once erased strings take up more room than live ones (and at least
+ * a chunk's worth), the arena is compacted.
+ */
+
+#define CNM_ARENA_CHUNK 65536
+
+/*
+ * B+ tree node sizing. Each node holds about CNM_BT_NODE_BYTES worth of keys
+ * (a few cache lines), but never fewer than CNM_BT_CAP_MIN or more than
+ * CNM_BT_CAP_MAX of them.
+ */
+
+#define CNM_BT_NODE_BYTES 256
+#define CNM_BT_CAP_MIN    8
+#define CNM_BT_CAP_MAX    64
+
+/*
+ * A frozen snapshot search prefetches the element this many levels further
+ * down the tree. The 2^N elements there sit next to each other, so one
+ * prefetch covers all of them (for small keys).
+ */
+
+#define CNM_FROZEN_PREFETCH_LEVELS 4
+
+/*
+ * Sharded map tuning. A shard checks whether it has outgrown the others every
+ * CNM_SHARD_CHECK insertions, and gives elements to a neighbour once it has
+ * more than CNM_SHARD_SLACK over its share. Shards are kept CNM_CACHE_LINE
+ * bytes apart.
+ */
+
+#define CNM_SHARD_CHECK 1024
+#define CNM_SHARD_SLACK 1024
+#define CNM_CACHE_LINE  64
+
+/*
+ * Concurrent reader tuning. Up to CNM_EPOCH_READERS threads can hold a read
+ * lock at once (any more spin until a slot frees up). Erased nodes are reclaimed CNM_EPOCH_BATCH at a time. A read
+ * gives up and starts over if it goes more than CNM_READ_MAX_DEPTH nodes deep,
+ * which can only happen when the tree changes under it.
+ */
+
+#define CNM_EPOCH_READERS  128
+#define CNM_EPOCH_BATCH    256
+#define CNM_READ_MAX_DEPTH 128
+
+/*
+ * A red-black tree of fewer than 2^32 nodes is at most 64 nodes deep, so that
+ * is as long as the path a persistent CN_Map ever has to remember.
+ */
+
+#define CNM_PS_MAX_DEPTH 64
+
+/*
+ * Parallel sort tuning. Inputs smaller than CNM_SORT_PARALLEL_MIN are sorted
+ * on the calling thread. No more than CNM_SORT_THREADS_MAX threads are used,
+ * and runs shorter than CNM_SORT_INSERTION are insertion sorted.
+ */
+
+#define CNM_SORT_PARALLEL_MIN 65536
+#define CNM_SORT_THREADS_MAX  64
+#define CNM_SORT_INSERTION    16
+
+/*
+ * Batch insertion rebuilds the whole tree once the batch is at least 1/Nth
+ * the size of the CN_Map. Smaller batches are inserted one by one instead.
+ */
+
+#define CNM_BATCH_REBUILD_RATIO 4
+
+/*
+ * Number of searches "cn_map_find_batch" keeps in flight at once. Each one
+ * prefetches its next node, so this many cache misses can overlap.
+ */
+
+#define CNM_FIND_BATCH_WIDTH 16
+
+/*
+ * Set operation tuning. CN_Maps with fewer than CNM_SET_PARALLEL_MIN elements
+ * between them are combined on the calling thread alone. Otherwise, each of
+ * the top levels of the recursion starts one more thread for every thread it
+ * already has, up to CNM_SET_SPAWN_MAX levels.
+ */
+
+#define CNM_SET_PARALLEL_MIN 65536
+#define CNM_SET_SPAWN_MAX    7
+
+#ifdef __GNUC__
+	#define CNM_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+	#define CNM_PREFETCH(ptr)
+#endif
+
+/*
+ * Every chunk starts with a header linking it to the previous chunk. It is
+ * padded out so the slots after it keep the same alignment malloc gives.
+ */
+
+typedef union cnm_chunk {
+	union cnm_chunk *next;
+	long double      align;
+} CNM_CHUNK;
+
+/*
+ * String key layout (see "new_cn_map_str"). The "char *" key is followed by
+ * its first 8 bytes packed into a big-endian integer, and then (if asked for)
+ * the length of the string.
+ */
+
+#define CNM_STR_PREFIX_OFFSET \
+	(CNM_KEY_OFFSET + CNM_ALIGN(sizeof(char *), sizeof(CNM_U64)))
+
+#define CNM_STR_LENGTH_OFFSET (CNM_STR_PREFIX_OFFSET + sizeof(CNM_U64))
+
+#define CNM_STR_PREFIX_OF(node) \
+	(*(CNM_U64 *) ((CNM_BYTE *) (node) + CNM_STR_PREFIX_OFFSET))
+
+#define CNM_STR_LENGTH_OF(node) \
+	(*(size_t  *) ((CNM_BYTE *) (node) + CNM_STR_LENGTH_OFFSET))
+
+/*
+ * String Query Struct
+ *
+ * A key being searched for in a string key CN_Map, with its prefix (and
+ * length) worked out once up front rather than at every node.
+ */
+
+typedef struct cnm_str_query {
+	const CNM_BYTE *str;
+	CNM_U64         prefix;
+	size_t          length;
+} CNM_STR_QUERY;
+
+CNC_COMP  __cn_map_str_cmp    (void *, void *);
+void      __cn_map_str_query  (CN_MAP, CNM_STR_QUERY *, void *);
+void      __cn_map_str_cache  (CN_MAP, CNM_NODE *);
+CNC_COMP  __cn_map_str_compare(CN_MAP, CNM_STR_QUERY *, CNM_NODE *);
+size_t    __cn_map_str_size   (CN_MAP, CNM_NODE *);
+
+//Subtree size of a node that might be NULL
+#define CNM_COUNT(node) (((node) == NULL) ? 0 : (node)->count)
+
+/*
+ * Reader Slot Struct
+ *
+ * Marks a thread as reading, along with the epoch it started reading in (0 if
+ * the slot is free). Each slot has a cache line to itself, so readers never
+ * write to a line another reader is using.
+ */
+
+typedef struct cnm_reader_slot {
+	CNM_U64  epoch;
+	CNM_BYTE pad[CNM_CACHE_LINE - sizeof(CNM_U64)];
+} CNM_READER_SLOT;
+
+/*
+ * Retired Node Struct
+ *
+ * A node that was erased while readers might still be looking at it, and the
+ * epoch it was erased in.
+ */
+
+typedef struct cnm_retired {
+	CNM_NODE *node;
+	CNM_U64   epoch;
+} CNM_RETIRED;
+
+/*
+ * Epoch Struct
+ *
+ * Everything a CN_Map needs for readers that take no locks (see
+ * "cn_map_set_concurrent_reads"). "seq" is odd while the writer is changing
+ * the tree, and goes up every time it does, like a seqlock. A reader waits
+ * for it to be even before searching, and can tell if the tree changed during
+ * the search. "global" is the current epoch. It moves on every
+ * CNM_EPOCH_BATCH erasures, and a node erased in epoch "e" is given back once
+ * no reader is left that locked in epoch "e" or before.
+ */
+
+typedef struct cnm_epoch {
+	CNM_READER_SLOT readers[CNM_EPOCH_READERS];
+
+	CNM_UINT        seq;
+	CNM_U64         global;
+
+	CNM_RETIRED    *retired;
+	CNM_UINT        retired_n, retired_cap;
+} CNM_EPOCH;
+
+//Links readers follow while the writer may be changing them. Every write to
+//one is a release, so whichever link a reader finds a node through, it also
+//sees the node filled in.
+#define CNM_LOAD(x)     __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define CNM_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+//Kinds of search "__cn_map_read_bound" can do
+#define CNM_READ_LOWER 0
+#define CNM_READ_UPPER 1
+#define CNM_READ_BELOW 2
+
+/*
+ * Persistent Tree Struct
+ *
+ * Shared by a persistent CN_Map and every snapshot of it (see
+ * "new_cn_map_persistent"). "nodes" hands out tree nodes, which hold a copy of
+ * their key, and "elems" the nodes holding the key/value pairs themselves.
+ * "maps" is how many CN_Maps share this. While there is more than one, any
+ * change to reference counts or to the pools is made holding "lock".
+ */
+
+typedef struct cnm_persist {
+	CNM_POOL        nodes, elems;
+	CNM_UINT        maps;
+	pthread_mutex_t lock;
+} CNM_PERSIST;
+
+/*
+ * Shared Pool Struct
+ *
+ * Node memory used by more than one regular CN_Map, once nodes have been moved
+ * from one to another (see "cn_map_split"). Each node goes back to the pool it
+ * came out of, whichever CN_Map it ends up in. Like with persistent CN_Maps,
+ * "maps" is how many CN_Maps use this, and while there is more than one, the
+ * pool is only touched holding "lock".
+ */
+
+typedef struct cnm_share {
+	CNM_POOL        pool;
+	CNM_UINT        maps;
+	pthread_mutex_t lock;
+} CNM_SHARE;
+
+/*
+ * Persistent Cursor Struct
+ *
+ * The path from the head down to the node a thread last stepped an iterator
+ * to in a persistent CN_Map, so the next step can carry on from it rather
+ * than searching from the head again. "stamp" is the "ps_stamp" the CN_Map had
+ * then. Every change to a persistent CN_Map gives it a stamp no CN_Map has had
+ * before, so a path is only ever used on the exact tree it was taken in.
+ */
+
+typedef struct cnm_ps_cursor {
+	CN_MAP    map;
+	CNM_U64   stamp;
+	CNM_UINT  depth;
+	CNM_NODE *path[CNM_PS_MAX_DEPTH];
+} CNM_PS_CURSOR;
+
+static __thread CNM_PS_CURSOR __cn_map_ps_cursor;
+static          CNM_U64       __cn_map_ps_stamps;
+
+//A stamp no persistent CN_Map has had before
+#define CNM_PS_STAMP() \
+	__atomic_add_fetch(&__cn_map_ps_stamps, 1, __ATOMIC_RELAXED)
+
+//Left (0) or right (1) child of a node, as something that can be assigned to
+#define CNM_CHILD(node, side) (*((side) ? &(node)->right : &(node)->left))
+
 // ----------------------------------------------------------------------------
 // Constructor                                                             {{{1
 // ----------------------------------------------------------------------------
@@ -39,13 +317,17 @@
  *     elements in bytes, while "s2" is the size of the value elements in
  *     bytes.
  *
+ *     If "s2" is 0, the CN_Map acts as a set. No memory is set aside for values
+ *     at all, and each node's "data" pointer is NULL.
+ *
  *     Since this is also a tree data structure, a comparison function is also
  *     required to be passed in. A destruct function is optional and must be
  *     added in through another function.
  */
 
 CN_MAP new_cn_map(CNM_UINT s1, CNM_UINT s2, CNC_COMP(*cmp)(void *, void *)) {
-	CN_MAP obj = (CN_MAP) malloc(sizeof(struct cn_map));
+	CN_MAP   obj = (CN_MAP) malloc(sizeof(struct cn_map));
+	CNM_UINT align;
 
 	//Set all pointers to NULL
 	obj->head  = NULL;
@@ -59,6 +341,27 @@ CN_MAP new_cn_map(CNM_UINT s1, CNM_UINT s2, CNC_COMP(*cmp)(void *, void *)) {
 	obj->func_compare = cmp;
 	obj->func_destruct = NULL;
 
+	//Optional features
+	obj->order_stats = 0;
+	obj->str_keys    = 0;
+	obj->bt          = NULL;
+	obj->epoch       = NULL;
+	obj->ps          = NULL;
+	obj->ps_stamp    = 0;
+	obj->share       = NULL;
+
+	//Node layout. The value is aligned to the largest power of 2 dividing its
+	//size (capped), which is always enough for whatever type it holds.
+	align = (s2 & -s2);
+	if (align == 0 || align > sizeof(CNM_CHUNK))
+		align = sizeof(CNM_CHUNK);
+
+	obj->data_offset = CNM_ALIGN(CNM_KEY_OFFSET + s1, align);
+
+	//Allocators
+	__cn_map_pool_init(&obj->pool, obj->data_offset + s2);
+	__cn_map_arena_init(&obj->arena);
+
 	//Dummy variables
 	obj->it_end.prev = NULL;
 	obj->it_end.node = NULL;
@@ -70,6 +373,159 @@ CN_MAP new_cn_map(CNM_UINT s1, CNM_UINT s2, CNC_COMP(*cmp)(void *, void *)) {
 	return obj;
 }
 
+/*
+ * new_cn_map_str
+ *
+ * Description:
+ *     Sets up a CN_Map with "char *" keys, ordered like "strcmp". Each node
+ *     also caches the first 8 bytes of its key as a big-endian integer. While
+ *     searching, most nodes are told apart by comparing those integers alone,
+ *     so the string itself (another pointer to follow, and likely another
+ *     cache miss) is only read when two keys start with the same 8 bytes.
+ *
+ *     "flags" can have any of the following:
+ *
+ *         CNM_STR_LENGTH: Each node caches the length of its key too. Keys
+ *                         sharing a prefix are then compared with "memcmp"
+ *                         rather than "strcmp".
+ *
+ *         CNM_STR_OWNED : The CN_Map makes its own copy of every key, packed
+ *                         into an internal arena. The caller's strings can be
+ *                         reused or freed as soon as the call returns, and no
+ *                         destructor is needed for keys. The copies are all
+ *                         freed at once by "cn_map_clear" and "cn_map_free".
+ *
+ *     Keys are passed in just like in a CN_Map made with "cn_map_init(char *,
+ *     ...)". Unless they are owned, the strings must not be changed while they
+ *     are in the CN_Map. The comparison function should not be changed either.
+ */
+
+CN_MAP new_cn_map_str(CNM_UINT s2, CNM_BYTE flags) {
+	CN_MAP   obj;
+	CNM_UINT s1;
+
+	//Make room for the cached bytes after the "char *" itself.
+	s1 = ((flags & CNM_STR_LENGTH) ? CNM_STR_LENGTH_OFFSET + sizeof(size_t)
+	                               : CNM_STR_LENGTH_OFFSET) - CNM_KEY_OFFSET;
+
+	obj = new_cn_map(s1, s2, __cn_map_str_cmp);
+
+	//Only the "char *" is copied in from the caller.
+	obj->key_size = sizeof(char *);
+	obj->str_keys = CNM_STR_PREFIX | (flags & (CNM_STR_LENGTH | CNM_STR_OWNED));
+
+	return obj;
+}
+
+/*
+ * new_cn_map_btree
+ *
+ * Description:
+ *     Sets up a CN_Map just like "new_cn_map", but stored in a B+ tree rather
+ *     than a red-black tree. Every node holds many keys side by side (see
+ *     CNM_BT_NODE_BYTES), and the leaves are linked together. A search then
+ *     takes a handful of cache misses rather than one per level of a binary
+ *     tree, and traversal walks through memory in order.
+ *
+ *     The same functions are used on it as on any other CN_Map, with a few
+ *     differences:
+ *
+ *     - Inserting or erasing shifts pairs around within the leaves, so it
+ *       invalidates every iterator into the CN_Map, and any pointer to a key
+ *       or value in it.
+ *
+ *     - The "CNM_NODE *" given to a destructor only has "key" and "data".
+ *
+ *     - Order statistics can't be turned on. "cn_map_rank" and friends fall
+ *       back to walking the elements.
+ *
+ *     - The batch functions insert one pair at a time.
+ *
+ *     - CN_MAP_DEFINE (cn_map_typed.h) only works with red-black trees.
+ */
+
+CN_MAP new_cn_map_btree(
+	CNM_UINT s1,
+	CNM_UINT s2,
+	CNC_COMP (*cmp)(void *, void *)
+) {
+	CN_MAP obj = new_cn_map(s1, s2, cmp);
+
+	__cn_map_bt_init(obj, 0);
+	return obj;
+}
+
+/*
+ * new_cn_map_btree_int
+ *
+ * Description:
+ *     Sets up a B+ tree CN_Map (see "new_cn_map_btree") with "int" keys in
+ *     numerical order. No comparison function is needed. Searching within a
+ *     node compares several keys at once with SIMD instructions (SSE2), where
+ *     the target supports them.
+ */
+
+CN_MAP new_cn_map_btree_int(CNM_UINT s2) {
+	CN_MAP obj = new_cn_map(sizeof(int), s2, __cn_map_bt_cmp_int);
+
+	__cn_map_bt_init(obj, 1);
+	return obj;
+}
+
+/*
+ * new_cn_map_persistent
+ *
+ * Description:
+ *     Sets up a CN_Map just like "new_cn_map", but as a persistent red-black
+ *     tree. "cn_map_snapshot" then makes a copy of it in O(1), with the two
+ *     sharing every node. When either one is changed, only the nodes on the
+ *     path to the change (and the few around it that rebalancing touches) are
+ *     copied, so any other version sharing them never sees it. A node is freed
+ *     along with the last version it is in.
+ *
+ *     Key/value pairs are kept apart from the tree nodes, and are never copied.
+ *     A pair is destructed once no version has it anymore. Every version of
+ *     the CN_Map may be inserted into and erased from like any other CN_Map,
+ *     with a few differences:
+ *
+ *     - Nodes have no parent links. Instead, each thread remembers the path
+ *       down to the last node it stepped an iterator to, which keeps walking
+ *       through the CN_Map O(1) amortised. Other steps search from the head.
+ *       Inserting into or erasing from a CN_Map invalidates every iterator into
+ *       it (but not into its other versions).
+ *
+ *     - Changing a value in place changes it in every version that has it.
+ *
+ *     - Order statistics and concurrent reads can't be turned on, and the batch
+ *       functions insert one pair at a time.
+ *
+ *     - CN_MAP_DEFINE (cn_map_typed.h) only works with regular red-black trees.
+ *
+ *     Different versions may be used from different threads at once, and one
+ *     version may be read by many threads while no one writes to it.
+ */
+
+CN_MAP new_cn_map_persistent(
+	CNM_UINT s1,
+	CNM_UINT s2,
+	CNC_COMP (*cmp)(void *, void *)
+) {
+	CN_MAP       obj = new_cn_map(s1, s2, cmp);
+	CNM_PERSIST *ps  = (CNM_PERSIST *) malloc(sizeof(CNM_PERSIST));
+
+	//Tree nodes keep their own copy of the key, so searching doesn't have to
+	//go to the pair.
+	__cn_map_pool_init(&ps->nodes, CNM_KEY_OFFSET + s1);
+	__cn_map_pool_init(&ps->elems, obj->data_offset + s2);
+	pthread_mutex_init(&ps->lock, NULL);
+	ps->maps = 1;
+
+	obj->ps       = ps;
+	obj->ps_stamp = CNM_PS_STAMP();
+
+	return obj;
+}
+
 // ----------------------------------------------------------------------------
 // Function Pointer Management                                             {{{1
 // ----------------------------------------------------------------------------
@@ -100,6 +556,100 @@ void cn_map_set_func_destructor(CN_MAP obj, void (*dest)(CNM_NODE*)) {
 	obj->func_destruct = dest;
 }
 
+/*
+ * cn_map_set_order_statistics
+ *
+ * Description:
+ *     Turns the order statistic augmentation on or off. While it is on, every
+ *     node keeps track of how many nodes are in its subtree, which makes
+ *     "cn_map_rank", "cn_map_select", "cn_map_count_range", and
+ *     "cn_map_advance" O(lg N) instead of O(N). This costs a walk up the tree
+ *     on every insert and erase. Turning it on for a CN_Map that already has
+ *     elements counts them all up in O(N).
+ */
+
+void cn_map_set_order_statistics(CN_MAP obj, CNM_BYTE enable) {
+	//B+ trees don't keep subtree counts, and persistent trees need "count".
+	if (obj->bt != NULL || obj->ps != NULL)
+		return;
+
+	if (enable && !obj->order_stats && obj->head != NULL)
+		__cn_map_recount(obj->head);
+
+	obj->order_stats = (enable != 0);
+}
+
+/*
+ * cn_map_set_concurrent_reads
+ *
+ * Description:
+ *     Turns reading without locks on or off. While it is on, any number of
+ *     threads can search the CN_Map at the same time as one other thread (the
+ *     writer) inserts and erases, and none of them ever takes a lock.
+ *
+ *     Readers wrap what they do in "cn_map_read_lock" and "cn_map_read_unlock".
+ *     In between, they may call "cn_map_find", "cn_map_lower_bound",
+ *     "cn_map_upper_bound", "cn_map_begin", "cn_map_rbegin", "cn_map_next",
+ *     "cn_map_prev", "cn_map_at_end", and "cn_map_size", and read keys and
+ *     values through the iterators they get back. Neither iterators nor the
+ *     keys and values they point at may be used after unlocking. Everything
+ *     else is left to the writer, and only one thread may write at a time.
+ *
+ *     The writer marks the tree as changing while it works on it, like a
+ *     seqlock. A reader that finds a change in progress waits for it to end
+ *     before searching, and one that was searching during a change starts its
+ *     search over. Calls that change many nodes at once ("cn_map_union",
+ *     "cn_map_erase_range", "cn_map_insert_batch" and the like) are a single
+ *     change, so readers wait for the whole call. Nodes that are erased aren't
+ *     destructed or given back right away. They wait until every reader that
+ *     might have seen them has unlocked. The writer never waits on readers,
+ *     except in "cn_map_clear" (and when turning this off).
+ *
+ *     Stepping an iterator searches down from the head, so it is O(lg N) while
+ *     this is on. B+ tree CN_Maps, persistent CN_Maps, CN_Maps that own their
+ *     string keys, and CN_Maps sharing node memory with others (see
+ *     "cn_map_split") can't be read this way, and are left alone. Only turn
+ *     this on or off while no other thread is using the CN_Map.
+ */
+
+void cn_map_set_concurrent_reads(CN_MAP obj, CNM_BYTE enable) {
+	CNM_EPOCH *ep;
+	void      *mem;
+
+	if (obj->bt != NULL || obj->ps != NULL || (obj->str_keys & CNM_STR_OWNED))
+		return;
+
+	if (enable && obj->share != NULL)
+		return;
+
+	if (!enable) {
+		if (obj->epoch == NULL)
+			return;
+
+		//Give back everything still waiting on readers.
+		__cn_map_epoch_sync(obj);
+
+		free(obj->epoch->retired);
+		free(obj->epoch);
+		obj->epoch = NULL;
+		return;
+	}
+
+	if (obj->epoch != NULL)
+		return;
+
+	if (posix_memalign(&mem, CNM_CACHE_LINE, sizeof(CNM_EPOCH)) != 0)
+		mem = malloc(sizeof(CNM_EPOCH));
+
+	ep = (CNM_EPOCH *) mem;
+	memset(ep, 0, sizeof(CNM_EPOCH));
+
+	//Epoch 0 marks a free reader slot.
+	ep->global = 1;
+
+	obj->epoch = ep;
+}
+
 // ----------------------------------------------------------------------------
 // Add                                                                     {{{1
 // ----------------------------------------------------------------------------
@@ -111,1005 +661,7163 @@ void cn_map_set_func_destructor(CN_MAP obj, void (*dest)(CNM_NODE*)) {
  *     Inserts a key/value pair into the CN_Map. The value can be blank. If so,
  *     it is filled with 0's, as defined in "__cn_map_create_node".
  *
+ *     If the key is already in the CN_Map, nothing is inserted. The destructor
+ *     (if there is one) is still called on a copy of the rejected pair, since
+ *     the CN_Map is treated as the owner of whatever was passed in.
+ *
  * Complexity:
- *     O(N lg N)
+ *     O(lg N)
  */
 
 CNM_UINT cn_map_insert(CN_MAP obj, void *key, void *value) {
-	//Copy the key and value into a new node and prepare it to put into tree.
-	CNM_NODE *new_node = __cn_map_create_node(
-		key,
-		value,
-		obj->key_size,
-		obj->elem_size
-	);
-
-	obj->size++;
-
-	if (obj->head == NULL) {
-		//Just insert the node in as the new head.
-		obj->head = new_node;
-		obj->head->colour = CNM_BLACK;
+	CNM_ITERATOR it;
+	CNM_BYTE     locked;
 
-		//Calibrate the tree to properly assign pointers.
-		__cn_map_calibrate(obj);
+	if (cn_map_try_insert(obj, &it, key, value))
 		return 1;
+
+	//Key exists. Let the destructor clean up what was passed in.
+	if (obj->func_destruct != NULL) {
+		locked = __cn_map_ps_lock(obj);
+		__cn_map_free_node(obj, __cn_map_create_node(obj, key, value));
+		__cn_map_ps_unlock(obj, locked);
 	}
 
-	//Traverse the tree until we hit the end or find a side that is NULL
-	CNM_NODE *cur = obj->head;
-	CNM_NODE *target;
-	CNC_COMP res;
+	return 0;
+}
 
-	while (1) {
-		res = obj->func_compare(new_node->key, cur->key);
+/*
+ * cn_map_try_insert
+ *
+ * Description:
+ *     Inserts a key/value pair into the CN_Map, much like "cn_map_insert".
+ *     However, the tree is searched before anything is allocated. If the key
+ *     already exists, nothing is copied and the destructor is not called.
+ *
+ *     Either way, "it" is set to the element with that key (the new one or the
+ *     one that was already there). Returns 1 if the pair was inserted, and 0 if
+ *     the key already existed. This mirrors the iterator/bool pair returned by
+ *     C++'s "std::map::insert".
+ *
+ * Complexity:
+ *     O(lg N)
+ */
 
-		//If the key matches something else, we can't insert
-		if (res == 0) {
-			__cn_map_free_node(obj, new_node);
-			return 0;
-		}
-		else {
-			//If not null, traverse.
-			//If null, set.
-			if (res < 0) {
-				if (cur->left == NULL) {
-					cur->left = new_node;
-					new_node->up = cur;
-					__cn_map_fix_colours(obj, new_node);
-					break;
-				}
-				else
-					cur = cur->left;
-			}
-			else {
-				if (cur->right == NULL) {
-					cur->right = new_node;
-					new_node->up = cur;
-					__cn_map_fix_colours(obj, new_node);
-					break;
-				}
-				else
-					cur = cur->right;
-			}
-		}
+CNM_UINT cn_map_try_insert(
+	CN_MAP        obj,
+	CNM_ITERATOR *it,
+	void         *key,
+	void         *value
+) {
+	CNM_NODE *cur, *new_node;
+	CNC_COMP  res;
+
+	if (obj->bt != NULL)
+		return __cn_map_bt_insert(obj, it, key, value);
+
+	if (obj->ps != NULL)
+		return __cn_map_ps_insert(obj, it, key, value);
+
+	//Traverse the tree until we find the key or a side that is NULL
+	cur = __cn_map_descend(obj, obj->head, key, &res);
+
+	//If the key matches something else, we can't insert
+	if (cur != NULL && res == 0) {
+		it->node = cur;
+		it->prev = cur->up;
+		return 0;
 	}
 
-	__cn_map_calibrate(obj);
+	//Only now copy the key and value into a new node and put it in.
+	new_node = __cn_map_create_node(obj, key, value);
+	__cn_map_attach(obj, cur, (res < 0), new_node);
+
+	it->node = new_node;
+	it->prev = new_node->up;
 
 	//Insertion complete.
 	return 1;
 }
 
-// ----------------------------------------------------------------------------
-// Get Functions                                                           {{{1
-// ----------------------------------------------------------------------------
+/*
+ * cn_map_insert_hint
+ *
+ * Description:
+ *     Inserts a key/value pair into the CN_Map using "it" as a hint of where
+ *     the key belongs. The hint is correct if the key goes right before or
+ *     right after the element "it" points to. An "end" iterator hints that the
+ *     key goes after every other element. If the hint is right, the node is
+ *     attached there without searching from the head. If it is wrong, this
+ *     falls back to "cn_map_try_insert".
+ *
+ *     Like "cn_map_try_insert", nothing is allocated if the key exists, and
+ *     "it" is set to the element with that key afterwards. Feeding it back in
+ *     as the next hint makes inserting sorted input very cheap.
+ *
+ * Complexity:
+ *     O(1) amortised (plus rebalancing) if the hint is right. O(lg N) if not.
+ */
 
-void cn_map_find(CN_MAP obj, CNM_ITERATOR *it, void *key) {
-	//End the search instantly if there's nothing.
-	if (obj->head == NULL) {
-		it->node = it->prev = NULL;
-		return;
+CNM_UINT cn_map_insert_hint(
+	CN_MAP        obj,
+	CNM_ITERATOR *it,
+	void         *key,
+	void         *value
+) {
+	CNM_NODE *hint = it->node;
+	CNM_NODE *next, *parent, *new_node;
+	CNM_BYTE  left;
+	CNC_COMP  res;
+
+	//Nothing to search in (or no parent links to follow). Let the regular
+	//path deal with it.
+	if (obj->head == NULL || obj->ps != NULL)
+		return cn_map_try_insert(obj, it, key, value);
+
+	//"end" means the key should come after the most element.
+	if (hint == NULL)
+		hint = obj->it_most.node;
+
+	res = obj->func_compare(key, hint->key);
+
+	if (res == 0) {
+		it->node = hint;
+		it->prev = hint->up;
+		return 0;
 	}
 
-	//Basically a repeat of insert
-	CNM_NODE *cur = obj->head;
-	CNM_NODE *target;
-	CNC_COMP res;
-	
-	//Binary Search
-	while (1) {
-		res = obj->func_compare(key, cur->key);
-
-		//If the key matches, we hit our target
-		if (res == 0) {
-			break;
-		}
-		else
-		if (res < 0) {
-			if (cur->left == NULL) {
-				cur = NULL;
-				break;
-			}
-			else
-				cur = cur->left;
+	if (res < 0) {
+		//Key goes before the hint. It has to be after the hint's predecessor.
+		if (hint == obj->it_least.node) {
+			parent = hint;
+			left   = 1;
 		}
 		else {
-			if (cur->right == NULL) {
-				cur = NULL;
-				break;
+			next = __cn_map_predecessor(hint);
+			res  = obj->func_compare(key, next->key);
+
+			if (res <= 0) {
+				if (res < 0)
+					return cn_map_try_insert(obj, it, key, value);
+
+				it->node = next;
+				it->prev = next->up;
+				return 0;
+			}
+
+			//The hint's left side is empty, or the predecessor's right is.
+			if (hint->left == NULL) {
+				parent = hint;
+				left   = 1;
+			}
+			else {
+				parent = next;
+				left   = 0;
 			}
-			else
-				cur = cur->right;
 		}
 	}
+	else {
+		//Key goes after the hint. It has to be before the hint's successor.
+		if (hint == obj->it_most.node) {
+			parent = hint;
+			left   = 0;
+		}
+		else {
+			next = __cn_map_successor(hint);
+			res  = obj->func_compare(key, next->key);
 
-	if (cur != NULL) {
-		it->node = cur;
+			if (res >= 0) {
+				if (res > 0)
+					return cn_map_try_insert(obj, it, key, value);
 
-		//Generate a "prev" too
-		CNM_ITERATOR tmp;
-		tmp = *it;
-		__cn_map_prev(obj, &tmp);
-		it->prev = tmp.node;
-	}
-	else {
-		it->node = NULL;
-	}
-}
+				it->node = next;
+				it->prev = next->up;
+				return 0;
+			}
 
-CNM_UINT cn_map_size(CN_MAP obj) {
-	return obj->size;
-}
+			//The hint's right side is empty, or the successor's left is.
+			if (hint->right == NULL) {
+				parent = hint;
+				left   = 0;
+			}
+			else {
+				parent = next;
+				left   = 1;
+			}
+		}
+	}
 
-CNM_BYTE cn_map_empty(CN_MAP obj) {
-	return (obj->size == 0);
-}
+	//The hint was right. Attach directly.
+	new_node = __cn_map_create_node(obj, key, value);
+	__cn_map_attach(obj, parent, left, new_node);
 
-CNM_UINT cn_map_key_size(CN_MAP obj) {
-	return obj->key_size;
-}
+	it->node = new_node;
+	it->prev = new_node->up;
 
-CNM_UINT cn_map_value_size(CN_MAP obj) {
-	return obj->elem_size;
+	return 1;
 }
 
-// ----------------------------------------------------------------------------
-// Iteration Functions                                                     {{{1
-// ----------------------------------------------------------------------------
-
 /*
- * cn_map_begin
+ * cn_map_build_sorted
  *
  * Description:
- *     Creates and returns a struct that contains a pointer to the key/value
- *     pair at the beginning of the map.
+ *     Replaces the contents of the CN_Map with "n" key/value pairs taken from
+ *     the arrays "keys" and "values". Element "i" of each array is at byte
+ *     offset "i * key_size" and "i * value_size" respectively. "values" may be
+ *     NULL, in which case every value is filled with 0's.
+ *
+ *     The keys must already be sorted (by the comparison function) from least
+ *     to most. Runs of equal keys are collapsed into the first one. If the
+ *     keys are out of order, the CN_Map is left untouched and 0 is returned.
+ *     Otherwise, the number of elements now in the CN_Map is returned.
+ *
+ *     Rather than inserting one at a time, the nodes are made in order and
+ *     linked into a perfectly balanced tree, with the bottom row coloured red
+ *     and every other node black. There are no rotations or recolours.
+ *
+ * Complexity:
+ *     O(N)
  */
 
-void cn_map_begin(CN_MAP obj, CNM_ITERATOR *it) {
-	//If there is nothing, return a blank iterator.
-	if (obj->size == 0) {
-		*it = obj->it_end;
-		return;
+CNM_UINT cn_map_build_sorted(
+	CN_MAP    obj,
+	void     *keys,
+	void     *values,
+	CNM_UINT  n
+) {
+	CNM_BYTE *key = (CNM_BYTE *) keys,
+	         *val = (CNM_BYTE *) values;
+	CNM_NODE *list, **tail, *node;
+	CNM_UINT  i, count;
+	CNC_COMP  res;
+
+	//Make sure the keys are in order, and count how many are unique.
+	count = (n > 0);
+	for (i = 1; i < n; i++) {
+		res = obj->func_compare(
+			key + (size_t) i * obj->key_size,
+			key + (size_t) (i - 1) * obj->key_size
+		);
+
+		if (res < 0)
+			return 0;
+
+		count += (res > 0);
 	}
 
-	//Traverse down to the left until we can't anymore.
-	it->node = obj->head;
-	while (it->node->left != NULL)
-		it->node = it->node->left;
+	cn_map_clear(obj);
 
-	//Mark the previous node as the parent
-	it->prev = it->node->up;
-}
+	if (obj->bt != NULL || obj->ps != NULL)
+		return __cn_map_insert_array(obj, key, val, n, 0);
 
-/*
- * cn_map_end
- *
- * Description:
- *     Creates and returns a struct that contains a pointer to the key/value
- *     pair at the end of the map (NULL, in this case).
- */
+	//Make the nodes in order, chained through their right pointers.
+	list = NULL;
+	tail = &list;
 
-void cn_map_end(CN_MAP obj, CNM_ITERATOR *it) {
-	*it = obj->it_end;
+	for (i = 0; i < n; i++) {
+		if (i > 0 && obj->func_compare(
+			key + (size_t) i * obj->key_size,
+			key + (size_t) (i - 1) * obj->key_size
+		) == 0)
+			continue;
+
+		node = __cn_map_create_node(
+			obj,
+			key + (size_t) i * obj->key_size,
+			(val == NULL) ? NULL : val + (size_t) i * obj->elem_size
+		);
+
+		*tail = node;
+		tail  = &node->right;
+	}
+
+	__cn_map_write_begin(obj);
+	__cn_map_build_tree(obj, list, count);
+	__cn_map_write_end(obj);
+
+	return obj->size;
 }
 
 /*
- * cn_map_rbegin
+ * cn_map_build_unsorted
  *
  * Description:
- *     Creates and returns a struct that contains a pointer to the key/value
- *     pair at the reverse beginning of the map.
+ *     Like "cn_map_build_sorted", but the keys may come in any order. The pairs
+ *     are sorted by the comparison function first, split across one thread
+ *     per core for large inputs, so the comparison function must be safe to
+ *     call from multiple threads at once. The arrays themselves are not
+ *     modified.
+ *
+ *     If a key shows up more than once, "keep" decides whether the pair that
+ *     comes first (CNM_KEEP_FIRST) or last (CNM_KEEP_LAST) in the arrays is
+ *     the one put in the CN_Map. The sorted pairs are then linked up into a
+ *     balanced tree in a single pass. Returns the number of elements in the
+ *     CN_Map afterwards.
+ *
+ * Complexity:
+ *     O(N lg N) work for the sort. The tree build is O(N).
  */
 
-void cn_map_rbegin(CN_MAP obj, CNM_ITERATOR *it) {
-	//If there is nothing, return a blank iterator.
-	if (obj->size == 0) {
-		*it = obj->it_end;
-		return;
+CNM_UINT cn_map_build_unsorted(
+	CN_MAP    obj,
+	void     *keys,
+	void     *values,
+	CNM_UINT  n,
+	CNM_DUP   keep
+) {
+	CNM_BYTE *key = (CNM_BYTE *) keys,
+	         *val = (CNM_BYTE *) values;
+	CNM_UINT *order, i, j, pick, count;
+	CNM_NODE *list, **tail, *node;
+
+	cn_map_clear(obj);
+
+	if (n == 0)
+		return 0;
+
+	if (obj->bt != NULL || obj->ps != NULL)
+		return __cn_map_insert_array(
+			obj, key, val, n, (keep == CNM_KEEP_LAST)
+		);
+
+	//Sort an index array rather than moving the pairs themselves.
+	order = __cn_map_sort_index(obj, key, n);
+
+	list  = NULL;
+	tail  = &list;
+	count = 0;
+
+	for (i = 0; i < n; i = j) {
+		//Find the run of equal keys. The sort is stable, so it is in the same
+		//order the keys were given in.
+		for (j = i + 1; j < n; j++) {
+			if (obj->func_compare(
+				key + (size_t) order[i] * obj->key_size,
+				key + (size_t) order[j] * obj->key_size
+			) != 0)
+				break;
+		}
+
+		pick = (keep == CNM_KEEP_LAST) ? order[j - 1] : order[i];
+
+		node = __cn_map_create_node(
+			obj,
+			key + (size_t) pick * obj->key_size,
+			(val == NULL) ? NULL : val + (size_t) pick * obj->elem_size
+		);
+
+		*tail = node;
+		tail  = &node->right;
+		count++;
 	}
 
-	//Traverse down to the right until we can't anymore.
-	it->node = obj->head;
-	while (it->node->right != NULL)
-		it->node = it->node->right;
+	free(order);
 
-	//Mark the previous node as the parent
-	it->prev = it->node->up;
+	__cn_map_write_begin(obj);
+	__cn_map_build_tree(obj, list, count);
+	__cn_map_write_end(obj);
+
+	return obj->size;
 }
 
 /*
- * cn_map_rend
+ * cn_map_insert_batch
  *
  * Description:
- *     Creates and returns a struct that contains a pointer to the key/value
- *     pair at the reverse end of the map (NULL, in this case).
+ *     Inserts "n" key/value pairs from the arrays "keys" and "values" (laid out
+ *     like in "cn_map_build_sorted") into a CN_Map that may already have data
+ *     in it. "values" may be NULL. Keys already in the CN_Map are left alone,
+ *     as are repeats within the batch after the first. Returns how many pairs
+ *     were inserted.
+ *
+ *     The batch is sorted first (see "cn_map_build_unsorted"). Then, one of two
+ *     strategies is used depending on how big the batch is compared to the
+ *     CN_Map (see CNM_BATCH_REBUILD_RATIO):
+ *
+ *     - Large batches are merged with the in-order list of existing nodes and
+ *       the whole tree is rebuilt balanced in one linear pass.
+ *
+ *     - Small batches are inserted in sorted order. Each search starts from
+ *       where the previous key went (a finger search), climbing only as far up
+ *       as needed, rather than from the head.
+ *
+ * Complexity:
+ *     O(M lg M) to sort the batch of M, then O(N + M) or O(M lg(N / M)).
  */
 
-void cn_map_rend(CN_MAP obj, CNM_ITERATOR *it) {
-	*it = obj->it_end;
+CNM_UINT cn_map_insert_batch(
+	CN_MAP    obj,
+	void     *keys,
+	void     *values,
+	CNM_UINT  n
+) {
+	CNM_BYTE *key = (CNM_BYTE *) keys,
+	         *val = (CNM_BYTE *) values;
+	CNM_UINT *order, i, count, before;
+	CNM_NODE *finger, *cur, *list, **tail, *node;
+	void     *k;
+	CNC_COMP  res;
+
+	if (n == 0)
+		return 0;
+
+	if (obj->bt != NULL || obj->ps != NULL)
+		return __cn_map_insert_array(obj, key, val, n, 0);
+
+	order  = __cn_map_sort_index(obj, key, n);
+	before = obj->size;
+
+	if ((CNM_U64) n * CNM_BATCH_REBUILD_RATIO >= obj->size) {
+		//Merge the existing nodes with the batch, then rebuild.
+		__cn_map_write_begin(obj);
+
+		cur = NULL;
+		if (obj->head != NULL)
+			__cn_map_flatten(obj->head, &cur);
+
+		list  = NULL;
+		tail  = &list;
+		count = 0;
+
+		for (i = 0; i < n || cur != NULL; ) {
+			if (i == n)
+				res = 1;
+			else
+			if (cur == NULL)
+				res = -1;
+			else
+				res = obj->func_compare(
+					key + (size_t) order[i] * obj->key_size, cur->key
+				);
+
+			if (res < 0) {
+				//Take from the batch.
+				node = __cn_map_create_node(
+					obj,
+					key + (size_t) order[i] * obj->key_size,
+					(val == NULL) ? NULL : val + (size_t) order[i] * obj->elem_size
+				);
+			}
+			else {
+				//Take the existing node.
+				node = cur;
+				cur  = cur->right;
+			}
+
+			CNM_STORE(*tail, node);
+			tail = &node->right;
+			count++;
+
+			//Skip over the batch keys that match what was just taken.
+			if (res <= 0) {
+				for (i++; i < n; i++) {
+					if (obj->func_compare(
+						key + (size_t) order[i] * obj->key_size, node->key
+					) != 0)
+						break;
+				}
+			}
+		}
+
+		CNM_STORE(obj->head, NULL);
+		__cn_map_build_tree(obj, list, count);
+		__cn_map_write_end(obj);
+	}
+	else {
+		//Insert in order, searching from the last spot each time.
+		finger = NULL;
+
+		for (i = 0; i < n; i++) {
+			k   = key + (size_t) order[i] * obj->key_size;
+			cur = (finger == NULL)
+				? __cn_map_descend(obj, obj->head, k, &res)
+				: __cn_map_finger_descend(obj, finger, k, &res);
+
+			if (res == 0) {
+				finger = cur;
+				continue;
+			}
+
+			node = __cn_map_create_node(
+				obj,
+				k,
+				(val == NULL) ? NULL : val + (size_t) order[i] * obj->elem_size
+			);
+
+			__cn_map_attach(obj, cur, (res < 0), node);
+			finger = node;
+		}
+	}
+
+	free(order);
+
+	return obj->size - before;
 }
 
+// ----------------------------------------------------------------------------
+// Get Functions                                                           {{{1
+// ----------------------------------------------------------------------------
+
 /*
- * cn_map_next
+ * cn_map_find
  *
  * Description:
- *     Advances the iterator to the next available key/value pair.
+ *     Sets "it" to the element with a key equal to "key". If there isn't one,
+ *     "it" is set to the end.
+ *
+ * Complexity:
+ *     O(lg N)
  */
 
-void cn_map_next(CN_MAP obj, CNM_ITERATOR *it) {
-	if (it->node == NULL) {
-		//Nice try
-		it->prev = NULL;
+void cn_map_find(CN_MAP obj, CNM_ITERATOR *it, void *key) {
+	CNM_NODE *cur;
+	CNC_COMP  res;
+
+	if (obj->bt != NULL) {
+		__cn_map_bt_find(obj, it, key);
 		return;
 	}
-	else
-	if (it->node == obj->it_most.node) {
-		//We have hit the end.
-		it->prev = NULL; //it->node;
-		it->node = NULL;
+
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_bound(obj, key, CNM_READ_LOWER);
+		it->prev = NULL;
+
+		if (it->node != NULL && obj->func_compare(key, it->node->key) != 0)
+			it->node = NULL;
+
+		return;
 	}
-	else
-	if (it->node->right != NULL && it->prev != it->node->right) {
-		//There is a right child. Go to the right, and then as far left as
-		//possible.
-		it->prev = it->node;
-		it->node = it->node->right;
 
-		while (it->node->left != NULL)
-			it->node = it->node->left;
+	//Binary Search
+	cur = __cn_map_descend(obj, obj->head, key, &res);
+
+	//If the key matches, we hit our target
+	if (cur != NULL && res == 0) {
+		it->node = cur;
+		it->prev = cur->up;
 	}
 	else {
-		//Go up. How much depends on what "prev" is.
-		it->prev = it->node;
-		it->node = it->node->up;
-
-		//Keep going up until we can't anymore.
-		while (it->prev == it->node->right) {
-			it->prev = it->node;
-			it->node = it->node->up;
-		}
+		it->node = it->prev = NULL;
 	}
 }
 
 /*
- * cn_map_prev
+ * cn_map_find_batch
  *
  * Description:
- *     Advances the iterator to the previous available key/value pair.
+ *     Looks up "n" keys from the array "keys" (laid out like in
+ *     "cn_map_build_sorted") and sets "out[i]" like "cn_map_find" would for
+ *     the "i"th key.
+ *
+ *     A single search is a chain of cache misses, each depending on the last.
+ *     Here, CNM_FIND_BATCH_WIDTH searches are stepped through in lockstep. The
+ *     next node of each search is prefetched before moving on to the others,
+ *     so their misses overlap instead of happening one after another. When a
+ *     search finishes, the next key takes over its slot.
+ *
+ * Complexity:
+ *     O(N lg M)
  */
 
-void cn_map_prev(CN_MAP obj, CNM_ITERATOR *it) {
-	__cn_map_prev(obj, it);
+void cn_map_find_batch(
+	CN_MAP        obj,
+	void         *keys,
+	CNM_UINT      n,
+	CNM_ITERATOR *out
+) {
+	CNM_BYTE     *key = (CNM_BYTE *) keys;
+	CNM_NODE     *cur[CNM_FIND_BATCH_WIDTH], *node, *next;
+	CNM_UINT      idx[CNM_FIND_BATCH_WIDTH];
+	CNM_STR_QUERY q  [CNM_FIND_BATCH_WIDTH];
+	CNM_UINT      lanes, active, fed, i;
+	CNC_COMP      res;
 
-	//Compute "prev"
-	CNM_ITERATOR tmp;
-	tmp = *it;
-	__cn_map_prev(obj, &tmp);
-	it->prev = tmp.node;
-}
+	if (obj->bt != NULL) {
+		for (i = 0; i < n; i++)
+			__cn_map_bt_find(obj, &out[i], key + (size_t) i * obj->key_size);
 
-void __cn_map_prev(CN_MAP obj, CNM_ITERATOR *it) {
-	if (it->node == NULL) {
-		//Nice try
-		it->prev = NULL;
 		return;
 	}
-	else
-	if (it->node == obj->it_least.node) {
-		//We have hit the end.
-		it->prev = NULL; //it->node;
-		it->node = NULL;
-	}
-	else
-	//To the left, and then as far right as possible.
-	if (it->node->left != NULL) {
-		it->node = it->node->left;
 
-		while (it->node->right != NULL)
-			it->node = it->node->right;
+	//Start as many searches as there are lanes.
+	lanes = (n < CNM_FIND_BATCH_WIDTH) ? n : CNM_FIND_BATCH_WIDTH;
+	fed   = 0;
+
+	for (i = 0; i < lanes; i++) {
+		idx[i] = fed++;
+		cur[i] = obj->head;
+
+		if (obj->str_keys)
+			__cn_map_str_query(
+				obj, &q[i], key + (size_t) idx[i] * obj->key_size
+			);
 	}
-	else {
-		//Keep going up until there is a left child
-		it->prev = it->node;
-		it->node = it->node->up;
 
-		if (it->node == NULL)
-			return;
+	active = lanes;
+	if (obj->head != NULL)
+		CNM_PREFETCH((CNM_BYTE *) obj->head + CNM_KEY_OFFSET);
+
+	while (active > 0) {
+		for (i = 0; i < lanes; i++) {
+			if (idx[i] == n)
+				continue;
+
+			//Take one step down in this lane.
+			node = cur[i];
+
+			if (node != NULL) {
+				res = obj->str_keys
+					? __cn_map_str_compare(obj, &q[i], node)
+					: obj->func_compare(
+						key + (size_t) idx[i] * obj->key_size, node->key
+					);
+
+				if (res != 0) {
+					next = (res < 0) ? node->left : node->right;
+
+					if (next != NULL) {
+						cur[i] = next;
+						CNM_PREFETCH(next);
+						CNM_PREFETCH((CNM_BYTE *) next + CNM_KEY_OFFSET);
+						continue;
+					}
+
+					//Fell off of the tree. Not found.
+					node = NULL;
+				}
+			}
+
+			out[idx[i]].node = node;
+			out[idx[i]].prev = (node == NULL) ? NULL : node->up;
 
-		//Well... okay
-		while (
-			it->node->up   != NULL &&
-			it->node->left != NULL &&
-			it->node->left == it->prev
-		) {
-			it->prev = it->node;
-			it->node = it->node->up;
+			//This lane is done. Feed it the next key, if there is one.
+			if (fed < n) {
+				idx[i] = fed++;
+				cur[i] = obj->head;
+
+				if (obj->str_keys)
+					__cn_map_str_query(
+						obj, &q[i], key + (size_t) idx[i] * obj->key_size
+					);
+			}
+			else {
+				idx[i] = n;
+				active--;
+			}
 		}
 	}
 }
 
 /*
- * cn_map_at_begin
+ * cn_map_find_batch_sorted
  *
  * Description:
- *     Returns true if at the the rend of the CN_Map
+ *     Same as "cn_map_find_batch", but the keys must be sorted from least to
+ *     most. Neighbouring keys share most of their path from the head, so each
+ *     search starts from where the last one ended (a finger search). It only
+ *     climbs as far as it needs to before searching down again.
+ *
+ * Complexity:
+ *     O(N lg(M / N)) for keys spread evenly through the CN_Map.
  */
 
-CNM_BYTE cn_map_at_begin(CN_MAP obj, CNM_ITERATOR *it) {
-	return (it->node == obj->it_least.node);
+void cn_map_find_batch_sorted(
+	CN_MAP        obj,
+	void         *keys,
+	CNM_UINT      n,
+	CNM_ITERATOR *out
+) {
+	CNM_BYTE *key = (CNM_BYTE *) keys;
+	CNM_NODE *cur = NULL;
+	CNM_UINT  i;
+	void     *k;
+	CNC_COMP  res;
+
+	//No parent links to climb.
+	if (obj->bt != NULL || obj->ps != NULL) {
+		cn_map_find_batch(obj, keys, n, out);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		k   = key + (size_t) i * obj->key_size;
+		cur = (cur == NULL)
+			? __cn_map_descend       (obj, obj->head, k, &res)
+			: __cn_map_finger_descend(obj, cur      , k, &res);
+
+		if (cur != NULL && res == 0) {
+			out[i].node = cur;
+			out[i].prev = cur->up;
+		}
+		else
+			out[i].node = out[i].prev = NULL;
+	}
 }
 
 /*
- * cn_map_at_end
+ * cn_map_lower_bound
  *
  * Description:
- *     Returns true if at the the rend of the CN_Map
+ *     Sets "it" to the first element whose key is not less than "key". If
+ *     every key is less, "it" is set to the end.
+ *
+ * Complexity:
+ *     O(lg N)
  */
 
-CNM_BYTE cn_map_at_end(CN_MAP obj, CNM_ITERATOR *it) {
-	return (it->node == NULL);
+void cn_map_lower_bound(CN_MAP obj, CNM_ITERATOR *it, void *key) {
+	if (obj->bt != NULL) {
+		__cn_map_bt_bound(obj, it, key, 0);
+		return;
+	}
+
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_bound(obj, key, CNM_READ_LOWER);
+		it->prev = NULL;
+		return;
+	}
+
+	it->node = __cn_map_bound(obj, key, 0);
+	it->prev = (it->node == NULL) ? NULL : it->node->up;
 }
 
 /*
- * cn_map_at_rbegin
+ * cn_map_upper_bound
  *
  * Description:
- *     Returns true if at the the rend of the CN_Map
+ *     Sets "it" to the first element whose key is greater than "key". If no
+ *     key is greater, "it" is set to the end.
+ *
+ * Complexity:
+ *     O(lg N)
  */
 
-CNM_BYTE cn_map_at_rbegin(CN_MAP obj, CNM_ITERATOR *it) {
-	return (it->node == obj->it_most.node);
+void cn_map_upper_bound(CN_MAP obj, CNM_ITERATOR *it, void *key) {
+	if (obj->bt != NULL) {
+		__cn_map_bt_bound(obj, it, key, 1);
+		return;
+	}
+
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_bound(obj, key, CNM_READ_UPPER);
+		it->prev = NULL;
+		return;
+	}
+
+	it->node = __cn_map_bound(obj, key, 1);
+	it->prev = (it->node == NULL) ? NULL : it->node->up;
 }
 
 /*
- * cn_map_at_rend
+ * cn_map_equal_range
  *
  * Description:
- *     Returns true if at the the rend of the CN_Map
+ *     Sets "first" and "last" to the range of elements with a key equal to
+ *     "key", as the lower and upper bound respectively. Since keys in a CN_Map
+ *     are unique, the range holds one element or none. If none, both are set
+ *     to where "key" would go.
+ *
+ * Complexity:
+ *     O(lg N)
  */
 
-CNM_BYTE cn_map_at_rend(CN_MAP obj, CNM_ITERATOR *it) {
-	return (it->node == NULL);
-}
-
+void cn_map_equal_range(
+	CN_MAP        obj,
+	CNM_ITERATOR *first,
+	CNM_ITERATOR *last,
+	void         *key
+) {
+	cn_map_lower_bound(obj, first, key);
+	*last = *first;
+
+	//If the key is there, the upper bound is the one right after it.
+	if (obj->bt != NULL) {
+		if (first->node != NULL &&
+			obj->func_compare(key, first->node->key) == 0
+		)
+			__cn_map_bt_next(last);
+	}
+	else if (first->node != NULL &&
+		obj->func_compare(key, first->node->key) == 0
+	) {
+		last->node = (obj->ps != NULL)
+			? __cn_map_bound(obj, key, 1)
+			: __cn_map_successor(first->node);
+		last->prev = (last->node == NULL) ? NULL : last->node->up;
+	}
+}
+
+CNM_UINT cn_map_size(CN_MAP obj) {
+	return obj->size;
+}
+
+CNM_BYTE cn_map_empty(CN_MAP obj) {
+	return (obj->size == 0);
+}
+
+CNM_UINT cn_map_key_size(CN_MAP obj) {
+	return obj->key_size;
+}
+
+CNM_UINT cn_map_value_size(CN_MAP obj) {
+	return obj->elem_size;
+}
+
+// ----------------------------------------------------------------------------
+// Order Statistics                                                        {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_rank
+ *
+ * Description:
+ *     Returns how many keys in the CN_Map are less than "key". If "key" is in
+ *     the CN_Map, this is its 0-based position in order.
+ *
+ * Complexity:
+ *     O(lg N) with order statistics on. O(N) otherwise.
+ */
+
+CNM_UINT cn_map_rank(CN_MAP obj, void *key) {
+	CNM_NODE     *node = obj->head;
+	CNM_UINT      rank = 0;
+	CNM_ITERATOR  it;
+	CNC_COMP      res;
+
+	//Without subtree counts, just count from the beginning.
+	if (!obj->order_stats) {
+		cn_map_traverse(obj, &it) {
+			if (obj->func_compare(it.node->key, key) >= 0)
+				break;
+
+			rank++;
+		}
+
+		return rank;
+	}
+
+	while (node != NULL) {
+		res = obj->func_compare(key, node->key);
+
+		if (res <= 0) {
+			if (res == 0)
+				return rank + CNM_COUNT(node->left);
+
+			node = node->left;
+		}
+		else {
+			//Everything on the left, and this node, are less than "key".
+			rank += CNM_COUNT(node->left) + 1;
+			node = node->right;
+		}
+	}
+
+	return rank;
+}
+
+/*
+ * cn_map_select
+ *
+ * Description:
+ *     Sets "it" to the element at 0-based position "i" in order. If "i" is
+ *     not less than the size of the CN_Map, "it" is set to the end.
+ *
+ * Complexity:
+ *     O(lg N) with order statistics on. O(N) otherwise.
+ */
+
+void cn_map_select(CN_MAP obj, CNM_ITERATOR *it, CNM_UINT i) {
+	CNM_NODE *node = obj->head;
+	CNM_UINT  left;
+
+	if (i >= obj->size) {
+		*it = obj->it_end;
+		return;
+	}
+
+	//Without subtree counts, just walk there from the beginning.
+	if (!obj->order_stats) {
+		for (cn_map_begin(obj, it); i > 0; i--)
+			cn_map_next(obj, it);
+
+		return;
+	}
+
+	while (1) {
+		left = CNM_COUNT(node->left);
+
+		if (i == left)
+			break;
+
+		if (i < left)
+			node = node->left;
+		else {
+			i -= left + 1;
+			node = node->right;
+		}
+	}
+
+	it->node = node;
+	it->prev = node->up;
+}
+
+/*
+ * cn_map_count_range
+ *
+ * Description:
+ *     Returns how many keys in the CN_Map are in the range ["lo", "hi"). That
+ *     is, not less than "lo" and less than "hi".
+ *
+ * Complexity:
+ *     O(lg N) with order statistics on. O(N) otherwise.
+ */
+
+CNM_UINT cn_map_count_range(CN_MAP obj, void *lo, void *hi) {
+	CNM_UINT r_lo, r_hi;
+
+	if (obj->func_compare(lo, hi) >= 0)
+		return 0;
+
+	r_lo = cn_map_rank(obj, lo);
+	r_hi = cn_map_rank(obj, hi);
+
+	return r_hi - r_lo;
+}
+
+/*
+ * cn_map_advance
+ *
+ * Description:
+ *     Moves "it" forward "k" elements (or backward, if "k" is negative). If
+ *     that goes off of either side of the CN_Map, "it" is set to the end. An
+ *     end iterator counts as being one past the last element.
+ *
+ * Complexity:
+ *     O(lg N) with order statistics on. O(|k|) otherwise.
+ */
+
+void cn_map_advance(CN_MAP obj, CNM_ITERATOR *it, long k) {
+	long pos;
+
+	//Without subtree counts, step one at a time.
+	if (!obj->order_stats) {
+		if (it->node == NULL && k < 0) {
+			cn_map_rbegin(obj, it);
+			k++;
+		}
+
+		for (; k > 0 && it->node != NULL; k--)
+			cn_map_next(obj, it);
+
+		for (; k < 0 && it->node != NULL; k++)
+			cn_map_prev(obj, it);
+
+		return;
+	}
+
+	pos = (it->node == NULL)
+		? (long) obj->size
+		: (long) __cn_map_node_rank(it->node);
+
+	pos += k;
+
+	if (pos < 0 || pos >= (long) obj->size) {
+		*it = obj->it_end;
+		return;
+	}
+
+	cn_map_select(obj, it, (CNM_UINT) pos);
+}
+
+// ----------------------------------------------------------------------------
+// Iteration Functions                                                     {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_begin
+ *
+ * Description:
+ *     Creates and returns a struct that contains a pointer to the key/value
+ *     pair at the beginning of the map. This is the least element, which is
+ *     always kept track of, so it is O(1).
+ */
+
+void cn_map_begin(CN_MAP obj, CNM_ITERATOR *it) {
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_end(obj, 0);
+		it->prev = NULL;
+		return;
+	}
+
+	//If there is nothing, return a blank iterator.
+	if (obj->size == 0) {
+		*it = obj->it_end;
+		return;
+	}
+
+	if (obj->bt != NULL) {
+		*it = obj->it_least;
+		return;
+	}
+
+	it->node = obj->it_least.node;
+
+	//Mark the previous node as the parent
+	it->prev = it->node->up;
+}
+
+/*
+ * cn_map_end
+ *
+ * Description:
+ *     Creates and returns a struct that contains a pointer to the key/value
+ *     pair at the end of the map (NULL, in this case).
+ */
+
+void cn_map_end(CN_MAP obj, CNM_ITERATOR *it) {
+	*it = obj->it_end;
+}
+
+/*
+ * cn_map_rbegin
+ *
+ * Description:
+ *     Creates and returns a struct that contains a pointer to the key/value
+ *     pair at the reverse beginning of the map. This is the most element,
+ *     which is always kept track of, so it is O(1).
+ */
+
+void cn_map_rbegin(CN_MAP obj, CNM_ITERATOR *it) {
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_end(obj, 1);
+		it->prev = NULL;
+		return;
+	}
+
+	//If there is nothing, return a blank iterator.
+	if (obj->size == 0) {
+		*it = obj->it_end;
+		return;
+	}
+
+	if (obj->bt != NULL) {
+		*it = obj->it_most;
+		return;
+	}
+
+	it->node = obj->it_most.node;
+
+	//Mark the previous node as the parent
+	it->prev = it->node->up;
+}
+
+/*
+ * cn_map_rend
+ *
+ * Description:
+ *     Creates and returns a struct that contains a pointer to the key/value
+ *     pair at the reverse end of the map (NULL, in this case).
+ */
+
+void cn_map_rend(CN_MAP obj, CNM_ITERATOR *it) {
+	*it = obj->it_end;
+}
+
+/*
+ * cn_map_next
+ *
+ * Description:
+ *     Advances the iterator to the next available key/value pair. This walks
+ *     through parent links, so it is O(1) amortised. A full traversal crosses
+ *     each edge of the tree at most twice.
+ */
+
+void cn_map_next(CN_MAP obj, CNM_ITERATOR *it) {
+	if (obj->bt != NULL) {
+		__cn_map_bt_next(it);
+		return;
+	}
+
+	if (it->node == NULL) {
+		//Nice try
+		it->prev = NULL;
+		return;
+	}
+
+	it->prev = it->node;
+
+	//Links might be changing, so search for the next key from the head.
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_bound(obj, it->prev->key, CNM_READ_UPPER);
+		return;
+	}
+
+	//No parent links. Retrace the path from the head instead.
+	if (obj->ps != NULL) {
+		it->node = __cn_map_ps_step(obj, it->prev, 1);
+		return;
+	}
+
+	it->node = __cn_map_successor(it->node);
+}
+
+/*
+ * cn_map_prev
+ *
+ * Description:
+ *     Advances the iterator to the previous available key/value pair. This is
+ *     the mirror of "cn_map_next", and just as fast.
+ */
+
+void cn_map_prev(CN_MAP obj, CNM_ITERATOR *it) {
+	__cn_map_prev(obj, it);
+}
+
+void __cn_map_prev(CN_MAP obj, CNM_ITERATOR *it) {
+	if (obj->bt != NULL) {
+		__cn_map_bt_prev(it);
+		return;
+	}
+
+	if (it->node == NULL) {
+		//Nice try
+		it->prev = NULL;
+		return;
+	}
+
+	it->prev = it->node;
+
+	if (obj->epoch != NULL) {
+		it->node = __cn_map_read_bound(obj, it->prev->key, CNM_READ_BELOW);
+		return;
+	}
+
+	if (obj->ps != NULL) {
+		it->node = __cn_map_ps_step(obj, it->prev, 0);
+		return;
+	}
+
+	it->node = __cn_map_predecessor(it->node);
+}
+
+/*
+ * cn_map_at_begin
+ *
+ * Description:
+ *     Returns true if at the the rend of the CN_Map
+ */
+
+CNM_BYTE cn_map_at_begin(CN_MAP obj, CNM_ITERATOR *it) {
+	return (it->node == obj->it_least.node);
+}
+
+/*
+ * cn_map_at_end
+ *
+ * Description:
+ *     Returns true if at the the rend of the CN_Map
+ */
+
+CNM_BYTE cn_map_at_end(CN_MAP obj, CNM_ITERATOR *it) {
+	return (it->node == NULL);
+}
+
+/*
+ * cn_map_at_rbegin
+ *
+ * Description:
+ *     Returns true if at the the rend of the CN_Map
+ */
+
+CNM_BYTE cn_map_at_rbegin(CN_MAP obj, CNM_ITERATOR *it) {
+	return (it->node == obj->it_most.node);
+}
+
+/*
+ * cn_map_at_rend
+ *
+ * Description:
+ *     Returns true if at the the rend of the CN_Map
+ */
+
+CNM_BYTE cn_map_at_rend(CN_MAP obj, CNM_ITERATOR *it) {
+	return (it->node == NULL);
+}
+
+// ----------------------------------------------------------------------------
+// Remove Functions                                                        {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_erase
+ *
+ * Description:
+ *     Removes a node from the CN_Map. It performs a BST delete, and then
+ *     reorders the tree so that it remains balanced.
+ *
+ *     If the node has two children, its in-order predecessor is unlinked from
+ *     the bottom of the tree and relinked into the node's spot. No keys or
+ *     values are copied around, so iterators to other elements stay valid.
+ */
+
+void cn_map_erase(CN_MAP obj, CNM_ITERATOR *it) {
+	CNM_NODE *node;
+
+	if (obj->bt != NULL) {
+		__cn_map_bt_erase(obj, it);
+		return;
+	}
+
+	if (obj->ps != NULL) {
+		__cn_map_ps_erase(obj, it);
+		return;
+	}
+
+	node = it->node;
+
+	__cn_map_write_begin(obj);
+
+	__cn_map_detach(obj, node);
+	__cn_map_free_node(obj, node);
+
+	//Nothing is left to point into the arena.
+	if (obj->size == 0)
+		__cn_map_arena_clear(&obj->arena);
+
+	__cn_map_write_end(obj);
+
+	//Reclaim the key arena once it is mostly erased strings.
+	if (obj->arena.dead >= CNM_ARENA_CHUNK && obj->arena.dead > obj->arena.live)
+		cn_map_compact_keys(obj);
+}
+
+/*
+ * cn_map_erase_range
+ *
+ * Description:
+ *     Removes every node from "first" up to, but not including, "last". "last"
+ *     may be an "end" iterator, to remove everything from "first" on. If
+ *     "last" comes before "first", the behaviour is undefined.
+ *
+ *     Rather than erasing and rebalancing once per node, the tree is split
+ *     around the range (see "__cn_map_split"), the nodes in the middle are
+ *     destructed and freed in one pass, and what is left on either side is
+ *     joined back together around the node at "last". Nodes outside of the
+ *     range stay where they are, so iterators to them stay valid.
+ *
+ *     For B+ tree and persistent CN_Maps, the nodes are erased one at a time.
+ *
+ * Complexity:
+ *     O(K + lg N) to erase K nodes. O(K lg N) if one at a time.
+ */
+
+void cn_map_erase_range(CN_MAP obj, CNM_ITERATOR *first, CNM_ITERATOR *last) {
+	CNM_NODE *head, *left, *mid, *right, *stop;
+	CNM_UINT  lh, mh, rh, removed;
+
+	if (first->node == NULL || first->node == last->node)
+		return;
+
+	if (obj->bt != NULL || obj->ps != NULL) {
+		__cn_map_erase_slow(obj, first, last);
+		return;
+	}
+
+	__cn_map_write_begin(obj);
+
+	//Cut the range out...
+	head = obj->head;
+
+	__cn_map_split(
+		obj, head, __cn_map_black_height(head), first->node->key,
+		&left, &lh, &mid, &mh
+	);
+
+	if (last->node == NULL) {
+		stop  = NULL;
+		right = NULL;
+	}
+	else
+		stop  = __cn_map_split(
+			obj, mid, mh, last->node->key, &mid, &mh, &right, &rh
+		);
+
+	//...and put the two sides back together.
+	if (stop != NULL)
+		head = __cn_map_join(obj, left, lh, stop, right, rh, &lh);
+	else
+		head = left;
+
+	if (head != NULL) {
+		head->up     = NULL;
+		head->colour = CNM_BLACK;
+	}
+
+	//"first" itself was taken out on its own by the first split.
+	__cn_map_free_node(obj, first->node);
+	removed = 1 + __cn_map_erase_nested(obj, mid);
+
+	obj->size -= removed;
+
+	CNM_STORE(obj->head, head);
+	__cn_map_calibrate(obj);
+
+	__cn_map_write_end(obj);
+
+	//Reclaim the key arena once it is mostly erased strings.
+	if (obj->arena.dead >= CNM_ARENA_CHUNK && obj->arena.dead > obj->arena.live)
+		cn_map_compact_keys(obj);
+}
+
+/*
+ * cn_map_clear
+ *
+ * Description:
+ *     Deletes all nodes in the graph. Nodes are only visited if there is a
+ *     destructor to call on them. The memory itself is handed back in bulk by
+ *     releasing the allocator chunks. Nodes in memory shared with other
+ *     CN_Maps (see "cn_map_split") go back to it one at a time instead.
+ */
+
+void cn_map_clear(CN_MAP obj) {
+	CNM_NODE *head = obj->head;
+
+	if (obj->ps != NULL) {
+		__cn_map_ps_clear(obj);
+		return;
+	}
+
+	if (obj->bt != NULL)
+		__cn_map_bt_clear(obj);
+
+	//Take the tree away from readers, then wait until none can still be in it.
+	if (obj->epoch != NULL) {
+		__cn_map_write_begin(obj);
+		CNM_STORE(obj->head, NULL);
+		obj->size = 0;
+		__cn_map_calibrate(obj);
+		__cn_map_write_end(obj);
+
+		__cn_map_epoch_sync(obj);
+	}
+
+	//Aggressively run destructors by recursion.
+	if (head != NULL && obj->func_destruct != NULL)
+		__cn_map_clear_nested(obj, head);
+
+	//Give every chunk back to the system.
+	if (obj->share != NULL)
+		__cn_map_share_release(obj, head);
+	else
+		__cn_map_pool_clear(&obj->pool);
+
+	__cn_map_arena_clear(&obj->arena);
+
+	//Reset stats
+	obj->size = 0;
+	CNM_STORE(obj->head, NULL);
+
+	__cn_map_calibrate(obj);
+}
+
+/*
+ * cn_map_compact_keys
+ *
+ * Description:
+ *     Copies every key of a CN_Map made with CNM_STR_OWNED into one fresh
+ *     arena chunk, in order, and frees the old chunks along with the space
+ *     erased keys were taking up. Erasing calls this on its own once most of
+ *     the arena is dead, so it only needs to be called to shrink the CN_Map
+ *     right away. Pointers to keys of the CN_Map are invalid afterwards, but
+ *     nodes stay where they are.
+ *
+ * Complexity:
+ *     O(N + L), where L is the total length of the keys.
+ */
+
+void cn_map_compact_keys(CN_MAP obj) {
+	CNM_ARENA old = obj->arena;
+	CNM_NODE *node;
+	char    **key;
+
+	if (!(obj->str_keys & CNM_STR_OWNED))
+		return;
+
+	__cn_map_arena_init(&obj->arena);
+
+	if (old.live > 0)
+		__cn_map_arena_grow(&obj->arena, old.live);
+
+	node = obj->it_least.node;
+
+	for (; node != NULL; node = __cn_map_successor(node)) {
+		key = (char **) node->key;
+
+		if (*key != NULL)
+			*key = __cn_map_arena_copy(
+				&obj->arena, *key, __cn_map_str_size(obj, node)
+			);
+	}
+
+	__cn_map_arena_clear(&old);
+}
+
+/*
+ * cn_map_free
+ *
+ * Description:
+ *     Frees the CN_Map from memory. Deletes all nodes. Call this when you are
+ *     done using the data structure. For a persistent CN_Map, only the nodes
+ *     no other version has are deleted.
+ */
+
+void cn_map_free(CN_MAP obj) {
+	CNM_PERSIST *ps = obj->ps;
+	CNM_SHARE   *sh = obj->share;
+
+	//Free all nodes
+	cn_map_clear(obj);
+	free(obj->bt);
+
+	if (obj->epoch != NULL) {
+		free(obj->epoch->retired);
+		free(obj->epoch);
+	}
+
+	//The last version to go takes the shared pools with it.
+	if (ps != NULL &&
+		__atomic_sub_fetch(&ps->maps, 1, __ATOMIC_ACQ_REL) == 0
+	) {
+		__cn_map_pool_clear(&ps->nodes);
+		__cn_map_pool_clear(&ps->elems);
+		pthread_mutex_destroy(&ps->lock);
+		free(ps);
+	}
+
+	//Same for node memory shared with other CN_Maps.
+	if (sh != NULL && __atomic_sub_fetch(&sh->maps, 1, __ATOMIC_ACQ_REL) == 0) {
+		__cn_map_pool_clear(&sh->pool);
+		pthread_mutex_destroy(&sh->lock);
+		free(sh);
+	}
+
+	//Free the map itself (cn_map_clear already gave back the pool chunks)
+	free(obj);
+}
+
+// ----------------------------------------------------------------------------
+// Frozen Snapshots                                                        {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_freeze
+ *
+ * Description:
+ *     Copies the contents of the CN_Map into a new read-only snapshot (see
+ *     CNM_FROZEN), laid out in Eytzinger order. Searching it goes down the
+ *     implicit tree with no branches on the comparison results, and the top
+ *     levels of the tree share a few cache lines. Elements are visited in
+ *     order with "cn_map_frozen_next" and "cn_map_frozen_prev", which just do
+ *     arithmetic on the index.
+ *
+ *     The snapshot has nothing to do with the CN_Map afterwards, and nothing
+ *     in it is ever written to, so any number of threads can search it at
+ *     once without locking. Keys and values are copied byte for byte, so
+ *     anything they point to (like "char *" keys) must outlive the snapshot.
+ *     Free it with "cn_map_frozen_free".
+ *
+ * Complexity:
+ *     O(N)
+ */
+
+CNM_FROZEN cn_map_freeze(CN_MAP obj) {
+	CNM_FROZEN   fz = (CNM_FROZEN) malloc(sizeof(struct cnm_frozen));
+	CNM_ITERATOR it;
+	CNM_U64      k;
+	CNM_UINT     i;
+
+	fz->size         = obj->size;
+	fz->key_size     = obj->key_size;
+	fz->elem_size    = obj->elem_size;
+	fz->func_compare = obj->func_compare;
+
+	fz->keys   = (CNM_BYTE *) malloc((size_t) (fz->size + 1) * fz->key_size);
+	fz->values = (fz->elem_size == 0)
+		? NULL
+		: (CNM_BYTE *) malloc((size_t) (fz->size + 1) * fz->elem_size);
+
+	//The least element is the leftmost node, and the most is the rightmost.
+	for (k = 1; 2 * k <= fz->size; k = 2 * k);
+	fz->first = (fz->size == 0) ? 0 : (CNM_UINT) k;
+
+	for (k = 1; 2 * k + 1 <= fz->size; k = 2 * k + 1);
+	fz->last  = (fz->size == 0) ? 0 : (CNM_UINT) k;
+
+	//Fill the slots in the order an in-order walk of the implicit tree visits
+	//them, which is the order the CN_Map gives its elements in.
+
+	i = fz->first;
+
+	cn_map_traverse(obj, &it) {
+		memcpy(
+			fz->keys + (size_t) i * fz->key_size, it.node->key, fz->key_size
+		);
+
+		if (fz->elem_size != 0)
+			memcpy(
+				fz->values + (size_t) i * fz->elem_size,
+				it.node->data, fz->elem_size
+			);
+
+		i = cn_map_frozen_next(fz, i);
+	}
+
+	return fz;
+}
+
+/*
+ * cn_map_frozen_find
+ *
+ * Description:
+ *     Returns the index of the element with "key", or 0 if there isn't one.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_UINT cn_map_frozen_find(CNM_FROZEN fz, void *key) {
+	CNM_UINT i = __cn_map_frozen_bound(fz, key, 0);
+
+	if (i != 0 &&
+		fz->func_compare(fz->keys + (size_t) i * fz->key_size, key) == 0
+	)
+		return i;
+
+	return 0;
+}
+
+/*
+ * cn_map_frozen_lower_bound
+ *
+ * Description:
+ *     Returns the index of the first element whose key is not less than "key",
+ *     or 0 if there isn't one.
+ */
+
+CNM_UINT cn_map_frozen_lower_bound(CNM_FROZEN fz, void *key) {
+	return __cn_map_frozen_bound(fz, key, 0);
+}
+
+/*
+ * cn_map_frozen_upper_bound
+ *
+ * Description:
+ *     Returns the index of the first element whose key is greater than "key",
+ *     or 0 if there isn't one.
+ */
+
+CNM_UINT cn_map_frozen_upper_bound(CNM_FROZEN fz, void *key) {
+	return __cn_map_frozen_bound(fz, key, 1);
+}
+
+/*
+ * cn_map_frozen_begin
+ *
+ * Description:
+ *     Returns the index of the least element, or 0 if the snapshot is empty.
+ */
+
+CNM_UINT cn_map_frozen_begin(CNM_FROZEN fz) {
+	return fz->first;
+}
+
+/*
+ * cn_map_frozen_rbegin
+ *
+ * Description:
+ *     Returns the index of the most element, or 0 if the snapshot is empty.
+ */
+
+CNM_UINT cn_map_frozen_rbegin(CNM_FROZEN fz) {
+	return fz->last;
+}
+
+/*
+ * cn_map_frozen_next
+ *
+ * Description:
+ *     Returns the index of the element after the one at "i", or 0 if "i" is
+ *     the last one. That is the leftmost node of the right subtree if there is
+ *     one. Otherwise, climb up past every right child, and take one more step
+ *     up (out of a left child).
+ *
+ * Complexity:
+ *     O(1) amortised
+ */
+
+CNM_UINT cn_map_frozen_next(CNM_FROZEN fz, CNM_UINT i) {
+	CNM_U64 k = i;
+
+	if (k == 0)
+		return 0;
+
+	if (2 * k + 1 <= fz->size) {
+		k = 2 * k + 1;
+
+		while (2 * k <= fz->size)
+			k = 2 * k;
+
+		return (CNM_UINT) k;
+	}
+
+	while (k & 1)
+		k >>= 1;
+
+	return (CNM_UINT) (k >> 1);
+}
+
+/*
+ * cn_map_frozen_prev
+ *
+ * Description:
+ *     Mirror of "cn_map_frozen_next". Returns 0 if "i" is the first element.
+ */
+
+CNM_UINT cn_map_frozen_prev(CNM_FROZEN fz, CNM_UINT i) {
+	CNM_U64 k = i;
+
+	if (k == 0)
+		return 0;
+
+	if (2 * k <= fz->size) {
+		k = 2 * k;
+
+		while (2 * k + 1 <= fz->size)
+			k = 2 * k + 1;
+
+		return (CNM_UINT) k;
+	}
+
+	while (k > 1 && !(k & 1))
+		k >>= 1;
+
+	return (CNM_UINT) (k >> 1);
+}
+
+CNM_UINT cn_map_frozen_size(CNM_FROZEN fz) {
+	return fz->size;
+}
+
+/*
+ * cn_map_frozen_free
+ *
+ * Description:
+ *     Frees a snapshot made by "cn_map_freeze". The CN_Map it came from is not
+ *     affected.
+ */
+
+void cn_map_frozen_free(CNM_FROZEN fz) {
+	free(fz->keys);
+	free(fz->values);
+	free(fz);
+}
+
+// ----------------------------------------------------------------------------
+// Persistent Maps                                                         {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_snapshot
+ *
+ * Description:
+ *     Returns a new version of a persistent CN_Map (see
+ *     "new_cn_map_persistent") with the same contents. Nothing is copied. The
+ *     two just share the tree until one of them changes, so this can be taken
+ *     as often as needed. The snapshot is a CN_Map of its own. It is iterated
+ *     and searched with the usual functions, may be changed without touching
+ *     the original (and vice versa), and must be freed with "cn_map_free".
+ *
+ *     Take a snapshot from the thread that writes to the CN_Map. It can then
+ *     be handed to another thread, which can read it while the original keeps
+ *     changing. Returns NULL if the CN_Map isn't persistent.
+ *
+ * Complexity:
+ *     O(1)
+ */
+
+CN_MAP cn_map_snapshot(CN_MAP obj) {
+	CN_MAP   snap;
+	CNM_BYTE locked;
+
+	if (obj->ps == NULL)
+		return NULL;
+
+	snap = (CN_MAP) malloc(sizeof(struct cn_map));
+
+	locked = __cn_map_ps_lock(obj);
+
+	//Everything else (least and most included) is the same in both.
+	*snap = *obj;
+
+	if (obj->head != NULL)
+		obj->head->count++;
+
+	__atomic_add_fetch(&obj->ps->maps, 1, __ATOMIC_ACQ_REL);
+	__cn_map_ps_unlock(obj, locked);
+
+	return snap;
+}
+
+/*
+ * __cn_map_ps_lock
+ *
+ * Description:
+ *     Locks the pools and reference counts a persistent CN_Map shares with its
+ *     other versions, if there are any. Returns whether it did, to be passed
+ *     to "__cn_map_ps_unlock". With only one version around, nothing else can
+ *     reach any of it, so there is nothing to lock.
+ */
+
+CNM_BYTE __cn_map_ps_lock(CN_MAP obj) {
+	if (obj->ps == NULL ||
+		__atomic_load_n(&obj->ps->maps, __ATOMIC_ACQUIRE) < 2
+	)
+		return 0;
+
+	pthread_mutex_lock(&obj->ps->lock);
+	return 1;
+}
+
+void __cn_map_ps_unlock(CN_MAP obj, CNM_BYTE locked) {
+	if (locked)
+		pthread_mutex_unlock(&obj->ps->lock);
+}
+
+/*
+ * __cn_map_ps_insert
+ *
+ * Description:
+ *     "cn_map_try_insert" for a persistent CN_Map. Every node on the path down
+ *     to where the key goes is made this version's own first (see
+ *     "__cn_map_ps_own"), along with the uncles rebalancing recolours. With
+ *     no parent links, the path is kept on the stack to climb back up.
+ */
+
+CNM_UINT __cn_map_ps_insert(
+	CN_MAP        obj,
+	CNM_ITERATOR *it,
+	void         *key,
+	void         *value
+) {
+	CNM_NODE  *path[CNM_PS_MAX_DEPTH + 1], *node, *elem, *p, *g, *u;
+	CNM_NODE **slot;
+	CNM_BYTE   dir [CNM_PS_MAX_DEPTH + 1], locked, pd;
+	CNM_UINT   depth;
+	CNC_COMP   res;
+
+	//Look before copying anything.
+	node = __cn_map_descend(obj, obj->head, key, &res);
+
+	if (node != NULL && res == 0) {
+		it->node = node;
+		it->prev = node->up;
+		return 0;
+	}
+
+	locked = __cn_map_ps_lock(obj);
+
+	for (depth = 0, slot = &obj->head; *slot != NULL; depth++) {
+		node = __cn_map_ps_own(obj, slot);
+
+		path[depth] = node;
+		dir [depth] = (obj->func_compare(key, node->key) > 0);
+		slot        = &CNM_CHILD(node, dir[depth]);
+	}
+
+	//The pair gets a node of its own, and the tree node points at it.
+	elem = __cn_map_create_node(obj, key, value);
+	node = (CNM_NODE *) __cn_map_pool_alloc(&obj->ps->nodes);
+
+	node->key   = (CNM_BYTE *) node + CNM_KEY_OFFSET;
+	node->data  = elem->data;
+	node->up    = elem;
+	node->left  = NULL;
+	node->right = NULL;
+
+	node->colour = CNM_RED;
+	node->count  = 1;
+
+	memcpy(node->key, elem->key, obj->key_size);
+
+	*slot = node;
+	path[depth] = node;
+	obj->size++;
+	obj->ps_stamp = CNM_PS_STAMP();
+
+	//Same cases as "__cn_map_fix_colours", climbing "path" instead.
+	while (depth > 0 && path[depth - 1]->colour == CNM_RED) {
+		p  = path[depth - 1];
+		g  = path[depth - 2];
+		pd = dir[depth - 2];
+		u  = CNM_CHILD(g, !pd);
+
+		if (u != NULL && u->colour == CNM_RED) {
+			u = __cn_map_ps_own(obj, &CNM_CHILD(g, !pd));
+
+			p->colour = u->colour = CNM_BLACK;
+			g->colour = CNM_RED;
+			depth -= 2;
+			continue;
+		}
+
+		//Inner grandchild. Rotate it to the outside first.
+		if (dir[depth - 1] != pd) {
+			__cn_map_ps_rotate(&CNM_CHILD(g, pd), pd);
+			p = CNM_CHILD(g, pd);
+		}
+
+		slot = (depth == 2)
+			? &obj->head
+			: &CNM_CHILD(path[depth - 3], dir[depth - 3]);
+
+		__cn_map_ps_rotate(slot, !pd);
+
+		p->colour = CNM_BLACK;
+		g->colour = CNM_RED;
+		break;
+	}
+
+	obj->head->colour = CNM_BLACK;
+	__cn_map_calibrate(obj);
+
+	__cn_map_ps_unlock(obj, locked);
+
+	it->node = node;
+	it->prev = elem;
+
+	return 1;
+}
+
+/*
+ * __cn_map_ps_erase
+ *
+ * Description:
+ *     "cn_map_erase" for a persistent CN_Map. The path down to the node with
+ *     the key is made this version's own. If that node has two children, the
+ *     path goes on to its successor, whose pair is moved up into it, and the
+ *     successor's spot is the one taken out. Then the tree is rebalanced like
+ *     in "__cn_map_delete_fixup", climbing the path, and making each sibling
+ *     (and nephew) this version's own before it is changed.
+ */
+
+void __cn_map_ps_erase(CN_MAP obj, CNM_ITERATOR *it) {
+	CNM_NODE  *path[CNM_PS_MAX_DEPTH + 2], *node, *y, *x, *p, *sib, *far;
+	CNM_NODE **slot;
+	CNM_BYTE   dir [CNM_PS_MAX_DEPTH + 2], locked, s;
+	CNM_COLOUR y_colour;
+	CNM_UINT   depth, i;
+	CNC_COMP   res;
+	void      *key = it->node->key;
+
+	locked = __cn_map_ps_lock(obj);
+
+	//Find the node again, this time making the path ours.
+	for (depth = 0, slot = &obj->head; *slot != NULL; depth++) {
+		node = __cn_map_ps_own(obj, slot);
+		res  = obj->func_compare(key, node->key);
+
+		path[depth] = node;
+		dir [depth] = (res > 0);
+
+		if (res == 0)
+			break;
+
+		slot = &CNM_CHILD(node, dir[depth]);
+	}
+
+	if (*slot == NULL) {
+		__cn_map_ps_unlock(obj, locked);
+		return;
+	}
+
+	//Two children. Go down to the successor and give its pair to "node".
+	if (node->left != NULL && node->right != NULL) {
+		dir[depth] = 1;
+		slot = &node->right;
+
+		for (depth++; ; depth++) {
+			y = __cn_map_ps_own(obj, slot);
+
+			path[depth] = y;
+			dir [depth] = 0;
+
+			if (y->left == NULL)
+				break;
+
+			slot = &y->left;
+		}
+
+		p         = y->up;
+		y->up     = node->up;
+		y->data   = node->data;
+		node->up   = p;
+		node->data = p->data;
+
+		memcpy(node->key, p->key, obj->key_size);
+	}
+
+	//"y" has at most one child, "x", which takes its place.
+	y = path[depth];
+	x = (y->left != NULL) ? y->left : y->right;
+
+	*slot    = x;
+	y_colour = y->colour;
+
+	y->left = y->right = NULL;
+	__cn_map_ps_release(obj, y);
+
+	obj->size--;
+	obj->ps_stamp = CNM_PS_STAMP();
+
+	if (y_colour == CNM_BLACK) {
+		if (x != NULL) {
+			//A red child just takes on the black.
+			x = __cn_map_ps_own(obj, slot);
+			x->colour = CNM_BLACK;
+		}
+		else if (depth > 0) {
+			//"x" is an empty spot on side "s" of "path[i]", one black short.
+			i = depth - 1;
+			s = dir[i];
+
+			while (1) {
+				p   = path[i];
+				sib = __cn_map_ps_own(obj, &CNM_CHILD(p, !s));
+
+				slot = (i == 0)
+					? &obj->head
+					: &CNM_CHILD(path[i - 1], dir[i - 1]);
+
+				if (sib->colour == CNM_RED) {
+					//Red sibling. Rotate it above "p", pushing "p" down.
+					__cn_map_ps_rotate(slot, s);
+
+					sib->colour = CNM_BLACK;
+					p->colour   = CNM_RED;
+
+					path[i + 1] = p;
+					path[i]     = sib;
+					dir [i]     = s;
+					i++;
+					continue;
+				}
+
+				if ((sib->left  == NULL || sib->left->colour  == CNM_BLACK) &&
+					(sib->right == NULL || sib->right->colour == CNM_BLACK)
+				) {
+					//Black sibling with black children. Push the problem up.
+					sib->colour = CNM_RED;
+
+					if (p->colour == CNM_RED || i == 0) {
+						p->colour = CNM_BLACK;
+						break;
+					}
+
+					s = dir[--i];
+					continue;
+				}
+
+				far = CNM_CHILD(sib, !s);
+
+				if (far == NULL || far->colour == CNM_BLACK) {
+					//Only the near nephew is red. Rotate it up to the sibling.
+					__cn_map_ps_own(obj, &CNM_CHILD(sib, s));
+					__cn_map_ps_rotate(&CNM_CHILD(p, !s), !s);
+
+					sib->colour = CNM_RED;
+					sib = CNM_CHILD(p, !s);
+					sib->colour = CNM_BLACK;
+				}
+
+				//The far nephew is red. Rotate the sibling above "p".
+				far = __cn_map_ps_own(obj, &CNM_CHILD(sib, !s));
+				__cn_map_ps_rotate(slot, s);
+
+				sib->colour = p->colour;
+				p->colour   = CNM_BLACK;
+				far->colour = CNM_BLACK;
+				break;
+			}
+		}
+	}
+
+	if (obj->head != NULL)
+		obj->head->colour = CNM_BLACK;
+
+	__cn_map_calibrate(obj);
+	__cn_map_ps_unlock(obj, locked);
+}
+
+/*
+ * __cn_map_ps_clear
+ *
+ * Description:
+ *     "cn_map_clear" for a persistent CN_Map. Lets go of the tree, which frees
+ *     whatever no other version has. If no other version is left, every node
+ *     is gone now, so the pools give their chunks back too.
+ */
+
+void __cn_map_ps_clear(CN_MAP obj) {
+	CNM_BYTE locked = __cn_map_ps_lock(obj);
+
+	__cn_map_ps_release(obj, obj->head);
+
+	obj->head     = NULL;
+	obj->size     = 0;
+	obj->ps_stamp = CNM_PS_STAMP();
+	__cn_map_calibrate(obj);
+
+	if (!locked) {
+		__cn_map_pool_clear(&obj->ps->nodes);
+		__cn_map_pool_clear(&obj->ps->elems);
+	}
+
+	__cn_map_ps_unlock(obj, locked);
+}
+
+/*
+ * __cn_map_ps_step
+ *
+ * Description:
+ *     Returns the node after "node" in a persistent CN_Map (or before it, if
+ *     "right" is false), or NULL if there isn't one. Without parent links, the
+ *     way back up is the path down from the head, kept in this thread's
+ *     cursor. If the cursor isn't on "node" in this exact tree, the path is
+ *     found again by searching for its key.
+ *
+ * Complexity:
+ *     O(1) amortised when stepping the same way through a CN_Map. O(lg N)
+ *     otherwise.
+ */
+
+CNM_NODE *__cn_map_ps_step(CN_MAP obj, CNM_NODE *node, CNM_BYTE right) {
+	CNM_PS_CURSOR *c = &__cn_map_ps_cursor;
+	CNM_NODE      *cur, *child;
+	CNC_COMP       res;
+
+	if (c->map != obj || c->stamp != obj->ps_stamp || c->depth == 0 ||
+		c->path[c->depth - 1] != node
+	) {
+		c->map   = obj;
+		c->stamp = obj->ps_stamp;
+		c->depth = 0;
+
+		for (cur = obj->head; cur != NULL; ) {
+			c->path[c->depth++] = cur;
+
+			res = obj->func_compare(node->key, cur->key);
+			if (res == 0)
+				break;
+
+			cur = (res < 0) ? cur->left : cur->right;
+		}
+	}
+
+	//Down the subtree on that side, as far the other way as it goes.
+	if (CNM_CHILD(node, right) != NULL) {
+		cur = CNM_CHILD(node, right);
+
+		for (; cur != NULL; cur = CNM_CHILD(cur, !right))
+			c->path[c->depth++] = cur;
+
+		return c->path[c->depth - 1];
+	}
+
+	//Otherwise up, past every node this one is on the "right" side of.
+	do {
+		child = c->path[--c->depth];
+	} while (c->depth > 0 && CNM_CHILD(c->path[c->depth - 1], right) == child);
+
+	return (c->depth == 0) ? NULL : c->path[c->depth - 1];
+}
+
+/*
+ * __cn_map_ps_own
+ *
+ * Description:
+ *     Makes the node at "*slot" belong to this version of a persistent CN_Map
+ *     alone, so it can be changed. If some other version has it too, it is
+ *     copied, the copy is put in "*slot", and the copy is returned. Its
+ *     children (and pair) are then linked from one more node. The node's
+ *     parent must already be this version's own.
+ */
+
+CNM_NODE *__cn_map_ps_own(CN_MAP obj, CNM_NODE **slot) {
+	CNM_NODE *node = *slot, *copy;
+
+	if (node->count == 1)
+		return node;
+
+	copy = (CNM_NODE *) __cn_map_pool_alloc(&obj->ps->nodes);
+	memcpy(copy, node, CNM_KEY_OFFSET + obj->key_size);
+
+	copy->key   = (CNM_BYTE *) copy + CNM_KEY_OFFSET;
+	copy->count = 1;
+
+	if (copy->left  != NULL) copy->left->count++;
+	if (copy->right != NULL) copy->right->count++;
+	copy->up->count++;
+
+	node->count--;
+	*slot = copy;
+
+	return copy;
+}
+
+/*
+ * __cn_map_ps_release
+ *
+ * Description:
+ *     Drops a link to "node" in a persistent CN_Map. If it was the last one,
+ *     the node is freed, its pair loses a link too (and is destructed and
+ *     freed if that was its last), and the same is done for its children.
+ */
+
+void __cn_map_ps_release(CN_MAP obj, CNM_NODE *node) {
+	CNM_NODE *next;
+
+	//Loop down the right side rather than recursing on it.
+	for (; node != NULL && --node->count == 0; node = next) {
+		__cn_map_ps_release(obj, node->left);
+
+		if (--node->up->count == 0)
+			__cn_map_free_node(obj, node->up);
+
+		next = node->right;
+		__cn_map_pool_release(&obj->ps->nodes, node);
+	}
+}
+
+/*
+ * __cn_map_ps_rotate
+ *
+ * Description:
+ *     Rotates the subtree at "*slot" so its root goes down to the left (if
+ *     "right" is false) or the right, and its child on the other side takes
+ *     its place. Both must already belong to this version.
+ */
+
+void __cn_map_ps_rotate(CNM_NODE **slot, CNM_BYTE right) {
+	CNM_NODE *node  = *slot,
+	         *child = CNM_CHILD(node, !right);
+
+	CNM_CHILD(node , !right) = CNM_CHILD(child, right);
+	CNM_CHILD(child,  right) = node;
+
+	*slot = child;
+}
+
+// ----------------------------------------------------------------------------
+// Concurrent Readers                                                      {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_read_lock
+ *
+ * Description:
+ *     Starts a read of a CN_Map with concurrent reads on (see
+ *     "cn_map_set_concurrent_reads"), and returns the slot to pass to
+ *     "cn_map_read_unlock" when done. All it does is claim a slot and note the
+ *     current epoch in it, so nothing the writer erases from here on is given
+ *     back until the slot is released. Searches made while holding it may
+ *     still wait on the writer (see "cn_map_set_concurrent_reads").
+ *
+ *     Every reader writes only to its own slot, and each slot has its own
+ *     cache line, so readers on different cores don't slow each other down.
+ *     At most CNM_EPOCH_READERS threads can hold a slot at once. Any more
+ *     spin, yielding the CPU, until one is unlocked.
+ */
+
+CNM_UINT cn_map_read_lock(CN_MAP obj) {
+	CNM_EPOCH *ep = obj->epoch;
+	CNM_U64    e, unused;
+	CNM_UINT   i, n;
+
+	//Threads have stacks far apart from each other, so where this one is
+	//makes for a cheap hash that keeps each thread on a slot of its own.
+	i = (CNM_UINT) (((size_t) &e >> 16) * 2654435761u % CNM_EPOCH_READERS);
+
+	for (n = 0;; n++, i = (i + 1) % CNM_EPOCH_READERS) {
+		if (__atomic_load_n(&ep->readers[i].epoch, __ATOMIC_RELAXED) != 0) {
+			//Every slot is taken. Let a reader get on with unlocking one.
+			if (n % CNM_EPOCH_READERS == CNM_EPOCH_READERS - 1)
+				sched_yield();
+
+			continue;
+		}
+
+		e      = __atomic_load_n(&ep->global, __ATOMIC_ACQUIRE);
+		unused = 0;
+
+		//Full barrier. The writer sees this slot, or this reader sees the
+		//tree without whatever the writer is about to give back.
+		if (__atomic_compare_exchange_n(
+			&ep->readers[i].epoch, &unused, e,
+			0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED
+		))
+			return i;
+	}
+}
+
+/*
+ * cn_map_read_unlock
+ *
+ * Description:
+ *     Ends a read started with "cn_map_read_lock". Iterators into the CN_Map
+ *     must not be used after this.
+ */
+
+void cn_map_read_unlock(CN_MAP obj, CNM_UINT slot) {
+	__atomic_store_n(&obj->epoch->readers[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * __cn_map_read_begin
+ *
+ * Description:
+ *     Waits for the writer to be done with whatever it is in the middle of,
+ *     and returns the sequence number to check against afterwards. This is
+ *     the one place a reader waits on the writer, for as long as the change
+ *     takes.
+ */
+
+CNM_UINT __cn_map_read_begin(CN_MAP obj) {
+	CNM_UINT seq;
+
+	while ((seq = __atomic_load_n(&obj->epoch->seq, __ATOMIC_ACQUIRE)) & 1);
+
+	return seq;
+}
+
+/*
+ * __cn_map_read_retry
+ *
+ * Description:
+ *     Returns true if the tree was changed since "__cn_map_read_begin"
+ *     returned "seq", meaning what was read from it can't be trusted.
+ */
+
+CNM_BYTE __cn_map_read_retry(CN_MAP obj, CNM_UINT seq) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return (__atomic_load_n(&obj->epoch->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/*
+ * __cn_map_read_bound
+ *
+ * Description:
+ *     "__cn_map_bound" for readers. Returns the first node not less than
+ *     "key" (CNM_READ_LOWER), the first node greater than "key"
+ *     (CNM_READ_UPPER), or the last node less than "key" (CNM_READ_BELOW).
+ *     Returns NULL if there isn't one.
+ *
+ *     The search starts over if the tree changed while it ran. Midway through
+ *     a rotation, links may briefly lead somewhere odd (even in a loop), so a
+ *     search that hasn't hit the bottom after CNM_READ_MAX_DEPTH nodes starts
+ *     over too. Every node it can reach is either in the tree or waiting to be
+ *     reclaimed, so none of it is ever freed memory.
+ */
+
+CNM_NODE *__cn_map_read_bound(CN_MAP obj, void *key, CNM_BYTE kind) {
+	CNM_NODE     *node, *best;
+	CNM_UINT      seq, depth;
+	CNC_COMP      res;
+	CNM_STR_QUERY q;
+
+	if (obj->str_keys)
+		__cn_map_str_query(obj, &q, key);
+
+	do {
+		seq  = __cn_map_read_begin(obj);
+		node = CNM_LOAD(obj->head);
+		best = NULL;
+
+		for (depth = 0; node != NULL && depth < CNM_READ_MAX_DEPTH; depth++) {
+			res = obj->str_keys
+				? __cn_map_str_compare(obj, &q, node)
+				: obj->func_compare(key, node->key);
+
+			if (kind == CNM_READ_BELOW) {
+				if (res > 0) {
+					best = node;
+					node = CNM_LOAD(node->right);
+				}
+				else
+					node = CNM_LOAD(node->left);
+			}
+			else
+			if (res < 0 || (res == 0 && kind == CNM_READ_LOWER)) {
+				best = node;
+				node = CNM_LOAD(node->left);
+			}
+			else
+				node = CNM_LOAD(node->right);
+		}
+	} while (node != NULL || __cn_map_read_retry(obj, seq));
+
+	return best;
+}
+
+/*
+ * __cn_map_read_end
+ *
+ * Description:
+ *     Returns the least node (or the most, if "most" is true) for a reader, or
+ *     NULL if the CN_Map is empty.
+ */
+
+CNM_NODE *__cn_map_read_end(CN_MAP obj, CNM_BYTE most) {
+	CNM_NODE *node;
+	CNM_UINT  seq;
+
+	do {
+		seq  = __cn_map_read_begin(obj);
+		node = most
+			? CNM_LOAD(obj->it_most.node)
+			: CNM_LOAD(obj->it_least.node);
+	} while (__cn_map_read_retry(obj, seq));
+
+	return node;
+}
+
+/*
+ * __cn_map_write_begin
+ *
+ * Description:
+ *     Marks the tree as being changed, so readers know to wait and to not trust
+ *     anything they read until "__cn_map_write_end". Does nothing unless
+ *     concurrent reads are on.
+ */
+
+void __cn_map_write_begin(CN_MAP obj) {
+	if (obj->epoch == NULL)
+		return;
+
+	__atomic_store_n(&obj->epoch->seq, obj->epoch->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void __cn_map_write_end(CN_MAP obj) {
+	if (obj->epoch == NULL)
+		return;
+
+	__atomic_store_n(&obj->epoch->seq, obj->epoch->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * __cn_map_epoch_retire
+ *
+ * Description:
+ *     Puts an erased node aside until no reader can still reach it. Every
+ *     CNM_EPOCH_BATCH nodes, a new epoch is started, and everything erased
+ *     before the oldest epoch a reader is still in is reclaimed.
+ */
+
+void __cn_map_epoch_retire(CN_MAP obj, CNM_NODE *node) {
+	CNM_EPOCH *ep = obj->epoch;
+	CNM_U64    oldest, e;
+	CNM_UINT   i;
+
+	if (ep->retired_n == ep->retired_cap) {
+		ep->retired_cap = (ep->retired_cap == 0)
+			? CNM_EPOCH_BATCH
+			: ep->retired_cap * 2;
+
+		ep->retired = (CNM_RETIRED *) realloc(
+			ep->retired, sizeof(CNM_RETIRED) * ep->retired_cap
+		);
+	}
+
+	ep->retired[ep->retired_n].node  = node;
+	ep->retired[ep->retired_n].epoch = ep->global;
+	ep->retired_n++;
+
+	if (ep->retired_n % CNM_EPOCH_BATCH != 0)
+		return;
+
+	//Readers that lock from here on can't reach anything retired so far.
+	__atomic_store_n(&ep->global, ep->global + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	oldest = ep->global;
+
+	for (i = 0; i < CNM_EPOCH_READERS; i++) {
+		e = __atomic_load_n(&ep->readers[i].epoch, __ATOMIC_ACQUIRE);
+
+		if (e != 0 && e < oldest)
+			oldest = e;
+	}
+
+	__cn_map_epoch_reclaim(obj, oldest);
+}
+
+/*
+ * __cn_map_epoch_sync
+ *
+ * Description:
+ *     Starts a new epoch and waits for every reader that locked before it to
+ *     unlock. Afterwards, no reader can reach anything that was erased, so it
+ *     is all reclaimed.
+ */
+
+void __cn_map_epoch_sync(CN_MAP obj) {
+	CNM_EPOCH *ep = obj->epoch;
+	CNM_U64    e;
+	CNM_UINT   i;
+
+	__atomic_store_n(&ep->global, ep->global + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (i = 0; i < CNM_EPOCH_READERS; i++) {
+		for (;;) {
+			e = __atomic_load_n(&ep->readers[i].epoch, __ATOMIC_ACQUIRE);
+
+			if (e == 0 || e >= ep->global)
+				break;
+
+			sched_yield();
+		}
+	}
+
+	__cn_map_epoch_reclaim(obj, ep->global);
+}
+
+/*
+ * __cn_map_epoch_reclaim
+ *
+ * Description:
+ *     Destructs and gives back every retired node erased before epoch
+ *     "oldest". Nodes are retired in epoch order, so these are all at the
+ *     front of the list.
+ */
+
+void __cn_map_epoch_reclaim(CN_MAP obj, CNM_U64 oldest) {
+	CNM_EPOCH *ep = obj->epoch;
+	CNM_UINT   i;
+
+	for (i = 0; i < ep->retired_n && ep->retired[i].epoch < oldest; i++) {
+		if (obj->func_destruct != NULL)
+			obj->func_destruct(ep->retired[i].node);
+
+		__cn_map_pool_release(&obj->pool, ep->retired[i].node);
+	}
+
+	if (i == 0)
+		return;
+
+	memmove(
+		ep->retired, ep->retired + i, sizeof(CNM_RETIRED) * (ep->retired_n - i)
+	);
+
+	ep->retired_n -= i;
+}
+
+// ----------------------------------------------------------------------------
+// Sharded Maps                                                            {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * Shard Struct
+ *
+ * One range of keys of a CNM_SHARDED, held in an ordinary CN_Map behind a
+ * lock of its own. "size" is a copy of the CN_Map's size that can be read
+ * without the lock. It is only written with the lock held for writing.
+ * Padded out to a whole cache line, so that threads working in neighbouring
+ * shards don't fight over the same line.
+ */
+
+typedef struct cnm_shard {
+	CN_MAP           map;
+	pthread_rwlock_t lock;
+	CNM_UINT         size;
+
+	CNM_BYTE pad[
+		CNM_CACHE_LINE -
+		(sizeof(CN_MAP) + sizeof(pthread_rwlock_t) + sizeof(CNM_UINT)) %
+		CNM_CACHE_LINE
+	];
+} CNM_SHARD;
+
+/*
+ * Sharded Map Struct
+ *
+ * Shard "i" holds the keys that are less than "bounds[i]" and not less than
+ * "bounds[i - 1]". Only the first "bounds_set" bounds are in use. The rest
+ * are past every key, so the shards after shard "bounds_set" are empty.
+ *
+ * The bounds are read behind "bounds_lock", which is only held while picking
+ * a shard, never while waiting on one. "version" goes up every time a bound
+ * changes, so a thread can tell if the bounds it used to pick a shard were
+ * changed before it got the shard locked. Bounds are only ever changed by a
+ * thread holding "rebalance", the locks of both shards the bound sits
+ * between, and "bounds_lock" for writing.
+ */
+
+struct cnm_sharded {
+	CNM_SHARD       *shards;
+	CNM_UINT         count;
+	CNM_UINT         key_size, elem_size;
+
+	CNM_BYTE        *bounds;
+	CNM_UINT         bounds_set;
+	CNM_UINT         version;
+	pthread_rwlock_t bounds_lock;
+	pthread_mutex_t  rebalance;
+
+	CNC_COMP (*func_compare)(void *, void *);
+};
+
+#define CNM_SHARD_BOUND(obj, i) ((obj)->bounds + (size_t) (i) * (obj)->key_size)
+
+//Size of a shard, read without locking it
+#define CNM_SHARD_SIZE(obj, i) \
+	__atomic_load_n(&(obj)->shards[i].size, __ATOMIC_RELAXED)
+
+//Copies the size of a shard out after changing it, with its lock held
+#define CNM_SHARD_RESIZE(obj, i) \
+	__atomic_store_n( \
+		&(obj)->shards[i].size, (obj)->shards[i].map->size, __ATOMIC_RELAXED \
+	)
+
+CNM_UINT  __cn_map_sharded_route    (CNM_SHARDED, void *);
+CNM_UINT  __cn_map_sharded_lock     (CNM_SHARDED, void *, CNM_BYTE);
+void      __cn_map_sharded_settle   (CNM_SHARDED, CNM_SHARDED_ITERATOR *);
+void      __cn_map_sharded_rebalance(CNM_SHARDED, CNM_UINT);
+void      __cn_map_sharded_move     (CNM_SHARDED, CNM_UINT, CNM_UINT,
+                                     CNM_UINT);
+
+/*
+ * new_cn_map_sharded
+ *
+ * Description:
+ *     Sets up a blank CN_Map that any number of threads can insert into,
+ *     search, erase from, and iterate through at the same time. "s1", "s2"
+ *     and "cmp" are the same as for "new_cn_map". The keys are split by range
+ *     across "shards" CN_Maps, each behind a read/write lock of its own, so
+ *     threads only wait on each other when they work in the same range.
+ *
+ *     Shards are rebalanced as the CN_Map grows. When a shard ends up with a
+ *     lot more than its share of the elements, it hands some of its least or
+ *     most keys over to a neighbouring shard, and the bound between the two
+ *     moves. Everything starts out in the first shard and spreads out from
+ *     there, so whatever the keys look like, each shard ends up with about as
+ *     many as the rest.
+ *
+ *     Keys and values are copied in like usual, so anything they point to must
+ *     stay valid for as long as the CNM_SHARDED exists (the bounds between
+ *     shards are copies of keys that were in it).
+ */
+
+CNM_SHARDED new_cn_map_sharded(
+	CNM_UINT s1,
+	CNM_UINT s2,
+	CNC_COMP (*cmp)(void *, void *),
+	CNM_UINT shards
+) {
+	CNM_SHARDED obj = (CNM_SHARDED) malloc(sizeof(struct cnm_sharded));
+	CNM_UINT    i;
+	void       *mem;
+
+	if (shards == 0)
+		shards = 1;
+
+	obj->count        = shards;
+	obj->key_size     = s1;
+	obj->elem_size    = s2;
+	obj->func_compare = cmp;
+	obj->bounds       = (CNM_BYTE *) malloc((size_t) shards * s1);
+	obj->bounds_set   = 0;
+	obj->version      = 0;
+
+	pthread_rwlock_init(&obj->bounds_lock, NULL);
+	pthread_mutex_init (&obj->rebalance  , NULL);
+
+	//Line the shards up with the cache lines.
+	if (posix_memalign(&mem, CNM_CACHE_LINE, sizeof(CNM_SHARD) * shards) != 0)
+		mem = malloc(sizeof(CNM_SHARD) * shards);
+
+	obj->shards = (CNM_SHARD *) mem;
+
+	for (i = 0; i < shards; i++) {
+		obj->shards[i].map  = new_cn_map(s1, s2, cmp);
+		obj->shards[i].size = 0;
+		pthread_rwlock_init(&obj->shards[i].lock, NULL);
+	}
+
+	return obj;
+}
+
+/*
+ * cn_map_sharded_insert
+ *
+ * Description:
+ *     Inserts a key/value pair, like "cn_map_insert". Returns 1 if it was
+ *     inserted, and 0 if the key was already there. Only the shard the key
+ *     belongs in is locked.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_UINT cn_map_sharded_insert(CNM_SHARDED obj, void *key, void *value) {
+	CNM_UINT s, added, size;
+
+	s     = __cn_map_sharded_lock(obj, key, 1);
+	added = cn_map_insert(obj->shards[s].map, key, value);
+	size  = obj->shards[s].map->size;
+	CNM_SHARD_RESIZE(obj, s);
+	pthread_rwlock_unlock(&obj->shards[s].lock);
+
+	//Every so often, see if this shard has outgrown the rest.
+	if (added && size % CNM_SHARD_CHECK == 0)
+		__cn_map_sharded_rebalance(obj, s);
+
+	return added;
+}
+
+/*
+ * cn_map_sharded_find
+ *
+ * Description:
+ *     Returns 1 if "key" is in the CN_Map, and 0 if not. If it is, and "value"
+ *     isn't NULL, its value is copied into "value". The value is copied out
+ *     (rather than pointed at) since another thread may erase the element as
+ *     soon as the shard is unlocked.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_BYTE cn_map_sharded_find(CNM_SHARDED obj, void *key, void *value) {
+	CNM_ITERATOR it;
+	CNM_UINT     s;
+
+	s = __cn_map_sharded_lock(obj, key, 0);
+	cn_map_find(obj->shards[s].map, &it, key);
+
+	if (it.node != NULL && value != NULL && obj->elem_size != 0)
+		memcpy(value, it.node->data, obj->elem_size);
+
+	pthread_rwlock_unlock(&obj->shards[s].lock);
+
+	return (it.node != NULL);
+}
+
+/*
+ * cn_map_sharded_erase
+ *
+ * Description:
+ *     Erases the element with "key". Returns 1 if there was one, and 0 if not.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_UINT cn_map_sharded_erase(CNM_SHARDED obj, void *key) {
+	CNM_ITERATOR it;
+	CNM_UINT     s;
+
+	s = __cn_map_sharded_lock(obj, key, 1);
+	cn_map_find(obj->shards[s].map, &it, key);
+
+	if (it.node != NULL) {
+		cn_map_erase(obj->shards[s].map, &it);
+		CNM_SHARD_RESIZE(obj, s);
+	}
+
+	pthread_rwlock_unlock(&obj->shards[s].lock);
+
+	return (it.node != NULL);
+}
+
+/*
+ * cn_map_sharded_size
+ *
+ * Description:
+ *     Returns the number of elements. The shards aren't locked, so if other
+ *     threads are changing the CN_Map, this is only a rough count.
+ */
+
+CNM_UINT cn_map_sharded_size(CNM_SHARDED obj) {
+	CNM_UINT i, size = 0;
+
+	for (i = 0; i < obj->count; i++)
+		size += CNM_SHARD_SIZE(obj, i);
+
+	return size;
+}
+
+/*
+ * cn_map_sharded_begin
+ *
+ * Description:
+ *     Sets "sit" to the least element. The shard it is in is read-locked until
+ *     the iterator leaves it.
+ *
+ *     Moving from one shard to the next locks the next one before letting go
+ *     of the current one. No elements can move between the two in the
+ *     meantime, so a traversal sees every key once, in order, even while
+ *     shards are being rebalanced. Other threads can keep on reading the whole
+ *     time, but writes to the shard the iterator is in have to wait. That
+ *     includes writes from the thread that owns the iterator, so don't modify
+ *     the CN_Map mid-traversal. If the traversal stops before reaching the
+ *     end, call "cn_map_sharded_release".
+ */
+
+void cn_map_sharded_begin(CNM_SHARDED obj, CNM_SHARDED_ITERATOR *sit) {
+	sit->shard = 0;
+
+	pthread_rwlock_rdlock(&obj->shards[0].lock);
+	cn_map_begin(obj->shards[0].map, &sit->it);
+
+	__cn_map_sharded_settle(obj, sit);
+}
+
+/*
+ * cn_map_sharded_lower_bound
+ *
+ * Description:
+ *     Sets "sit" to the first element whose key is not less than "key", or to
+ *     the end if there isn't one. Iterating from here until a key is reached
+ *     gives every element in that range. Locking works like it does for
+ *     "cn_map_sharded_begin".
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+void cn_map_sharded_lower_bound(
+	CNM_SHARDED           obj,
+	CNM_SHARDED_ITERATOR *sit,
+	void                 *key
+) {
+	sit->shard = __cn_map_sharded_lock(obj, key, 0);
+	cn_map_lower_bound(obj->shards[sit->shard].map, &sit->it, key);
+
+	__cn_map_sharded_settle(obj, sit);
+}
+
+/*
+ * cn_map_sharded_upper_bound
+ *
+ * Description:
+ *     Sets "sit" to the first element whose key is greater than "key", or to
+ *     the end if there isn't one.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+void cn_map_sharded_upper_bound(
+	CNM_SHARDED           obj,
+	CNM_SHARDED_ITERATOR *sit,
+	void                 *key
+) {
+	sit->shard = __cn_map_sharded_lock(obj, key, 0);
+	cn_map_upper_bound(obj->shards[sit->shard].map, &sit->it, key);
+
+	__cn_map_sharded_settle(obj, sit);
+}
+
+/*
+ * cn_map_sharded_next
+ *
+ * Description:
+ *     Advances "sit" to the next element, moving on to the next shard when it
+ *     runs out of elements in this one.
+ */
+
+void cn_map_sharded_next(CNM_SHARDED obj, CNM_SHARDED_ITERATOR *sit) {
+	if (sit->shard >= obj->count)
+		return;
+
+	cn_map_next(obj->shards[sit->shard].map, &sit->it);
+	__cn_map_sharded_settle(obj, sit);
+}
+
+CNM_BYTE cn_map_sharded_at_end(CNM_SHARDED obj, CNM_SHARDED_ITERATOR *sit) {
+	return (sit->shard >= obj->count);
+}
+
+/*
+ * cn_map_sharded_release
+ *
+ * Description:
+ *     Unlocks the shard "sit" is in and sets it to the end. Call this when
+ *     done with an iterator that hasn't reached the end. It does nothing to
+ *     one that has.
+ */
+
+void cn_map_sharded_release(CNM_SHARDED obj, CNM_SHARDED_ITERATOR *sit) {
+	if (sit->shard >= obj->count)
+		return;
+
+	pthread_rwlock_unlock(&obj->shards[sit->shard].lock);
+
+	sit->shard   = obj->count;
+	sit->it.node = sit->it.prev = NULL;
+}
+
+/*
+ * cn_map_sharded_free
+ *
+ * Description:
+ *     Frees the CNM_SHARDED and every shard in it. No other thread may be
+ *     using it at this point.
+ */
+
+void cn_map_sharded_free(CNM_SHARDED obj) {
+	CNM_UINT i;
+
+	for (i = 0; i < obj->count; i++) {
+		cn_map_free(obj->shards[i].map);
+		pthread_rwlock_destroy(&obj->shards[i].lock);
+	}
+
+	pthread_rwlock_destroy(&obj->bounds_lock);
+	pthread_mutex_destroy (&obj->rebalance  );
+
+	free(obj->shards);
+	free(obj->bounds);
+	free(obj);
+}
+
+/*
+ * __cn_map_sharded_route
+ *
+ * Description:
+ *     Returns the shard "key" belongs in according to the bounds: the first
+ *     one whose bound is greater than "key". The caller holds "bounds_lock".
+ */
+
+CNM_UINT __cn_map_sharded_route(CNM_SHARDED obj, void *key) {
+	CNM_UINT lo = 0,
+	         hi = obj->bounds_set,
+	         mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (obj->func_compare(key, CNM_SHARD_BOUND(obj, mid)) < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/*
+ * __cn_map_sharded_lock
+ *
+ * Description:
+ *     Locks the shard "key" belongs in (for writing if "write" is true, and
+ *     for reading if not) and returns its number.
+ *
+ *     The shard is picked under a read lock on the bounds, which is let go
+ *     before locking the shard, since the thread moving a bound holds the
+ *     shards on both sides of it while it waits for the bounds. Once the shard
+ *     is locked, no bound around it can move, but one may have moved before
+ *     then. If the version changed at all in between, the shard is let go and
+ *     picked again.
+ */
+
+CNM_UINT __cn_map_sharded_lock(CNM_SHARDED obj, void *key, CNM_BYTE write) {
+	CNM_UINT v, s;
+
+	for (;;) {
+		pthread_rwlock_rdlock(&obj->bounds_lock);
+
+		v = obj->version;
+		s = __cn_map_sharded_route(obj, key);
+
+		pthread_rwlock_unlock(&obj->bounds_lock);
+
+		if (write)
+			pthread_rwlock_wrlock(&obj->shards[s].lock);
+		else
+			pthread_rwlock_rdlock(&obj->shards[s].lock);
+
+		//A bound next to this shard can only have moved while the thread
+		//moving it held the shard, so that change is seen here.
+		if (__atomic_load_n(&obj->version, __ATOMIC_RELAXED) == v)
+			return s;
+
+		pthread_rwlock_unlock(&obj->shards[s].lock);
+	}
+}
+
+/*
+ * __cn_map_sharded_settle
+ *
+ * Description:
+ *     If "sit" is at the end of its shard, moves it on to the least element of
+ *     the next shard that has any (locking that shard before unlocking the
+ *     one it was in). If no shard after it has any, the last one is unlocked
+ *     and "sit" is set to the end.
+ */
+
+void __cn_map_sharded_settle(CNM_SHARDED obj, CNM_SHARDED_ITERATOR *sit) {
+	while (sit->it.node == NULL) {
+		if (sit->shard + 1 >= obj->count) {
+			cn_map_sharded_release(obj, sit);
+			return;
+		}
+
+		pthread_rwlock_rdlock  (&obj->shards[sit->shard + 1].lock);
+		pthread_rwlock_unlock  (&obj->shards[sit->shard    ].lock);
+
+		sit->shard++;
+		cn_map_begin(obj->shards[sit->shard].map, &sit->it);
+	}
+}
+
+/*
+ * __cn_map_sharded_rebalance
+ *
+ * Description:
+ *     Called after an insertion into shard "s". If "s" holds more than its
+ *     share of the elements (by over CNM_SHARD_SLACK), half of the difference
+ *     between it and its smaller neighbour is moved over to that neighbour,
+ *     and the bound between the two follows. This repeats from the shard that
+ *     took the elements, until no shard along the way is too big.
+ *
+ *     Only one rebalance runs at a time. If one is already going, this one
+ *     is skipped, and the shard gets looked at again after more insertions.
+ *     The two shards are locked in order (left, then right), the same order
+ *     iterators lock them in, so they can't deadlock with each other.
+ */
+
+void __cn_map_sharded_rebalance(CNM_SHARDED obj, CNM_UINT s) {
+	CNM_UINT lo, hi, n_lo, n_hi, total, size, to;
+
+	if (obj->count < 2 || pthread_mutex_trylock(&obj->rebalance) != 0)
+		return;
+
+	for (;;) {
+		//Sizes of the other shards can change under us. That's fine, since
+		//they are only used to decide whether to do anything.
+		total = cn_map_sharded_size(obj);
+		size  = CNM_SHARD_SIZE(obj, s);
+
+		if ((CNM_U64) size * obj->count <=
+			(CNM_U64) total + (CNM_U64) CNM_SHARD_SLACK * obj->count
+		)
+			break;
+
+		//Pick the smaller of the two neighbours.
+		if (s == 0)
+			lo = s;
+		else if (s + 1 == obj->count)
+			lo = s - 1;
+		else {
+			n_lo = CNM_SHARD_SIZE(obj, s - 1);
+			n_hi = CNM_SHARD_SIZE(obj, s + 1);
+			lo   = (n_lo < n_hi) ? s - 1 : s;
+		}
+
+		hi = lo + 1;
+		to = obj->count;
+
+		pthread_rwlock_wrlock(&obj->shards[lo].lock);
+		pthread_rwlock_wrlock(&obj->shards[hi].lock);
+
+		n_lo = obj->shards[lo].map->size;
+		n_hi = obj->shards[hi].map->size;
+
+		if (n_lo > n_hi + CNM_SHARD_SLACK)
+			__cn_map_sharded_move(obj, lo, to = hi, (n_lo - n_hi) / 2);
+		else if (n_hi > n_lo + CNM_SHARD_SLACK)
+			__cn_map_sharded_move(obj, hi, to = lo, (n_hi - n_lo) / 2);
+
+		pthread_rwlock_unlock(&obj->shards[hi].lock);
+		pthread_rwlock_unlock(&obj->shards[lo].lock);
+
+		//The shard that took the elements may be too big now. It gets no
+		//insertions of its own to notice with, so look at it from here.
+		if (to == obj->count)
+			break;
+
+		s = to;
+	}
+
+	pthread_mutex_unlock(&obj->rebalance);
+}
+
+/*
+ * __cn_map_sharded_move
+ *
+ * Description:
+ *     Moves "n" elements from shard "from" over to the neighbouring shard
+ *     "to", and sets the bound between them to the least key now in the right
+ *     one. If "to" is on the right, the "n" most elements of "from" go.
+ *     Otherwise, its "n" least do. The caller holds the rebalance lock and
+ *     write locks on both shards. The bounds are locked for writing only
+ *     while the bound itself changes.
+ *
+ *     Elements come out of one end of "from" and go in at the near end of
+ *     "to", so every insertion has a correct hint.
+ *
+ * Complexity:
+ *     O(n lg N)
+ */
+
+void __cn_map_sharded_move(
+	CNM_SHARDED obj,
+	CNM_UINT    from,
+	CNM_UINT    to,
+	CNM_UINT    n
+) {
+	CN_MAP       src = obj->shards[from].map,
+	             dst = obj->shards[to  ].map;
+	CNM_UINT     lo  = (from < to) ? from : to,
+	             i;
+	CNM_ITERATOR it, hint;
+
+	if (from < to)
+		cn_map_begin(dst, &hint);
+	else
+		cn_map_end  (dst, &hint);
+
+	for (i = 0; i < n; i++) {
+		if (from < to)
+			cn_map_rbegin(src, &it);
+		else
+			cn_map_begin (src, &it);
+
+		cn_map_insert_hint(dst, &hint, it.node->key, it.node->data);
+		cn_map_erase(src, &it);
+	}
+
+	CNM_SHARD_RESIZE(obj, from);
+	CNM_SHARD_RESIZE(obj, to  );
+
+	//Move the bound. Threads that picked a shard before this start over.
+	cn_map_begin(obj->shards[lo + 1].map, &it);
+
+	pthread_rwlock_wrlock(&obj->bounds_lock);
+
+	memcpy(CNM_SHARD_BOUND(obj, lo), it.node->key, obj->key_size);
+
+	if (obj->bounds_set < lo + 1)
+		obj->bounds_set = lo + 1;
+
+	__atomic_store_n(&obj->version, obj->version + 1, __ATOMIC_RELAXED);
+
+	pthread_rwlock_unlock(&obj->bounds_lock);
+}
+
+// ----------------------------------------------------------------------------
+// Set Operations                                                          {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * Set Job Struct
+ *
+ * One piece of a set operation: combining the tree "tree" (of black height
+ * "height") with the subtree "src" of the other CN_Map. The result is left in
+ * "tree" and "height". "obj" is the CN_Map nodes are made and freed through.
+ * It is the real one, or a copy of it with a pool of its own while the job is
+ * on another thread. "added" and "removed" count the nodes made and freed.
+ * The job may hand half of its work to a new thread "spawn" more times down.
+ */
+
+typedef struct cnm_set_job {
+	CN_MAP     obj;
+	CNM_NODE  *tree, *src;
+	CNM_UINT   height, added, removed, spawn;
+	CNM_BYTE   op;
+
+	void     (*merge)(CNM_NODE *, CNM_NODE *);
+} CNM_SET_JOB;
+
+//What a set job does with the keys of "src"
+#define CNM_SET_UNION        0
+#define CNM_SET_INTERSECTION 1
+#define CNM_SET_DIFFERENCE   2
+
+void      __cn_map_set_run   (CN_MAP, CN_MAP, CNM_BYTE,
+                              void (*)(CNM_NODE *, CNM_NODE *));
+void      __cn_map_set_slow  (CN_MAP, CN_MAP, CNM_BYTE,
+                              void (*)(CNM_NODE *, CNM_NODE *));
+void      __cn_map_set_nested(CNM_SET_JOB *);
+void     *__cn_map_set_thread(void *);
+CNM_NODE *__cn_map_set_copy  (CNM_SET_JOB *, CNM_NODE *);
+void      __cn_map_set_drop  (CNM_SET_JOB *, CNM_NODE *);
+
+/*
+ * cn_map_union
+ *
+ * Description:
+ *     Inserts every key/value pair of "src" into "obj". Pairs are copied in
+ *     like with "cn_map_insert", and "src" is left as it is. For a key that is
+ *     in both, "merge" (if not NULL) is called with the node from "obj" and
+ *     the one from "src", and may change the value in the first one. If it is
+ *     NULL, "obj" keeps its own value.
+ *
+ *     Rather than inserting one key at a time, "obj" is split around the key
+ *     at the head of "src", the two halves are combined with the two subtrees
+ *     of "src", and the results are joined back together around that key. The
+ *     two halves have nothing to do with each other, so for large CN_Maps, the
+ *     top few levels of this run on separate threads. The comparison function,
+ *     "merge", and the destructor of "obj" must be safe to call from multiple
+ *     threads at once.
+ *
+ *     Both CN_Maps must have the same key type, value type and order. For B+
+ *     tree and persistent CN_Maps, the pairs are inserted one at a time. So
+ *     are they when "src" is small enough next to "obj" (M lg N < N), where
+ *     each split and join costs more than the search it saves.
+ *
+ * Complexity:
+ *     O(M lg(N / M + 1)) work for CN_Maps of M and N >= M elements, plus the
+ *     O(K) it takes to copy the K pairs only "src" has. O(lg N lg M) span.
+ *     O(M lg N) if inserted one at a time.
+ */
+
+void cn_map_union(
+	CN_MAP   obj,
+	CN_MAP   src,
+	void   (*merge)(CNM_NODE *, CNM_NODE *)
+) {
+	__cn_map_set_run(obj, src, CNM_SET_UNION, merge);
+}
+
+/*
+ * cn_map_intersection
+ *
+ * Description:
+ *     Erases every element of "obj" whose key isn't in "src". For the keys
+ *     that are in both, "merge" (if not NULL) is called just like in
+ *     "cn_map_union". Erased elements go through the destructor of "obj".
+ *     "src" is left as it is. Works the same way as "cn_map_union".
+ *
+ * Complexity:
+ *     O(M lg(N / M + 1)) work, plus O(K) to erase K elements. O(lg N lg M)
+ *     span.
+ */
+
+void cn_map_intersection(
+	CN_MAP   obj,
+	CN_MAP   src,
+	void   (*merge)(CNM_NODE *, CNM_NODE *)
+) {
+	__cn_map_set_run(obj, src, CNM_SET_INTERSECTION, merge);
+}
+
+/*
+ * cn_map_difference
+ *
+ * Description:
+ *     Erases every element of "obj" whose key is in "src". Erased elements go
+ *     through the destructor of "obj". "src" is left as it is. Works the same
+ *     way as "cn_map_union".
+ *
+ * Complexity:
+ *     O(M lg(N / M + 1)) work. O(lg N lg M) span.
+ */
+
+void cn_map_difference(CN_MAP obj, CN_MAP src) {
+	__cn_map_set_run(obj, src, CNM_SET_DIFFERENCE, NULL);
+}
+
+/*
+ * __cn_map_set_run
+ *
+ * Description:
+ *     Does set operation "op" on "obj" with "src" (see "cn_map_union"). Each
+ *     thread spawned gets its own copy of the CN_Map struct, with a pool of
+ *     its own, so making and freeing nodes never needs a lock. The pools are
+ *     merged back into the CN_Map's as the threads finish.
+ *
+ *     CN_Maps that own their string keys, share node memory with other
+ *     CN_Maps, or have concurrent reads on, are done on the calling thread
+ *     alone.
+ */
+
+void __cn_map_set_run(
+	CN_MAP   obj,
+	CN_MAP   src,
+	CNM_BYTE op,
+	void   (*merge)(CNM_NODE *, CNM_NODE *)
+) {
+	CNM_SET_JOB  job;
+	CNM_ITERATOR it;
+	CNM_UINT     spawn, lg, i;
+	long         cores;
+
+	//A CN_Map combined with itself. Only merging (or clearing) is left.
+	if (obj == src) {
+		if (op == CNM_SET_DIFFERENCE)
+			cn_map_clear(obj);
+		else
+		if (merge != NULL)
+			cn_map_traverse(obj, &it)
+				merge(it.node, it.node);
+
+		return;
+	}
+
+	if (obj->bt != NULL || obj->ps != NULL || src->bt != NULL) {
+		__cn_map_set_slow(obj, src, op, merge);
+		return;
+	}
+
+	//A few keys go in (or come out) faster one at a time. An intersection
+	//has to go through all of "obj" either way, so it never does.
+	for (lg = 0, i = obj->size; i > 1; i >>= 1)
+		lg++;
+
+	if (op != CNM_SET_INTERSECTION && (CNM_U64) src->size * lg < obj->size) {
+		__cn_map_set_slow(obj, src, op, merge);
+		return;
+	}
+
+	//Enough levels of threads for about twice as many threads as cores.
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	spawn = 0;
+
+	if (cores > 1 && (CNM_U64) obj->size + src->size >= CNM_SET_PARALLEL_MIN &&
+		obj->epoch == NULL && obj->share == NULL &&
+		!(obj->str_keys & CNM_STR_OWNED)
+	)
+		for (spawn = 1; cores > 1 && spawn < CNM_SET_SPAWN_MAX; cores >>= 1)
+			spawn++;
+
+	job.obj     = obj;
+	job.tree    = obj->head;
+	job.height  = __cn_map_black_height(obj->head);
+	job.src     = src->head;
+	job.added   = 0;
+	job.removed = 0;
+	job.spawn   = spawn;
+	job.op      = op;
+	job.merge   = merge;
+
+	__cn_map_write_begin(obj);
+
+	__cn_map_set_nested(&job);
+
+	if (job.tree != NULL) {
+		job.tree->up     = NULL;
+		job.tree->colour = CNM_BLACK;
+	}
+
+	obj->size = obj->size + job.added - job.removed;
+
+	CNM_STORE(obj->head, job.tree);
+	__cn_map_calibrate(obj);
+
+	__cn_map_write_end(obj);
+
+	//Reclaim the key arena once it is mostly erased strings.
+	if (obj->arena.dead >= CNM_ARENA_CHUNK && obj->arena.dead > obj->arena.live)
+		cn_map_compact_keys(obj);
+}
+
+/*
+ * __cn_map_set_slow
+ *
+ * Description:
+ *     Does set operation "op" one element at a time, for CN_Maps that can't
+ *     be split and joined. Costs O(M lg N) (or O(N lg M) for intersections).
+ */
+
+void __cn_map_set_slow(
+	CN_MAP   obj,
+	CN_MAP   src,
+	CNM_BYTE op,
+	void   (*merge)(CNM_NODE *, CNM_NODE *)
+) {
+	CNM_ITERATOR it, next, s;
+	CNM_BYTE     moves = (obj->bt != NULL || obj->ps != NULL);
+	void        *key;
+
+	if (op == CNM_SET_UNION) {
+		cn_map_traverse(src, &s) {
+			if (!cn_map_try_insert(obj, &it, s.node->key, s.node->data) &&
+				merge != NULL
+			)
+				merge(it.node, s.node);
+		}
+
+		return;
+	}
+
+	if (op == CNM_SET_DIFFERENCE) {
+		cn_map_traverse(src, &s) {
+			cn_map_find(obj, &it, s.node->key);
+
+			if (it.node != NULL)
+				cn_map_erase(obj, &it);
+		}
+
+		return;
+	}
+
+	//Only B+ tree and persistent CN_Maps move nodes when erasing, so only
+	//they find the way back in by key (see "__cn_map_merge_slow").
+	key = malloc(obj->key_size);
+
+	cn_map_begin(obj, &it);
+
+	while (it.node != NULL) {
+		cn_map_find(src, &s, it.node->key);
+
+		if (s.node != NULL) {
+			if (merge != NULL)
+				merge(it.node, s.node);
+
+			cn_map_next(obj, &it);
+			continue;
+		}
+
+		next = it;
+		cn_map_next(obj, &next);
+
+		if (moves && next.node != NULL)
+			memcpy(key, next.node->key, obj->key_size);
+
+		cn_map_erase(obj, &it);
+
+		if (next.node == NULL)
+			break;
+
+		if (moves)
+			cn_map_lower_bound(obj, &it, key);
+		else
+			it = next;
+	}
+
+	free(key);
+}
+
+/*
+ * __cn_map_set_nested
+ *
+ * Description:
+ *     Recursive part of a set operation. Splits "job->tree" around the key at
+ *     the head of "job->src", combines the left half with the left subtree of
+ *     "src" and the right half with the right subtree (the right one on a new
+ *     thread, if the job may still spawn one), and joins them back together.
+ *     The key itself goes in the middle if it belongs in the result.
+ */
+
+void __cn_map_set_nested(CNM_SET_JOB *job) {
+	CN_MAP        obj = job->obj;
+	CNM_NODE     *src = job->src, *found;
+	CNM_SET_JOB   left, right;
+	struct cn_map view;
+	pthread_t     tid;
+	CNM_BYTE      spawned;
+
+	//Nothing left in "src". Only an intersection has anything to do.
+	if (src == NULL) {
+		if (job->op == CNM_SET_INTERSECTION && job->tree != NULL) {
+			__cn_map_set_drop(job, job->tree);
+			job->tree   = NULL;
+			job->height = 0;
+		}
+
+		return;
+	}
+
+	//Nothing left in the tree. A union takes all of "src".
+	if (job->tree == NULL) {
+		if (job->op == CNM_SET_UNION) {
+			job->tree   = __cn_map_set_copy(job, src);
+			job->height = __cn_map_black_height(job->tree);
+		}
+
+		return;
+	}
+
+	found = __cn_map_split(
+		obj, job->tree, job->height, src->key,
+		&left.tree, &left.height, &right.tree, &right.height
+	);
+
+	left.obj     = right.obj     = obj;
+	left.src     = src->left;
+	right.src    = src->right;
+	left.added   = right.added   = 0;
+	left.removed = right.removed = 0;
+	left.spawn   = right.spawn   = (job->spawn > 0) ? job->spawn - 1 : 0;
+	left.op      = right.op      = job->op;
+	left.merge   = right.merge   = job->merge;
+
+	//Hand the right side to another thread, with a pool of its own.
+	spawned = 0;
+
+	if (job->spawn > 0) {
+		view = *obj;
+		__cn_map_pool_init(&view.pool, obj->pool.slot_size);
+
+		right.obj = &view;
+		spawned   = !pthread_create(&tid, NULL, __cn_map_set_thread, &right);
+
+		if (!spawned)
+			right.obj = obj;
+	}
+
+	__cn_map_set_nested(&left);
+
+	if (spawned) {
+		pthread_join(tid, NULL);
+		__cn_map_pool_merge(&obj->pool, &view.pool);
+	}
+	else
+		__cn_map_set_nested(&right);
+
+	job->added   += left.added   + right.added;
+	job->removed += left.removed + right.removed;
+
+	//The key is in both CN_Maps.
+	if (found != NULL) {
+		if (job->op == CNM_SET_DIFFERENCE) {
+			__cn_map_free_node(obj, found);
+			job->removed++;
+			found = NULL;
+		}
+		else
+		if (job->merge != NULL)
+			job->merge(found, src);
+	}
+	else
+	if (job->op == CNM_SET_UNION) {
+		found = __cn_map_create_node(obj, src->key, src->data);
+		job->added++;
+	}
+
+	if (found != NULL)
+		job->tree = __cn_map_join(
+			obj, left.tree, left.height, found, right.tree, right.height,
+			&job->height
+		);
+	else
+		job->tree = __cn_map_join2(
+			obj, left.tree, left.height, right.tree, right.height,
+			&job->height
+		);
+}
+
+/*
+ * __cn_map_set_thread
+ *
+ * Description:
+ *     Thread entry for the side of a set operation handed to a new thread.
+ */
+
+void *__cn_map_set_thread(void *arg) {
+	__cn_map_set_nested((CNM_SET_JOB *) arg);
+
+	return NULL;
+}
+
+/*
+ * __cn_map_set_copy
+ *
+ * Description:
+ *     Copies the subtree at "src" node for node, colours and all, and returns
+ *     the copy. It is a valid red-black tree as it is.
+ */
+
+CNM_NODE *__cn_map_set_copy(CNM_SET_JOB *job, CNM_NODE *src) {
+	CNM_NODE *node;
+
+	if (src == NULL)
+		return NULL;
+
+	node = __cn_map_create_node(job->obj, src->key, src->data);
+	job->added++;
+
+	node->colour = src->colour;
+	node->left   = __cn_map_set_copy(job, src->left );
+	node->right  = __cn_map_set_copy(job, src->right);
+
+	if (node->left  != NULL) node->left->up  = node;
+	if (node->right != NULL) node->right->up = node;
+
+	if (job->obj->order_stats)
+		__cn_map_update_count(node);
+
+	return node;
+}
+
+/*
+ * __cn_map_set_drop
+ *
+ * Description:
+ *     Frees every node in the subtree at "node", destructor and all.
+ */
+
+void __cn_map_set_drop(CNM_SET_JOB *job, CNM_NODE *node) {
+	CNM_NODE *left;
+
+	while (node != NULL) {
+		if (node->right != NULL)
+			__cn_map_set_drop(job, node->right);
+
+		left = node->left;
+
+		__cn_map_free_node(job->obj, node);
+		job->removed++;
+
+		node = left;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Split and Join                                                          {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_split
+ *
+ * Description:
+ *     Moves every key/value pair of "obj" into two new CN_Maps, put in "*left"
+ *     and "*right". "*left" gets the keys less than "key", and "*right" gets
+ *     the rest. Both are set up like "obj" (same comparison function,
+ *     destructor, order statistics and concurrent reads), and have to be freed
+ *     with "cn_map_free". "obj" is left empty, and can still be used.
+ *
+ *     Nodes are moved, not copied. Going down to "key", each subtree hanging
+ *     off the path is cut loose and joined onto the tree on its side of "key"
+ *     (see "__cn_map_split"). Iterators to the pairs stay valid in whichever
+ *     CN_Map they end up in. Afterwards, the three CN_Maps make and free nodes
+ *     through one pool, which they lock while more than one of them is left,
+ *     so each may still be used on a thread of its own.
+ *
+ *     With order statistics on, the size of each half is read off of its
+ *     head. Otherwise, the smaller half is counted, walking in from both ends
+ *     at once.
+ *
+ *     B+ tree CN_Maps, CN_Maps that own their string keys, and CN_Maps with
+ *     concurrent reads on have their pairs copied over one at a time instead.
+ *     Persistent CN_Maps can't be split. "*left" and "*right" are set to NULL,
+ *     and "obj" is left as it is.
+ *
+ * Complexity:
+ *     O(lg N) with order statistics on. O(lg N + min(K, N - K)) otherwise,
+ *     where K is the number of keys less than "key". O(N) if copied.
+ */
+
+void cn_map_split(CN_MAP obj, void *key, CN_MAP *left, CN_MAP *right) {
+	CNM_NODE     *head = obj->head, *found, *l, *r, *a, *b;
+	CNM_UINT      lh, rh, size = obj->size, lsize;
+	CNM_ITERATOR  it, hl, hr;
+
+	if (obj->ps != NULL) {
+		*left = *right = NULL;
+		return;
+	}
+
+	*left  = __cn_map_new_like(obj);
+	*right = __cn_map_new_like(obj);
+
+	if (!__cn_map_can_move(obj, *left)) {
+		cn_map_end(*left , &hl);
+		cn_map_end(*right, &hr);
+
+		cn_map_traverse(obj, &it) {
+			if (obj->func_compare(it.node->key, key) < 0)
+				cn_map_insert_hint(*left , &hl, it.node->key, it.node->data);
+			else
+				cn_map_insert_hint(*right, &hr, it.node->key, it.node->data);
+		}
+
+		__cn_map_hand_over(obj);
+		return;
+	}
+
+	//All three make and free nodes out of the same memory from now on.
+	__cn_map_share(obj, *left);
+	__cn_map_share(obj, *right);
+
+	found = __cn_map_split(
+		obj, head, __cn_map_black_height(head), key, &l, &lh, &r, &rh
+	);
+
+	//The node with "key" itself goes in front of everything in "r".
+	if (found != NULL)
+		r = __cn_map_join(obj, NULL, 0, found, r, rh, &rh);
+
+	if (l != NULL) {
+		l->up     = NULL;
+		l->colour = CNM_BLACK;
+	}
+
+	if (r != NULL) {
+		r->up     = NULL;
+		r->colour = CNM_BLACK;
+	}
+
+	(*left )->head = l;
+	(*right)->head = r;
+
+	__cn_map_calibrate(*left );
+	__cn_map_calibrate(*right);
+
+	//Count whichever half runs out first.
+	if (obj->order_stats)
+		lsize = (l != NULL) ? l->count : 0;
+	else {
+		a = (*left )->it_least.node;
+		b = (*right)->it_most.node;
+
+		for (lsize = 0; a != NULL && b != NULL; lsize++) {
+			a = __cn_map_successor  (a);
+			b = __cn_map_predecessor(b);
+		}
+
+		if (a != NULL)
+			lsize = size - lsize;
+	}
+
+	(*left )->size = lsize;
+	(*right)->size = size - lsize;
+
+	obj->head = NULL;
+	obj->size = 0;
+	__cn_map_calibrate(obj);
+}
+
+/*
+ * cn_map_join
+ *
+ * Description:
+ *     Moves every key/value pair of "other" into "obj", undoing a
+ *     "cn_map_split". Every key of "other" has to come after every key of
+ *     "obj". If one doesn't, nothing is moved and 0 is returned. Otherwise, 1
+ *     is returned, and "other" is left empty. It still has to be freed.
+ *
+ *     Nodes are moved, not copied. The last node of "obj" is taken out, and
+ *     put back in between the two trees, down the side of the taller one (see
+ *     "__cn_map_join"). From then on, the two CN_Maps make and free nodes
+ *     through one pool, like after "cn_map_split".
+ *
+ *     Pairs are copied one at a time instead if either CN_Map is a B+ tree,
+ *     owns its string keys, or has concurrent reads on, if their pairs aren't
+ *     the same size, or if each already shares its pool with other CN_Maps.
+ *     Persistent CN_Maps can't be joined, and 0 is returned.
+ *
+ * Complexity:
+ *     O(lg N + lg M). Counting up the nodes of "other" adds O(M) if "obj" has
+ *     order statistics on and "other" doesn't. O(M) if copied.
+ */
+
+CNM_UINT cn_map_join(CN_MAP obj, CN_MAP other) {
+	CNM_ITERATOR last, first, it;
+	CNM_NODE    *head;
+	CNM_UINT     height;
+
+	if (obj == other || obj->ps != NULL || other->ps != NULL)
+		return 0;
+
+	if (other->size == 0)
+		return 1;
+
+	if (obj->size > 0) {
+		cn_map_rbegin(obj  , &last );
+		cn_map_begin (other, &first);
+
+		if (obj->func_compare(last.node->key, first.node->key) >= 0)
+			return 0;
+	}
+
+	if (!__cn_map_can_move(obj, other) || !__cn_map_share(obj, other)) {
+		cn_map_end(obj, &last);
+
+		cn_map_traverse(other, &it)
+			cn_map_insert_hint(obj, &last, it.node->key, it.node->data);
+
+		__cn_map_hand_over(other);
+		return 1;
+	}
+
+	if (obj->order_stats && !other->order_stats)
+		__cn_map_recount(other->head);
+
+	head = __cn_map_join2(
+		obj,
+		obj->head  , __cn_map_black_height(obj->head),
+		other->head, __cn_map_black_height(other->head),
+		&height
+	);
+
+	head->colour = CNM_BLACK;
+
+	obj->head    = head;
+	obj->size   += other->size;
+	other->head  = NULL;
+	other->size  = 0;
+
+	__cn_map_calibrate(obj);
+	__cn_map_calibrate(other);
+
+	return 1;
+}
+
+/*
+ * __cn_map_new_like
+ *
+ * Description:
+ *     Makes a blank CN_Map set up just like "obj": same kind of tree, key and
+ *     value sizes, comparison function, destructor, order statistics and
+ *     concurrent reads.
+ */
+
+CN_MAP __cn_map_new_like(CN_MAP obj) {
+	CN_MAP map;
+
+	if (obj->str_keys)
+		map = new_cn_map_str(
+			obj->elem_size, obj->str_keys & (CNM_STR_LENGTH | CNM_STR_OWNED)
+		);
+	else
+		map = new_cn_map(obj->key_size, obj->elem_size, obj->func_compare);
+
+	//Only "new_cn_map_btree_int" makes B+ trees with this comparison.
+	if (obj->bt != NULL)
+		__cn_map_bt_init(map, obj->func_compare == __cn_map_bt_cmp_int);
+
+	map->func_compare  = obj->func_compare;
+	map->func_destruct = obj->func_destruct;
+
+	cn_map_set_order_statistics(map, obj->order_stats);
+	cn_map_set_concurrent_reads(map, obj->epoch != NULL);
+
+	return map;
+}
+
+/*
+ * __cn_map_can_move
+ *
+ * Description:
+ *     Returns whether nodes can be moved between "obj" and "other" as they
+ *     are. Both have to be plain red-black trees without concurrent reads,
+ *     with nodes laid out the same way. Keys in an arena stay with the CN_Map
+ *     that owns it, so they can't be moved either.
+ */
+
+CNM_BYTE __cn_map_can_move(CN_MAP obj, CN_MAP other) {
+	if (obj->bt    != NULL || other->bt    != NULL ||
+		obj->ps    != NULL || other->ps    != NULL ||
+		obj->epoch != NULL || other->epoch != NULL ||
+		((obj->str_keys | other->str_keys) & CNM_STR_OWNED)
+	)
+		return 0;
+
+	return obj->key_size    == other->key_size    &&
+	       obj->elem_size   == other->elem_size   &&
+	       obj->data_offset == other->data_offset &&
+	       obj->str_keys    == other->str_keys;
+}
+
+/*
+ * __cn_map_share
+ *
+ * Description:
+ *     Makes "obj" and "other" make and free nodes out of the same pool, so
+ *     nodes can be moved from one to the other. Each CN_Map's own pool is
+ *     merged into it. Returns 0 (and changes nothing) if each of them already
+ *     shares a different pool with other CN_Maps. Returns 1 otherwise.
+ */
+
+CNM_BYTE __cn_map_share(CN_MAP obj, CN_MAP other) {
+	CNM_SHARE *sh;
+	CN_MAP     swap;
+	CNM_BYTE   locked;
+
+	if (obj->share != NULL && obj->share == other->share)
+		return 1;
+
+	//Whichever has a pool of its own (or one no one else uses) joins the
+	//other's.
+	if (other->share != NULL && (obj->share == NULL ||
+		__atomic_load_n(&other->share->maps, __ATOMIC_ACQUIRE) > 1)
+	) {
+		swap  = obj;
+		obj   = other;
+		other = swap;
+	}
+
+	if (other->share != NULL) {
+		if (__atomic_load_n(&other->share->maps, __ATOMIC_ACQUIRE) > 1)
+			return 0;
+
+		//No one else uses it. Take it back as a pool of its own.
+		other->pool = other->share->pool;
+
+		pthread_mutex_destroy(&other->share->lock);
+		free(other->share);
+		other->share = NULL;
+	}
+
+	if (obj->share == NULL) {
+		sh = (CNM_SHARE *) malloc(sizeof(CNM_SHARE));
+
+		sh->pool = obj->pool;
+		sh->maps = 1;
+		pthread_mutex_init(&sh->lock, NULL);
+
+		__cn_map_pool_init(&obj->pool, obj->pool.slot_size);
+		obj->share = sh;
+	}
+
+	locked = __cn_map_share_lock(obj);
+	__cn_map_pool_merge(&obj->share->pool, &other->pool);
+	__cn_map_share_unlock(obj, locked);
+
+	other->share = obj->share;
+	__atomic_add_fetch(&obj->share->maps, 1, __ATOMIC_ACQ_REL);
+
+	return 1;
+}
+
+/*
+ * __cn_map_share_lock
+ *
+ * Description:
+ *     Locks the pool a CN_Map shares with others, if any of them are still
+ *     around. Returns whether it did, to be passed to "__cn_map_share_unlock".
+ */
+
+CNM_BYTE __cn_map_share_lock(CN_MAP obj) {
+	if (__atomic_load_n(&obj->share->maps, __ATOMIC_ACQUIRE) < 2)
+		return 0;
+
+	pthread_mutex_lock(&obj->share->lock);
+	return 1;
+}
+
+void __cn_map_share_unlock(CN_MAP obj, CNM_BYTE locked) {
+	if (locked)
+		pthread_mutex_unlock(&obj->share->lock);
+}
+
+/*
+ * __cn_map_share_release
+ *
+ * Description:
+ *     Gives every node in the subtree at "node" back to the pool "obj" shares
+ *     with other CN_Maps, all under one lock. Destructors aren't called.
+ */
+
+void __cn_map_share_release(CN_MAP obj, CNM_NODE *node) {
+	CNM_NODE *list = NULL, *next;
+	CNM_BYTE  locked;
+
+	__cn_map_flatten(node, &list);
+
+	locked = __cn_map_share_lock(obj);
+
+	for (; list != NULL; list = next) {
+		next = list->right;
+		__cn_map_pool_release(&obj->share->pool, list);
+	}
+
+	__cn_map_share_unlock(obj, locked);
+}
+
+/*
+ * __cn_map_hand_over
+ *
+ * Description:
+ *     Empties a CN_Map whose pairs were all copied into another one, which
+ *     owns them now. The destructor is only called on nodes erased before.
+ */
+
+void __cn_map_hand_over(CN_MAP obj) {
+	void (*dest)(CNM_NODE *) = obj->func_destruct;
+
+	if (obj->epoch != NULL)
+		__cn_map_epoch_sync(obj);
+
+	obj->func_destruct = NULL;
+	cn_map_clear(obj);
+	obj->func_destruct = dest;
+}
+
+// ----------------------------------------------------------------------------
+// Node Splicing                                                           {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * cn_map_merge
+ *
+ * Description:
+ *     Moves every key/value pair of "src" whose key isn't in "obj" yet over to
+ *     "obj", like "merge" on a C++17 "std::map". Pairs with a key "obj"
+ *     already has are left in "src". Both CN_Maps must have the same key type,
+ *     value type and order.
+ *
+ *     Nodes are moved, not copied. Each one is taken out of "src" and hung in
+ *     "obj" as is, so iterators to them stay valid, now pointing into "obj".
+ *     Nothing is allocated, destructed or freed. If every key of "src" comes
+ *     after every key of "obj", the whole tree is joined on at once (see
+ *     "cn_map_join"). Afterwards, the two CN_Maps make and free nodes through
+ *     one pool, like after "cn_map_split".
+ *
+ *     Pairs are copied and erased one at a time instead (without calling the
+ *     destructor on them) if either CN_Map is a B+ tree or persistent, owns
+ *     its string keys, or has concurrent reads on, or if each already shares
+ *     its pool with other CN_Maps.
+ *
+ * Complexity:
+ *     O(M lg (N + M)) for M elements in "src". O(lg N + lg M) if joined.
+ */
+
+void cn_map_merge(CN_MAP obj, CN_MAP src) {
+	CNM_NODE *node, *next;
+
+	if (obj == src || src->size == 0)
+		return;
+
+	if (!__cn_map_can_move(obj, src) || !__cn_map_share(obj, src)) {
+		__cn_map_merge_slow(obj, src);
+		return;
+	}
+
+	if (cn_map_join(obj, src))
+		return;
+
+	for (node = src->it_least.node; node != NULL; node = next) {
+		next = __cn_map_successor(node);
+		__cn_map_move(obj, src, node);
+	}
+}
+
+/*
+ * cn_map_splice
+ *
+ * Description:
+ *     Moves the key/value pair "it" points to from "src" over to "obj", if
+ *     "obj" doesn't have its key yet. Returns 1 if it was moved, and "it"
+ *     points to it in "obj" afterwards. Returns 0 if "obj" already has the
+ *     key, in which case the pair stays in "src" and "it" is left alone.
+ *
+ *     Like "cn_map_merge", the node itself is moved, and nothing is
+ *     allocated, destructed or freed. The same kinds of CN_Maps have the pair
+ *     copied and erased instead, and "it" then points to the copy.
+ *
+ * Complexity:
+ *     O(lg N + lg M)
+ */
+
+CNM_UINT cn_map_splice(CN_MAP obj, CN_MAP src, CNM_ITERATOR *it) {
+	void       (*dest)(CNM_NODE *) = src->func_destruct;
+	CNM_ITERATOR found;
+
+	if (obj == src || it->node == NULL)
+		return 0;
+
+	if (__cn_map_can_move(obj, src) && __cn_map_share(obj, src)) {
+		if (__cn_map_move(obj, src, it->node) != it->node)
+			return 0;
+
+		it->prev = it->node->up;
+		return 1;
+	}
+
+	if (!cn_map_try_insert(obj, &found, it->node->key, it->node->data))
+		return 0;
+
+	//The pair belongs to "obj" now. Anything erased before still gets the
+	//destructor, once readers are done with it.
+	if (src->epoch != NULL)
+		__cn_map_epoch_sync(src);
+
+	src->func_destruct = NULL;
+	cn_map_erase(src, it);
+
+	if (src->epoch != NULL)
+		__cn_map_epoch_sync(src);
+
+	src->func_destruct = dest;
+
+	*it = found;
+	return 1;
+}
+
+/*
+ * cn_map_extract
+ *
+ * Description:
+ *     Takes the node "it" points to out of the CN_Map, and hands it to the
+ *     caller, key/value pair and all. Nothing is destructed or freed. "it" is
+ *     set to "end". The caller may change the key (and value) in place, then
+ *     put the node back with "cn_map_insert_node", or get rid of it with
+ *     "cn_map_free_node".
+ *
+ *     The node stays in the memory of the CN_Map it came from. It can only go
+ *     back in that CN_Map, or one it shares node memory with (see
+ *     "cn_map_split"), and has to be dealt with before that CN_Map is cleared
+ *     or freed.
+ *
+ *     B+ tree CN_Maps, persistent CN_Maps, CN_Maps that own their string keys,
+ *     and CN_Maps with concurrent reads on don't keep their pairs in nodes
+ *     that can be handed out like this. For them, NULL is returned and
+ *     nothing is done.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_NODE *cn_map_extract(CN_MAP obj, CNM_ITERATOR *it) {
+	CNM_NODE *node = it->node;
+
+	if (node == NULL || obj->bt != NULL || obj->ps != NULL ||
+		obj->epoch != NULL || (obj->str_keys & CNM_STR_OWNED)
+	)
+		return NULL;
+
+	__cn_map_write_begin(obj);
+	__cn_map_detach(obj, node);
+	__cn_map_write_end(obj);
+
+	*it = obj->it_end;
+	return node;
+}
+
+/*
+ * cn_map_insert_node
+ *
+ * Description:
+ *     Puts a node taken out with "cn_map_extract" back in, wherever its key
+ *     goes now. Returns 1 if it went in, with "it" pointing to it. If the key
+ *     is already in the CN_Map, 0 is returned, "it" points to the element
+ *     with that key instead, and the node is still the caller's. Nothing is
+ *     allocated or copied either way.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_UINT cn_map_insert_node(CN_MAP obj, CNM_ITERATOR *it, CNM_NODE *node) {
+	CNM_NODE *cur;
+
+	//The key might have been changed since it was cached.
+	if (obj->str_keys)
+		__cn_map_str_cache(obj, node);
+
+	cur = __cn_map_move(obj, NULL, node);
+
+	it->node = cur;
+	it->prev = cur->up;
+
+	return (cur == node);
+}
+
+/*
+ * cn_map_free_node
+ *
+ * Description:
+ *     Calls the destructor on a node taken out with "cn_map_extract", and
+ *     gives its memory back to the CN_Map it came from.
+ */
+
+void cn_map_free_node(CN_MAP obj, CNM_NODE *node) {
+	__cn_map_free_node(obj, node);
+}
+
+/*
+ * __cn_map_merge_slow
+ *
+ * Description:
+ *     "cn_map_merge" for CN_Maps nodes can't be moved between. Each pair is
+ *     copied into "obj", and erased from "src" without the destructor.
+ */
+
+void __cn_map_merge_slow(CN_MAP obj, CN_MAP src) {
+	void       (*dest)(CNM_NODE *) = src->func_destruct;
+	CNM_ITERATOR it, next, found;
+	CNM_BYTE     moves = (src->bt != NULL || src->ps != NULL);
+	void        *key   = malloc(src->key_size);
+
+	//Anything erased before still gets the destructor.
+	if (src->epoch != NULL)
+		__cn_map_epoch_sync(src);
+
+	src->func_destruct = NULL;
+
+	//Erasing a red-black tree node leaves every other node where it is, but
+	//a B+ tree shifts pairs around its leaves and a persistent CN_Map copies
+	//the path, so those find the way back in by key. Neither owns its string
+	//keys, so the saved key can't be freed by the erase.
+	cn_map_begin(src, &it);
+
+	while (it.node != NULL) {
+		if (!cn_map_try_insert(obj, &found, it.node->key, it.node->data)) {
+			cn_map_next(src, &it);
+			continue;
+		}
+
+		next = it;
+		cn_map_next(src, &next);
+
+		if (moves && next.node != NULL)
+			memcpy(key, next.node->key, src->key_size);
+
+		cn_map_erase(src, &it);
+
+		if (next.node == NULL)
+			break;
+
+		if (moves)
+			cn_map_lower_bound(src, &it, key);
+		else
+			it = next;
+	}
+
+	if (src->epoch != NULL)
+		__cn_map_epoch_sync(src);
+
+	src->func_destruct = dest;
+	free(key);
+}
+
+// ----------------------------------------------------------------------------
+// Private/Implementation Helper Functions                                 {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * __cn_map_create_node
+ *
+ * Description:
+ *     Creates a node to be attached in the CN_Map internal tree structure. The
+ *     node, key, and value all come out of one slot in the map's pool. In a
+ *     persistent CN_Map, this is the node that holds a pair, which comes out of
+ *     the pool shared with its snapshots instead. A CN_Map sharing node memory
+ *     with others (see "cn_map_split") takes it from that shared pool.
+ */
+
+CNM_NODE *__cn_map_create_node(CN_MAP obj, void *key, void *value) {
+	CNM_UINT  ksize = obj->key_size,
+	          vsize = obj->elem_size;
+	CNM_NODE *node;
+	CNM_BYTE  locked;
+
+	if (obj->share != NULL) {
+		locked = __cn_map_share_lock(obj);
+		node   = (CNM_NODE *) __cn_map_pool_alloc(&obj->share->pool);
+		__cn_map_share_unlock(obj, locked);
+	}
+	else
+		node = (CNM_NODE *) __cn_map_pool_alloc(
+			(obj->ps != NULL) ? &obj->ps->elems : &obj->pool
+		);
+
+	//Point the key and value at the storage inside of the slot.
+	node->key  = (CNM_BYTE *) node + CNM_KEY_OFFSET;
+	node->data = (vsize == 0) ? NULL : (CNM_BYTE *) node + obj->data_offset;
+
+	//Setup the pointers
+	node->left  = NULL;
+	node->right = NULL;
+	node->up    = NULL;
+
+	//Set the colour to black by default
+	node->colour = CNM_RED;
+	node->count  = 1;
+
+	/*
+	 * Copy over the key and values
+	 *
+	 * If the parameter passed in is NULL, make the element blank instead of
+	 * a segfault.
+	 */
+	if (key == NULL)
+		memset(node->key , 0  , ksize);
+	else
+		memcpy(node->key , key, ksize);
+
+	if (obj->str_keys)
+		__cn_map_str_cache(obj, node);
+
+	if (vsize == 0)
+		return node;
+
+	if (value == NULL)
+		memset(node->data, 0    , vsize);
+	else
+		memcpy(node->data, value, vsize);
+
+	return node;
+}
+
+/*
+ * __cn_map_free_node
+ *
+ * Description:
+ *     Calls the destructor on a node and gives its memory back to the pool so
+ *     the next insertion can recycle it. With concurrent reads on, both wait
+ *     until no reader can still reach the node.
+ */
+
+void __cn_map_free_node(CN_MAP obj, CNM_NODE *node) {
+	CNM_BYTE locked;
+
+	//Readers might still be looking at it. Hold onto it until they are done.
+	if (obj->epoch != NULL) {
+		__cn_map_epoch_retire(obj, node);
+		return;
+	}
+
+	//Call the destructor... if it exists.
+	if (obj->func_destruct != NULL)
+		obj->func_destruct(node);
+
+	//The key's copy in the arena is dead now.
+	if (obj->str_keys & CNM_STR_OWNED) {
+		obj->arena.live -= __cn_map_str_size(obj, node);
+		obj->arena.dead += __cn_map_str_size(obj, node);
+	}
+
+	if (obj->share != NULL) {
+		locked = __cn_map_share_lock(obj);
+		__cn_map_pool_release(&obj->share->pool, node);
+		__cn_map_share_unlock(obj, locked);
+		return;
+	}
+
+	__cn_map_pool_release(
+		(obj->ps != NULL) ? &obj->ps->elems : &obj->pool, node
+	);
+}
+
+/*
+ * __cn_map_detach
+ *
+ * Description:
+ *     Takes "node" out of the tree and rebalances it, like "cn_map_erase", but
+ *     leaves the node alone otherwise. Nothing is destructed or freed. Must be
+ *     called between "__cn_map_write_begin" and "__cn_map_write_end".
+ */
+
+void __cn_map_detach(CN_MAP obj, CNM_NODE *node) {
+	CNM_NODE   *x, *y, *double_blk, *x_parent, *up;
+	CNM_NODE    sentinel;
+	CNM_COLOUR  y_colour;
+	CNM_BYTE    y_is_left;
+
+	//If it is the head, and the size is 1, just take it out.
+	if (obj->size == 1 && node == obj->head) {
+		CNM_STORE(obj->head, NULL);
+		obj->size--;
+		__cn_map_calibrate(obj);
+		return;
+	}
+
+	//Hand the least/most spots to the neighbours if they are being erased.
+	if (node == obj->it_least.node)
+		CNM_STORE(obj->it_least.node, __cn_map_successor(node));
+
+	if (node == obj->it_most.node)
+		CNM_STORE(obj->it_most.node, __cn_map_predecessor(node));
+
+	//Initially there is no Double Black
+	double_blk = NULL;
+
+	//Determine which node "y" is physically taken out of its spot.
+	if (node->left == NULL || node->right == NULL)
+		y = node;
+	else {
+		y = node->left;
+		while (y->right != NULL)
+			y = y->right;
+	}
+
+	if (y->left != NULL)
+		x = y->left;
+	else
+		x = y->right;
+
+	if (x != NULL)
+		x->up = y->up;
+
+	x_parent  = y->up;
+	y_colour  = y->colour;
+	y_is_left = 0;
+
+	if (y->up == NULL) {
+		CNM_STORE(obj->head, x);
+	}
+	else {
+		if (y == y->up->left) {
+			CNM_STORE(y->up->left, x);
+			y_is_left = 1;
+		}
+		else
+			CNM_STORE(y->up->right, x);
+	}
+
+	if (y != node) {
+		//Relink "y" into the spot "node" is in (colour and all).
+		if (x_parent == node)
+			x_parent = y;
+
+		__cn_map_replace_node(obj, node, y);
+	}
+
+	//Recount every subtree from where "y" was taken out up to the head.
+	if (obj->order_stats)
+		for (up = x_parent; up != NULL; up = up->up)
+			__cn_map_update_count(up);
+
+	if (y_colour == CNM_BLACK) {
+		//Stand in a blank node on the stack if null. Readers might run into
+		//it though, so for them, use "node". It is out of the tree by now,
+		//and its key is still good to compare against.
+		if (x == NULL) {
+			if (obj->epoch != NULL)
+				double_blk = node;
+			else {
+				double_blk = &sentinel;
+				double_blk->key  = NULL;
+				double_blk->data = NULL;
+			}
+
+			CNM_STORE(double_blk->left , NULL);
+			CNM_STORE(double_blk->right, NULL);
+			double_blk->count = 0;
+
+			x = double_blk;
+
+			if (y_is_left)
+				CNM_STORE(x_parent->left, x);
+			else
+				CNM_STORE(x_parent->right, x);
+
+			x->up = x_parent;
+			x->colour = CNM_BLACK;
+		}
+
+		//Let's fix the tree up
+		__cn_map_delete_fixup(
+			obj,
+			x,
+			x_parent,
+			y_is_left,
+			y
+		);
+
+		//Clean up Double Black
+		if (double_blk != NULL) {
+			if (double_blk->up != NULL) {
+				if (double_blk->up->left == double_blk)
+					CNM_STORE(double_blk->up->left, NULL);
+				else
+					CNM_STORE(double_blk->up->right, NULL);
+			}
+		}
+	}
+
+	obj->size--;
+}
+
+/*
+ * __cn_map_move
+ *
+ * Description:
+ *     Hangs "node" in "obj" where its key goes, taking it out of "src" first
+ *     (unless "src" is NULL, for a node that is in no tree). Both CN_Maps must
+ *     make their nodes out of the same pool. Returns the node "obj" has with
+ *     that key afterwards. If it isn't "node", the key was already there, and
+ *     nothing was done.
+ */
+
+CNM_NODE *__cn_map_move(CN_MAP obj, CN_MAP src, CNM_NODE *node) {
+	CNM_NODE *cur;
+	CNC_COMP  res;
+
+	cur = __cn_map_descend(obj, obj->head, node->key, &res);
+
+	if (cur != NULL && res == 0)
+		return cur;
+
+	if (src != NULL) {
+		__cn_map_write_begin(src);
+		__cn_map_detach(src, node);
+		__cn_map_write_end(src);
+	}
+
+	//Back to how "__cn_map_create_node" leaves a node.
+	node->left   = NULL;
+	node->right  = NULL;
+	node->up     = NULL;
+	node->colour = CNM_RED;
+	node->count  = 1;
+
+	__cn_map_attach(obj, cur, (res < 0), node);
+	return node;
+}
+
+/*
+ * __cn_map_attach
+ *
+ * Description:
+ *     Hangs a freshly made "node" off of "parent" as its left child (if "left"
+ *     is true) or right child, then rebalances. "parent" must have no child on
+ *     that side. If "parent" is NULL, the tree must be empty and "node" becomes
+ *     the head.
+ */
+
+void __cn_map_attach(
+	CN_MAP    obj,
+	CNM_NODE *parent,
+	CNM_BYTE  left,
+	CNM_NODE *node
+) {
+	CNM_NODE *up;
+
+	__cn_map_write_begin(obj);
+
+	obj->size++;
+	node->up = parent;
+
+	//Every subtree on the way up gets one more node.
+	if (obj->order_stats)
+		for (up = parent; up != NULL; up = up->up)
+			up->count++;
+
+	if (parent == NULL) {
+		//Just insert the node in as the new head.
+		node->colour = CNM_BLACK;
+		CNM_STORE(obj->head, node);
+
+		//It's both the least and most element.
+		CNM_STORE(obj->it_least.node, node);
+		CNM_STORE(obj->it_most.node , node);
+		__cn_map_write_end(obj);
+		return;
+	}
+
+	//Readers may follow the link as soon as it is there, so it has to come
+	//after everything else in the node is filled in.
+	if (left) {
+		CNM_STORE(parent->left, node);
+
+		//Left of the least element is the new least element.
+		if (parent == obj->it_least.node)
+			CNM_STORE(obj->it_least.node, node);
+	}
+	else {
+		CNM_STORE(parent->right, node);
+
+		//Right of the most element is the new most element.
+		if (parent == obj->it_most.node)
+			CNM_STORE(obj->it_most.node, node);
+	}
+
+	__cn_map_fix_colours(obj, node);
+	__cn_map_write_end(obj);
+}
+
+/*
+ * __cn_map_replace_node
+ *
+ * Description:
+ *     Puts "node" into the exact spot "old" occupies in the tree, taking its
+ *     parent, children, and colour. "old" is left dangling.
+ */
+
+void __cn_map_replace_node(CN_MAP obj, CNM_NODE *old, CNM_NODE *node) {
+	CNM_STORE(node->left , old->left );
+	CNM_STORE(node->right, old->right);
+
+	node->up     = old->up;
+	node->colour = old->colour;
+
+	if (node->left  != NULL) node->left->up  = node;
+	if (node->right != NULL) node->right->up = node;
+
+	if (node->up == NULL)
+		CNM_STORE(obj->head, node);
+	else
+	if (node->up->left == old)
+		CNM_STORE(node->up->left, node);
+	else
+		CNM_STORE(node->up->right, node);
+}
+
+void __cn_map_fix_colours(CN_MAP obj, CNM_NODE *node) {
+	//If root, set the colour to black
+	if (node == obj->head) {
+		node->colour = CNM_BLACK;
+		return;
+	}
+
+	//If node's parent is black or node is root, back out.
+	if (node->up->colour == CNM_BLACK && node->up != obj->head)
+		return;
+
+	//Find out who is who
+	CNM_NODE *parent      = node->up;
+	CNM_NODE *grandparent = parent->up;
+	CNM_NODE *uncle;
+
+	if (parent->up == NULL)
+		return;
+
+	//Find out the uncle
+	if (grandparent->left == parent)
+		uncle = grandparent->right;
+	else
+		uncle = grandparent->left;
+
+	if (uncle != NULL && uncle->colour == CNM_RED) {
+		//If the uncle is red...
+		//Change colour of parent and uncle to black
+		uncle->colour = CNM_BLACK;
+		parent->colour = CNM_BLACK;
+		
+		//Change colour of grandparent to red.
+		grandparent->colour = CNM_RED;
+
+		//Call this on the grandparent
+		__cn_map_fix_colours(obj, grandparent);
+	}
+	else
+	if (uncle == NULL || uncle->colour == CNM_BLACK) {
+		//If the uncle is black...
+		if (parent == grandparent->left && node == parent->left)
+			__cn_map_l_l(obj, node, parent, grandparent, uncle);
+		else
+		if (parent == grandparent->left && node == parent->right)
+			__cn_map_l_r(obj, node, parent, grandparent, uncle);
+		else
+		if (parent == grandparent->right && node == parent->left)
+			__cn_map_r_l(obj, node, parent, grandparent, uncle);
+		else
+		if (parent == grandparent->right && node == parent->right)
+			__cn_map_r_r(obj, node, parent, grandparent, uncle);
+	}
+}
+
+/*
+ * __cn_map_delete_fixup
+ *
+ * Description:
+ *     Fixes the Red-Black tree post-BST deletion. This may involve multiple
+ *     recolours and/or rotations depending on which node was deleted, what
+ *     colour it was, and where it was in the tree at the time of deletion.
+ *
+ *     These fixes occur up and down the path of the tree, and each rotation is
+ *     guaranteed constant time. As such, there is a maximum of O(lg n)
+ *     operations taking place during the fixup procedure.
+ */
+
+void __cn_map_delete_fixup(
+	CN_MAP    obj,
+	CNM_NODE *node,
+	CNM_NODE *p,
+	CNM_BYTE  y_is_left,
+	CNM_NODE *y
+) {
+	CNM_NODE   *w;
+	CNM_COLOUR  lc, rc;
+
+	if (node == NULL)
+		return;
+
+	while (node != obj->head && node->colour == CNM_BLACK) {
+		//If left child
+		if (y_is_left) {
+			w = p->right;
+
+			if (w->colour == CNM_RED) {
+				w->colour = CNM_BLACK;
+				p->colour = CNM_RED;
+				p = __cn_map_rotate_left(obj, p)->left;
+				w = p->right;
+			}
+
+			lc = (w->left  == NULL) ? CNM_BLACK : w->left->colour;
+			rc = (w->right == NULL) ? CNM_BLACK : w->right->colour;
+
+			if (lc == CNM_BLACK && rc == CNM_BLACK) {
+				w->colour = CNM_RED;
+				node = node->up;
+				p = node->up;
+
+				if (p != NULL)
+					y_is_left = (node == p->left);
+			}
+			else {
+				if (rc == CNM_BLACK) {
+					w->left->colour = CNM_BLACK;
+					w->colour = CNM_RED;
+					w = __cn_map_rotate_right(obj, w);
+					w = p->right;
+				}
+
+				w->colour = p->colour;
+				p->colour = CNM_BLACK;
+
+				if (w->right != NULL)
+					w->right->colour = CNM_BLACK;
+
+				p = __cn_map_rotate_left(obj, p);
+				node = obj->head;
+				p = NULL;
+			}
+		}
+		else {
+			/* Same except flipped "left" and "right" */
+			w = p->left;
+
+			if (w->colour == CNM_RED) {
+				w->colour = CNM_BLACK;
+				p->colour = CNM_RED;
+				p = __cn_map_rotate_right(obj, p)->right;
+				w = p->left;
+			}
+
+			lc = (w->left  == NULL) ? CNM_BLACK : w->left->colour;
+			rc = (w->right == NULL) ? CNM_BLACK : w->right->colour;
+
+			if (lc == CNM_BLACK && rc == CNM_BLACK) {
+				w->colour = CNM_RED;
+				node = node->up;
+				p = node->up;
+				if (p != NULL)
+					y_is_left = (node == p->left);
+			}
+			else {
+				if (lc == CNM_BLACK) {
+					w->right->colour = CNM_BLACK;
+					w->colour = CNM_RED;
+					w = __cn_map_rotate_left(obj, w);
+					w = p->left;
+				}
+
+				w->colour = p->colour;
+				p->colour = CNM_BLACK;
+
+				if (w->left != NULL)
+					w->left->colour = CNM_BLACK;
+
+				p = __cn_map_rotate_right(obj, p);
+				node = obj->head;
+				p = NULL;
+			}
+		}
+	}
+
+	node->colour = CNM_BLACK;
+}
+
+void __cn_map_l_l(
+	CN_MAP obj,
+	CNM_NODE *node,
+	CNM_NODE *parent,
+	CNM_NODE *grandparent,
+	CNM_NODE *uncle
+) {
+	//Rotate to the right according to grandparent
+	grandparent = __cn_map_rotate_right(obj, grandparent);
+
+	//Swap grandparent and uncle's colours
+	CNM_COLOUR c1, c2;
+	c1 = grandparent->colour;
+	c2 = grandparent->right->colour;
+
+	grandparent->colour = c2;
+	grandparent->right->colour = c1;
+}
+
+void __cn_map_l_r(
+	CN_MAP obj,
+	CNM_NODE *node,
+	CNM_NODE *parent,
+	CNM_NODE *grandparent,
+	CNM_NODE *uncle
+) {
+	//Rotate to the left according to parent
+	parent = __cn_map_rotate_left(obj, parent);
+
+	//Refigure out who is who
+	node = parent->left;
+	grandparent = parent->up;
+	uncle = (grandparent->left == parent)
+		? grandparent->right
+		: grandparent->left;
+
+	//Apply left-left case
+	__cn_map_l_l(obj, node, parent, grandparent, uncle);
+}
+
+void __cn_map_r_r(
+	CN_MAP obj,
+	CNM_NODE *node,
+	CNM_NODE *parent,
+	CNM_NODE *grandparent,
+	CNM_NODE *uncle
+) {
+	//Rotate to the left according to grandparent
+	grandparent = __cn_map_rotate_left(obj, grandparent);
+
+	//Swap grandparent and uncle's colours
+	CNM_COLOUR c1, c2;
+	c1 = grandparent->colour;
+	c2 = grandparent->left->colour;
+
+	grandparent->colour = c2;
+	grandparent->left->colour = c1;
+}
+
+void __cn_map_r_l(
+	CN_MAP obj,
+	CNM_NODE *node,
+	CNM_NODE *parent,
+	CNM_NODE *grandparent,
+	CNM_NODE *uncle
+) {
+	//Rotate to the right according to parent
+	parent = __cn_map_rotate_right(obj, parent);
+
+	//Refigure out who is who
+	node = parent->right;
+	grandparent = parent->up;
+	uncle = (grandparent->left == parent)
+		? grandparent->right
+		: grandparent->left;
+
+	//Apply right-right case
+	__cn_map_r_r(obj, node, parent, grandparent, uncle);
+}
+
+/*
+ * __cn_map_rotate
+ *
+ * Description:
+ *     Brings the child of "node" on side "side" (its right child if "side" is
+ *     true, its left one if not) up into the spot of "node", which goes down
+ *     the other side. The parent of "node", if it has one, is pointed at the
+ *     child. Counts are kept up to date if "counts" is true. Returns the node
+ *     now in the spot of the original node.
+ *
+ *     The head of the CN_Map is never looked at, so this works just as well on
+ *     a tree that isn't attached to any CN_Map (see "__cn_map_join").
+ */
+
+CNM_NODE *__cn_map_rotate(CNM_NODE *node, CNM_BYTE side, CNM_BYTE counts) {
+	CNM_NODE *c, *inner, *up;
+
+	c     = CNM_CHILD(node, side);
+	inner = CNM_CHILD(c, !side);
+	up    = node->up;
+
+	//Adjust
+	c->up = up;
+	CNM_STORE(CNM_CHILD(c, !side), node);
+
+	CNM_STORE(CNM_CHILD(node, side), inner);
+	node->up = c;
+
+	if (inner != NULL)
+		inner->up = node;
+
+	if (up != NULL) {
+		if (up->right == node)
+			CNM_STORE(up->right, c);
+		else
+			CNM_STORE(up->left, c);
+	}
+
+	//"c" now covers the whole subtree. "node" lost "c" and its far side.
+	if (counts) {
+		c->count = node->count;
+		__cn_map_update_count(node);
+	}
+
+	return c;
+}
+
+/*
+ * __cn_map_rotate_left
+ *
+ * Description:
+ *     Performs a left rotation with "node". The following happens (with
+ *     respect to "C":
+ *
+ *         B                C
+ *        / \              / \
+ *       A   C     =>     B   D
+ *            \          /
+ *             D        A
+ *
+ *     Returns the new node pointing in the spot of the original node.
+ */
+
+CNM_NODE *__cn_map_rotate_left(CN_MAP obj, CNM_NODE *node) {
+	CNM_NODE *r = __cn_map_rotate(node, 1, obj->order_stats);
+
+	if (node == obj->head)
+		CNM_STORE(obj->head, r);
+
+	return r;
+}
+
+/*
+ * __cn_map_rotate_right
+ *
+ * Description:
+ *     Performs a right rotation with "node". The following happens (with
+ *     respect to "C":
+ *
+ *         C                B
+ *        / \              / \
+ *       B   D     =>     A   C
+ *      /                      \
+ *     A                        D
+ *
+ *     Returns the new node pointing in the spot of the original node.
+ */
+
+CNM_NODE *__cn_map_rotate_right(CN_MAP obj, CNM_NODE *node) {
+	CNM_NODE *l = __cn_map_rotate(node, 0, obj->order_stats);
+
+	if (node == obj->head)
+		CNM_STORE(obj->head, l);
+
+	return l;
+}
+
+/*
+ * __cn_map_black_height
+ *
+ * Description:
+ *     Returns how many black nodes are on the way down from "node" (counting
+ *     itself) to any empty spot under it.
+ */
+
+CNM_UINT __cn_map_black_height(CNM_NODE *node) {
+	CNM_UINT height = 0;
+
+	for (; node != NULL; node = node->left)
+		height += (node->colour == CNM_BLACK);
+
+	return height;
+}
+
+/*
+ * __cn_map_join
+ *
+ * Description:
+ *     Makes one tree out of "left" (black height "lh"), the node "mid", and
+ *     "right" (black height "rh"), in that order. Every key in "left" must come
+ *     before the key of "mid", and every key in "right" after it. Returns the
+ *     head of the new tree, and stores its black height in "*height". The head
+ *     may be red.
+ *
+ *     If both trees are as tall, "mid" goes on top of them. Otherwise, "mid"
+ *     goes down the side of the taller tree facing the other one, until it
+ *     finds a black node as tall as the shorter tree, and takes its place with
+ *     the two of them as its children. From there, it is fixed up just like
+ *     an insert.
+ *
+ *     Only the nodes given are touched, never the head of "obj", so the trees
+ *     may be ones cut out of it. The same goes for "__cn_map_join2",
+ *     "__cn_map_split" and "__cn_map_split_last".
+ *
+ * Complexity:
+ *     O(|lh - rh| + 1)
+ */
+
+CNM_NODE *__cn_map_join(
+	CN_MAP    obj,
+	CNM_NODE *left,
+	CNM_UINT  lh,
+	CNM_NODE *mid,
+	CNM_NODE *right,
+	CNM_UINT  rh,
+	CNM_UINT *height
+) {
+	CNM_NODE *head;
+
+	//Make both heads black, so "mid" can always be red under them.
+	if (left != NULL) {
+		left->up = NULL;
+
+		if (left->colour == CNM_RED) {
+			left->colour = CNM_BLACK;
+			lh++;
+		}
+	}
+
+	if (right != NULL) {
+		right->up = NULL;
+
+		if (right->colour == CNM_RED) {
+			right->colour = CNM_BLACK;
+			rh++;
+		}
+	}
+
+	//Go down the taller tree. If neither is, "mid" goes right on top.
+	if (lh >= rh) {
+		head    = __cn_map_join_side(obj, left, lh, mid, right, rh, 1);
+		*height = lh;
+	}
+	else {
+		head    = __cn_map_join_side(obj, right, rh, mid, left, lh, 0);
+		*height = rh;
+	}
+
+	head->up = NULL;
+	return head;
+}
+
+/*
+ * __cn_map_join_side
+ *
+ * Description:
+ *     Recursive helper for "__cn_map_join". Puts "mid" and the shorter tree
+ *     "other" into "tall", down its right side (if "right" is true) or its left
+ *     side. "other" goes on that same side of "mid". Returns the new head of
+ *     "tall". If a red node ends up with a red child, the first black node
+ *     above the two rotates to fix it.
+ */
+
+CNM_NODE *__cn_map_join_side(
+	CN_MAP    obj,
+	CNM_NODE *tall,
+	CNM_UINT  th,
+	CNM_NODE *mid,
+	CNM_NODE *other,
+	CNM_UINT  oh,
+	CNM_BYTE  right
+) {
+	CNM_NODE *sub;
+
+	//Found a black node as tall as "other". "mid" takes its place.
+	if (th == oh && (tall == NULL || tall->colour == CNM_BLACK)) {
+		CNM_STORE(CNM_CHILD(mid,  right), other);
+		CNM_STORE(CNM_CHILD(mid, !right), tall );
+
+		if (tall  != NULL) tall->up  = mid;
+		if (other != NULL) other->up = mid;
+
+		mid->colour = CNM_RED;
+
+		if (obj->order_stats)
+			__cn_map_update_count(mid);
+
+		return mid;
+	}
+
+	sub = __cn_map_join_side(
+		obj, CNM_CHILD(tall, right), th - (tall->colour == CNM_BLACK),
+		mid, other, oh, right
+	);
+
+	CNM_STORE(CNM_CHILD(tall, right), sub);
+	sub->up = tall;
+
+	if (obj->order_stats)
+		__cn_map_update_count(tall);
+
+	//Red under red under black. Rotate the black one down to the other side.
+	if (tall->colour == CNM_BLACK && sub->colour == CNM_RED &&
+		CNM_CHILD(sub, right) != NULL &&
+		CNM_CHILD(sub, right)->colour == CNM_RED
+	) {
+		CNM_CHILD(sub, right)->colour = CNM_BLACK;
+
+		tall = __cn_map_rotate(tall, right, obj->order_stats);
+	}
+
+	return tall;
+}
+
+/*
+ * __cn_map_join2
+ *
+ * Description:
+ *     Same as "__cn_map_join", but with no node to put in the middle. The last
+ *     node of "left" is taken out and used instead.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_NODE *__cn_map_join2(
+	CN_MAP    obj,
+	CNM_NODE *left,
+	CNM_UINT  lh,
+	CNM_NODE *right,
+	CNM_UINT  rh,
+	CNM_UINT *height
+) {
+	CNM_NODE *last;
+
+	if (left == NULL) {
+		if (right != NULL)
+			right->up = NULL;
+
+		*height = rh;
+		return right;
+	}
+
+	left = __cn_map_split_last(obj, left, lh, &lh, &last);
+
+	return __cn_map_join(obj, left, lh, last, right, rh, height);
+}
+
+/*
+ * __cn_map_split
+ *
+ * Description:
+ *     Splits the tree "node" (of black height "height") around "key". Every
+ *     node with a smaller key ends up in the tree put in "*left", and every
+ *     node with a bigger key in "*right", with their black heights in "*lh" and
+ *     "*rh". If a node has "key" itself, it is taken out and returned on its
+ *     own. Otherwise, NULL is returned.
+ *
+ *     Going down to "key", every node passed on the way is joined onto the
+ *     tree on the other side of the path from it, together with its subtree
+ *     on that side.
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_NODE *__cn_map_split(
+	CN_MAP     obj,
+	CNM_NODE  *node,
+	CNM_UINT   height,
+	void      *key,
+	CNM_NODE **left,
+	CNM_UINT  *lh,
+	CNM_NODE **right,
+	CNM_UINT  *rh
+) {
+	CNM_NODE *found, *sub;
+	CNM_UINT  sh;
+	CNC_COMP  res;
+
+	if (node == NULL) {
+		*left  = *right = NULL;
+		*lh    = *rh    = 0;
+		return NULL;
+	}
+
+	//Both subtrees are this tall, whatever colour they are.
+	height -= (node->colour == CNM_BLACK);
+	res     = obj->func_compare(key, node->key);
+
+	if (res == 0) {
+		*left  = node->left;
+		*right = node->right;
+		*lh    = *rh = height;
+
+		CNM_STORE(node->left , NULL);
+		CNM_STORE(node->right, NULL);
+		return node;
+	}
+
+	if (res < 0) {
+		found  = __cn_map_split(
+			obj, node->left, height, key, left, lh, &sub, &sh
+		);
+
+		*right = __cn_map_join(obj, sub, sh, node, node->right, height, rh);
+	}
+	else {
+		found  = __cn_map_split(
+			obj, node->right, height, key, &sub, &sh, right, rh
+		);
+
+		*left  = __cn_map_join(obj, node->left, height, node, sub, sh, lh);
+	}
+
+	return found;
+}
+
+/*
+ * __cn_map_split_last
+ *
+ * Description:
+ *     Takes the last node out of the tree "node" (of black height "height")
+ *     and puts it in "*last". Returns what is left of the tree, and stores its
+ *     black height in "*lh".
+ *
+ * Complexity:
+ *     O(lg N)
+ */
+
+CNM_NODE *__cn_map_split_last(
+	CN_MAP     obj,
+	CNM_NODE  *node,
+	CNM_UINT   height,
+	CNM_UINT  *lh,
+	CNM_NODE **last
+) {
+	CNM_NODE *left = node->left, *sub;
+	CNM_UINT  sh;
+
+	height -= (node->colour == CNM_BLACK);
+
+	if (node->right == NULL) {
+		CNM_STORE(node->left, NULL);
+		*last = node;
+		*lh   = height;
+
+		if (left != NULL)
+			left->up = NULL;
+
+		return left;
+	}
+
+	sub = __cn_map_split_last(obj, node->right, height, &sh, last);
+
+	return __cn_map_join(obj, left, height, node, sub, sh, lh);
+}
+
+/*
+ * __cn_map_clear_nested
+ *
+ * Description:
+ *     Recursive wrapper for destructing nodes in a graph at an accelerated
+ *     pace. Skips rotations. Just aggressively goes through all nodes and
+ *     calls the destructor. The memory itself is freed with the pool chunks.
+ */
+
+void __cn_map_clear_nested(CN_MAP obj, CNM_NODE *node) {
+	//Destruct children
+	if (node->left  != NULL) __cn_map_clear_nested(obj, node->left );
+	if (node->right != NULL) __cn_map_clear_nested(obj, node->right);
+
+	//Destruct self
+	obj->func_destruct(node);
+}
+
+/*
+ * __cn_map_erase_nested
+ *
+ * Description:
+ *     Frees every node in the subtree at "node", calling the destructor on
+ *     each like "cn_map_erase" would. Only the right subtrees are recursed
+ *     into. Returns how many nodes there were.
+ */
+
+CNM_UINT __cn_map_erase_nested(CN_MAP obj, CNM_NODE *node) {
+	CNM_NODE *left;
+	CNM_UINT  count = 0;
+
+	while (node != NULL) {
+		if (node->right != NULL)
+			count += __cn_map_erase_nested(obj, node->right);
+
+		left = node->left;
+
+		__cn_map_free_node(obj, node);
+		count++;
+
+		node = left;
+	}
+
+	return count;
+}
+
+/*
+ * __cn_map_erase_slow
+ *
+ * Description:
+ *     "cn_map_erase_range" for B+ tree and persistent CN_Maps, which erases
+ *     the nodes one at a time.
+ */
+
+void __cn_map_erase_slow(
+	CN_MAP        obj,
+	CNM_ITERATOR *first,
+	CNM_ITERATOR *last
+) {
+	CNM_ITERATOR it, next;
+	void        *key  = malloc(obj->key_size),
+	            *stop = NULL;
+
+	//Erasing may invalidate every iterator, so find the way back in by key.
+	if (last->node != NULL) {
+		stop = malloc(obj->key_size);
+		memcpy(stop, last->node->key, obj->key_size);
+	}
+
+	it = *first;
+
+	while (it.node != NULL &&
+		(stop == NULL || obj->func_compare(it.node->key, stop) < 0)
+	) {
+		next = it;
+		cn_map_next(obj, &next);
+
+		if (next.node != NULL)
+			memcpy(key, next.node->key, obj->key_size);
+
+		cn_map_erase(obj, &it);
+
+		if (next.node == NULL)
+			break;
+
+		cn_map_lower_bound(obj, &it, key);
+	}
+
+	free(key);
+	free(stop);
+}
+
+/*
+ * __cn_map_descend
+ *
+ * Description:
+ *     Binary searches for "key" starting at "node" and going down. If the key
+ *     is found, that node is returned and "*res" is 0. Otherwise, the node the
+ *     key would be hung off of is returned, with "*res" being negative if the
+ *     key belongs on its left and positive if it belongs on its right. If
+ *     "node" is NULL, so is the return value.
+ */
+
+CNM_NODE *__cn_map_descend(
+	CN_MAP    obj,
+	CNM_NODE *node,
+	void     *key,
+	CNC_COMP *res
+) {
+	CNM_NODE     *next;
+	CNM_STR_QUERY q;
+
+	*res = 0;
+
+	if (obj->str_keys)
+		__cn_map_str_query(obj, &q, key);
+
+	while (node != NULL) {
+		*res = obj->str_keys
+			? __cn_map_str_compare(obj, &q, node)
+			: obj->func_compare(key, node->key);
+
+		if (*res == 0)
+			break;
+
+		next = (*res < 0) ? node->left : node->right;
+		if (next == NULL)
+			break;
+
+		node = next;
+	}
+
+	return node;
+}
+
+/*
+ * __cn_map_bound
+ *
+ * Description:
+ *     Returns the first node whose key is not less than "key" (or greater than
+ *     "key", if "upper" is true). Returns NULL if there isn't one.
+ */
+
+CNM_NODE *__cn_map_bound(CN_MAP obj, void *key, CNM_BYTE upper) {
+	CNM_NODE     *node = obj->head,
+	             *best = NULL;
+	CNC_COMP      res;
+	CNM_STR_QUERY q;
+
+	if (obj->str_keys)
+		__cn_map_str_query(obj, &q, key);
+
+	while (node != NULL) {
+		res = obj->str_keys
+			? __cn_map_str_compare(obj, &q, node)
+			: obj->func_compare(key, node->key);
+
+		//Candidate. Anything better is to the left.
+		if (res < 0 || (res == 0 && !upper)) {
+			best = node;
+			node = node->left;
+		}
+		else
+			node = node->right;
+	}
+
+	return best;
+}
+
+/*
+ * __cn_map_finger_descend
+ *
+ * Description:
+ *     Same as "__cn_map_descend", but for a key that is known to come after
+ *     the key in "finger", a node already in the tree. Rather than starting
+ *     from the head, this climbs up from "finger" only until it reaches a
+ *     subtree that must hold the key, and searches down from there. Keys close
+ *     to the finger are found in O(lg d), where "d" is how far apart they are.
+ */
+
+CNM_NODE *__cn_map_finger_descend(
+	CN_MAP    obj,
+	CNM_NODE *finger,
+	void     *key,
+	CNC_COMP *res
+) {
+	CNM_NODE *node = finger;
+
+	//Going up from a right child only gets smaller keys. Going up from a left
+	//child, stop once the parent is bigger than the key.
+	while (node->up != NULL) {
+		if (node == node->up->left &&
+			obj->func_compare(key, node->up->key) < 0
+		)
+			break;
+
+		node = node->up;
+	}
+
+	return __cn_map_descend(obj, node, key, res);
+}
+
+/*
+ * __cn_map_insert_array
+ *
+ * Description:
+ *     Inserts "n" pairs from arrays laid out like in "cn_map_build_sorted",
+ *     one at a time. If "backwards" is true, they are inserted from last to
+ *     first, so the last of any repeated keys is the one kept. Returns how
+ *     many were inserted. This is what the batch functions fall back to for
+ *     CN_Maps they can't link up all at once.
+ */
+
+CNM_UINT __cn_map_insert_array(
+	CN_MAP    obj,
+	CNM_BYTE *keys,
+	CNM_BYTE *values,
+	CNM_UINT  n,
+	CNM_BYTE  backwards
+) {
+	CNM_ITERATOR it;
+	CNM_UINT     i, j, added = 0;
+
+	for (i = 0; i < n; i++) {
+		j = backwards ? n - 1 - i : i;
+
+		added += cn_map_try_insert(
+			obj, &it,
+			keys + (size_t) j * obj->key_size,
+			(values == NULL) ? NULL : values + (size_t) j * obj->elem_size
+		);
+	}
+
+	return added;
+}
+
+/*
+ * __cn_map_flatten
+ *
+ * Description:
+ *     Turns the subtree at "node" into a list linked in order through the
+ *     right pointers (the format "__cn_map_build_tree" wants). "*list" is the
+ *     list to put in front of it. Afterwards, "*list" points to the first node.
+ *     The subtree is walked from right to left, so each node's right child is
+ *     dealt with before its right pointer is overwritten.
+ */
+
+void __cn_map_flatten(CNM_NODE *node, CNM_NODE **list) {
+	CNM_NODE *left;
+
+	while (node != NULL) {
+		if (node->right != NULL)
+			__cn_map_flatten(node->right, list);
+
+		left = node->left;
+
+		CNM_STORE(node->right, *list);
+		*list = node;
+
+		node = left;
+	}
+}
+
+/*
+ * __cn_map_build_tree
+ *
+ * Description:
+ *     Turns "list", a chain of "n" nodes linked in order through their right
+ *     pointers, into a perfectly balanced Red-Black tree and makes it the tree
+ *     of the CN_Map. The CN_Map must be empty beforehand.
+ *
+ *     Sibling subtrees never differ in size by more than one node, so every
+ *     leaf is on one of the bottom two rows. Colouring the bottom row red and
+ *     the rest black gives every path the same black height.
+ */
+
+void __cn_map_build_tree(CN_MAP obj, CNM_NODE *list, CNM_UINT n) {
+	CNM_NODE *head;
+	CNM_UINT  red_depth, i;
+
+	//The deepest row sits at depth floor(lg n).
+	red_depth = 0;
+	for (i = n; i > 1; i >>= 1)
+		red_depth++;
+
+	head = __cn_map_build_nested(&list, n, 0, red_depth);
+
+	if (head != NULL) {
+		head->up     = NULL;
+		head->colour = CNM_BLACK;
+	}
+
+	//Only hand the tree to readers once it is all linked up.
+	CNM_STORE(obj->head, head);
+	obj->size = n;
+
+	__cn_map_calibrate(obj);
+}
+
+/*
+ * __cn_map_build_nested
+ *
+ * Description:
+ *     Recursive helper for "__cn_map_build_tree". Builds a subtree out of the
+ *     next "n" nodes in "*list" via an in-order walk, advancing "*list" past
+ *     them. Returns the subtree's root. Its parent is set by the caller.
+ */
+
+CNM_NODE *__cn_map_build_nested(
+	CNM_NODE **list,
+	CNM_UINT   n,
+	CNM_UINT   depth,
+	CNM_UINT   red_depth
+) {
+	CNM_NODE *left, *node;
+
+	if (n == 0)
+		return NULL;
+
+	//Left half, then this node, then the right half.
+	left  = __cn_map_build_nested(list, n / 2, depth + 1, red_depth);
+	node  = *list;
+	*list = node->right;
+
+	CNM_STORE(node->left, left);
+	if (left != NULL)
+		left->up = node;
+
+	CNM_STORE(node->right, __cn_map_build_nested(
+		list, n - n / 2 - 1, depth + 1, red_depth
+	));
+
+	if (node->right != NULL)
+		node->right->up = node;
+
+	node->colour = (depth == red_depth) ? CNM_RED : CNM_BLACK;
+	node->count  = n;
+
+	return node;
+}
+
+/*
+ * __cn_map_update_count
+ *
+ * Description:
+ *     Sets the subtree count of "node" from the counts of its children.
+ */
+
+void __cn_map_update_count(CNM_NODE *node) {
+	node->count = CNM_COUNT(node->left) + CNM_COUNT(node->right) + 1;
+}
+
+/*
+ * __cn_map_recount
+ *
+ * Description:
+ *     Recomputes the subtree counts of every node under (and including)
+ *     "node" from scratch. Returns the count of "node".
+ */
+
+CNM_UINT __cn_map_recount(CNM_NODE *node) {
+	if (node == NULL)
+		return 0;
+
+	node->count = __cn_map_recount(node->left)
+	            + __cn_map_recount(node->right)
+	            + 1;
+
+	return node->count;
+}
+
+/*
+ * __cn_map_node_rank
+ *
+ * Description:
+ *     Returns the 0-based position of "node" in order, using subtree counts.
+ *     Climbs from "node" to the head, adding up everything to the left.
+ */
+
+CNM_UINT __cn_map_node_rank(CNM_NODE *node) {
+	CNM_UINT rank = CNM_COUNT(node->left);
+
+	for (; node->up != NULL; node = node->up) {
+		if (node == node->up->right)
+			rank += CNM_COUNT(node->up->left) + 1;
+	}
+
+	return rank;
+}
+
+/*
+ * __cn_map_frozen_bound
+ *
+ * Description:
+ *     Returns the index of the first element not less than "key" (or greater
+ *     than "key", if "upper" is true) in a frozen snapshot, or 0.
+ *
+ *     Every step goes to child "2i" or "2i + 1" depending on the comparison,
+ *     computed arithmetically so there is no branch to mispredict. The search
+ *     always runs all the way to the bottom. Each time it goes right, the
+ *     answer is somewhere after the current element, so at the end, the right
+ *     turns taken since the last left turn are undone (a run of 1 bits at the
+ *     bottom of the index), along with that left turn itself.
+ */
+
+CNM_UINT __cn_map_frozen_bound(CNM_FROZEN fz, void *key, CNM_BYTE upper) {
+	CNM_U64  k = 1;
+	CNM_UINT ks = fz->key_size;
+	CNC_COMP res;
+
+	while (k <= fz->size) {
+		//Start loading the node a few levels down (and its neighbours).
+		CNM_PREFETCH(fz->keys + (k << CNM_FROZEN_PREFETCH_LEVELS) * ks);
+
+		res = fz->func_compare(fz->keys + k * ks, key);
+		k   = 2 * k + ((res < 0) | (upper & (res == 0)));
+	}
+
+	while (k & 1)
+		k >>= 1;
+
+	return (CNM_UINT) (k >> 1);
+}
+
+/*
+ * __cn_map_successor
+ *
+ * Description:
+ *     Returns the node that comes right after "node" in order, or NULL if it
+ *     is the last one.
+ */
+
+CNM_NODE *__cn_map_successor(CNM_NODE *node) {
+	CNM_NODE *up;
+
+	//Right once, then as far left as possible.
+	if (node->right != NULL) {
+		node = node->right;
+		while (node->left != NULL)
+			node = node->left;
+
+		return node;
+	}
+
+	//Otherwise, go up until we come from a left child.
+	up = node->up;
+	while (up != NULL && node == up->right) {
+		node = up;
+		up = up->up;
+	}
+
+	return up;
+}
+
+/*
+ * __cn_map_predecessor
+ *
+ * Description:
+ *     Returns the node that comes right before "node" in order, or NULL if it
+ *     is the first one.
+ */
+
+CNM_NODE *__cn_map_predecessor(CNM_NODE *node) {
+	CNM_NODE *up;
+
+	//Left once, then as far right as possible.
+	if (node->left != NULL) {
+		node = node->left;
+		while (node->right != NULL)
+			node = node->right;
+
+		return node;
+	}
+
+	//Otherwise, go up until we come from a right child.
+	up = node->up;
+	while (up != NULL && node == up->left) {
+		node = up;
+		up = up->up;
+	}
+
+	return up;
+}
+
+/*
+ * __cn_map_calibrate
+ *
+ * Description:
+ *     Recalculate the positions of the "least" and "most" iterators in the
+ *     tree from scratch. Insertion and deletion keep these up to date on their
+ *     own, so this is only needed after the tree is restructured in bulk.
+ */
+
+void __cn_map_calibrate(CN_MAP obj) {
+	CNM_NODE *least = obj->head, *most = obj->head;
+
+	//Recompute it_least and it_most
+	if (least != NULL) {
+		while (least->left != NULL)
+			least = least->left;
+
+		while (most->right != NULL)
+			most = most->right;
+	}
+
+	CNM_STORE(obj->it_least.node, least);
+	CNM_STORE(obj->it_most.node , most );
+}
+
+// ----------------------------------------------------------------------------
+// Pool Allocator                                                          {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * __cn_map_pool_init
+ *
+ * Description:
+ *     Sets up an empty pool that hands out blocks of "size" bytes. Slots are
+ *     at least big enough to hold the free list link, and are rounded up so
+ *     every slot is properly aligned for any type.
+ */
+
+void __cn_map_pool_init(CNM_POOL *pool, CNM_UINT size) {
+	CNM_UINT align = (size > sizeof(void *)) ? sizeof(CNM_CHUNK) : sizeof(void *);
+
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+
+	pool->chunks      = NULL;
+	pool->free_list   = NULL;
+	pool->bump        = NULL;
+	pool->bump_end    = NULL;
+	pool->slot_size   = (size + align - 1) & ~(align - 1);
+	pool->chunk_slots = CNM_POOL_CHUNK_MIN;
+}
+
+/*
+ * __cn_map_pool_alloc
+ *
+ * Description:
+ *     Returns a slot from the pool. Recycled slots are used first. Otherwise,
+ *     the slot is carved off of the newest chunk. Only when that is exhausted
+ *     does the pool go to malloc for another (larger) chunk.
+ */
+
+void *__cn_map_pool_alloc(CNM_POOL *pool) {
+	void      *slot;
+	CNM_CHUNK *chunk;
+
+	//Steady state. Pop off of the free list.
+	if (pool->free_list != NULL) {
+		slot = pool->free_list;
+		pool->free_list = *(void **) slot;
+		return slot;
+	}
+
+	//Grab a new chunk if the current one is full
+	if (pool->bump == pool->bump_end) {
+		chunk = (CNM_CHUNK *) malloc(
+			sizeof(CNM_CHUNK) + (size_t) pool->slot_size * pool->chunk_slots
+		);
+
+		chunk->next  = (CNM_CHUNK *) pool->chunks;
+		pool->chunks = chunk;
+
+		pool->bump     = (CNM_BYTE *) (chunk + 1);
+		pool->bump_end = pool->bump + (size_t) pool->slot_size * pool->chunk_slots;
+
+		if (pool->chunk_slots < CNM_POOL_CHUNK_MAX)
+			pool->chunk_slots <<= 1;
+	}
+
+	slot = pool->bump;
+	pool->bump += pool->slot_size;
+
+	return slot;
+}
+
+/*
+ * __cn_map_pool_release
+ *
+ * Description:
+ *     Pushes a slot back onto the pool's free list for recycling.
+ */
+
+void __cn_map_pool_release(CNM_POOL *pool, void *slot) {
+	*(void **) slot = pool->free_list;
+	pool->free_list = slot;
+}
+
+/*
+ * __cn_map_pool_clear
+ *
+ * Description:
+ *     Frees every chunk the pool has ever allocated. All slots handed out by
+ *     the pool are invalid afterwards.
+ */
+
+void __cn_map_pool_clear(CNM_POOL *pool) {
+	CNM_CHUNK *chunk, *next;
+
+	for (chunk = (CNM_CHUNK *) pool->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	__cn_map_pool_init(pool, pool->slot_size);
+}
+
+/*
+ * __cn_map_pool_merge
+ *
+ * Description:
+ *     Hands every chunk of "from" over to "pool", along with its free slots
+ *     and whatever it hadn't handed out yet of its newest chunk. Slots handed
+ *     out by "from" belong to "pool" afterwards. "from" is left empty.
+ */
+
+void __cn_map_pool_merge(CNM_POOL *pool, CNM_POOL *from) {
+	CNM_CHUNK *chunk;
+	void     **tail;
+
+	//The rest of the newest chunk becomes free slots.
+	for (; from->bump != from->bump_end; from->bump += from->slot_size)
+		__cn_map_pool_release(from, from->bump);
+
+	if (from->chunks != NULL) {
+		chunk = (CNM_CHUNK *) from->chunks;
+		while (chunk->next != NULL)
+			chunk = chunk->next;
+
+		chunk->next  = (CNM_CHUNK *) pool->chunks;
+		pool->chunks = from->chunks;
+	}
+
+	if (from->free_list != NULL) {
+		tail = (void **) from->free_list;
+		while (*tail != NULL)
+			tail = (void **) *tail;
+
+		*tail           = pool->free_list;
+		pool->free_list = from->free_list;
+	}
+
+	if (pool->chunk_slots < from->chunk_slots)
+		pool->chunk_slots = from->chunk_slots;
+
+	__cn_map_pool_init(from, from->slot_size);
+}
+
 // ----------------------------------------------------------------------------
-// Remove Functions                                                        {{{1
+// Arena Allocator                                                         {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * __cn_map_arena_init
+ *
+ * Description:
+ *     Sets up an empty arena. No memory is allocated until the first string is
+ *     copied in.
+ */
+
+void __cn_map_arena_init(CNM_ARENA *arena) {
+	arena->chunks   = NULL;
+	arena->bump     = NULL;
+	arena->bump_end = NULL;
+	arena->live     = 0;
+	arena->dead     = 0;
+}
+
+/*
+ * __cn_map_arena_copy
+ *
+ * Description:
+ *     Copies the "size" bytes at "str" to the end of the arena and returns
+ *     where they ended up.
+ */
+
+char *__cn_map_arena_copy(CNM_ARENA *arena, const char *str, size_t size) {
+	char *copy;
+
+	if ((size_t) (arena->bump_end - arena->bump) < size)
+		__cn_map_arena_grow(arena, size);
+
+	copy = (char *) arena->bump;
+	memcpy(copy, str, size);
+
+	arena->bump += size;
+	arena->live += size;
+
+	return copy;
+}
+
+/*
+ * __cn_map_arena_grow
+ *
+ * Description:
+ *     Starts a new chunk with room for at least "size" bytes. Whatever was
+ *     left at the end of the last chunk is skipped over.
+ */
+
+void __cn_map_arena_grow(CNM_ARENA *arena, size_t size) {
+	CNM_CHUNK *chunk;
+
+	if (size < CNM_ARENA_CHUNK)
+		size = CNM_ARENA_CHUNK;
+
+	chunk = (CNM_CHUNK *) malloc(sizeof(CNM_CHUNK) + size);
+
+	chunk->next   = (CNM_CHUNK *) arena->chunks;
+	arena->chunks = chunk;
+
+	arena->bump     = (CNM_BYTE *) (chunk + 1);
+	arena->bump_end = arena->bump + size;
+}
+
+/*
+ * __cn_map_arena_clear
+ *
+ * Description:
+ *     Frees every chunk of the arena. Every string in it is invalid afterwards.
+ */
+
+void __cn_map_arena_clear(CNM_ARENA *arena) {
+	CNM_CHUNK *chunk, *next;
+
+	for (chunk = (CNM_CHUNK *) arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	__cn_map_arena_init(arena);
+}
+
 // ----------------------------------------------------------------------------
+// B+ Tree Backend                                                         {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * B+ Tree Node Struct
+ *
+ * Header shared by both kinds of B+ tree nodes. "n" is how many keys the node
+ * holds. Leaves are linked to their neighbours through "prev" and "next", so
+ * iteration never has to go back up the tree. The rest of the node follows
+ * the header:
+ *
+ *     Leaf    : CNM_BT_HANDLE[cap], then the keys, then the values.
+ *     Internal: CNM_BT_NODE *[cap + 2] children, then cap + 1 keys.
+ *
+ * Internal nodes have room for one key more than they can keep, so a split
+ * can put the new key in first and then cut the node in half.
+ *
+ * Child "i" of an internal node holds keys from key "i - 1" (inclusive) up to
+ * key "i" (exclusive).
+ */
+
+typedef struct cnm_bt_node {
+	CNM_UINT            n;
+	struct cnm_bt_node *prev, *next;
+} CNM_BT_NODE;
+
+/*
+ * B+ Tree Handle Struct
+ *
+ * Every slot of a leaf has a handle pointing at its key and value. Handles
+ * are laid out like the start of a CNM_NODE, so an iterator's "node" can
+ * point at one and "cn_map_iterator_key" (or a destructor) works unchanged.
+ * A slot's key and value never move within the leaf's memory, so handles are
+ * only filled in when the leaf is made.
+ */
+
+typedef struct cnm_bt_handle {
+	void *key;
+	void *data;
+} CNM_BT_HANDLE;
+
+/*
+ * B+ Tree Struct
+ *
+ * Everything a CN_Map needs to run on a B+ tree instead of a red-black tree.
+ * "height" is 0 when the root is a leaf.
+ */
+
+typedef struct cnm_btree {
+	CNM_BT_NODE *root, *first, *last;
+	CNM_UINT     height;
+
+	CNM_UINT     cap, leaf_min, inner_min;
+	CNM_UINT     leaf_key_offset, val_offset, inner_key_offset;
+	CNM_BYTE     int_keys;
+
+	CNM_POOL     leaves, inners;
+} CNM_BTREE;
+
+#define CNM_BT_HANDLES(leaf)  ((CNM_BT_HANDLE *) ((CNM_BT_NODE *) (leaf) + 1))
+#define CNM_BT_CHILDREN(node) ((CNM_BT_NODE  **) ((CNM_BT_NODE *) (node) + 1))
+
+#define CNM_BT_LEAF_KEY(obj, leaf, i) \
+	((CNM_BYTE *) (leaf) + (obj)->bt->leaf_key_offset + \
+		(size_t) (i) * (obj)->key_size)
+
+#define CNM_BT_INNER_KEY(obj, node, i) \
+	((CNM_BYTE *) (node) + (obj)->bt->inner_key_offset + \
+		(size_t) (i) * (obj)->key_size)
+
+#define CNM_BT_VAL(obj, leaf, i) \
+	((CNM_BYTE *) (leaf) + (obj)->bt->val_offset + \
+		(size_t) (i) * (obj)->elem_size)
+
+//Longest root-to-leaf path. Fanout is at least 4, so this is plenty.
+#define CNM_BT_MAX_HEIGHT 48
+
+CNM_BT_NODE *__cn_map_bt_new_leaf  (CN_MAP);
+CNM_BT_NODE *__cn_map_bt_new_inner (CN_MAP);
+CNM_UINT     __cn_map_bt_search    (CN_MAP, CNM_BYTE *, CNM_UINT, void *,
+                                    CNM_BYTE);
+CNM_BT_NODE *__cn_map_bt_leaf_for  (CN_MAP, void *, CNM_BT_NODE **,
+                                    CNM_UINT *);
+void         __cn_map_bt_leaf_move (CN_MAP, CNM_BT_NODE *, CNM_UINT,
+                                    CNM_BT_NODE *, CNM_UINT, CNM_UINT);
+void         __cn_map_bt_rebalance (CN_MAP, CNM_BT_NODE **, CNM_UINT *,
+                                    CNM_UINT);
+void         __cn_map_bt_set_it    (CNM_ITERATOR *, CNM_BT_NODE *, CNM_UINT);
+
+
+/*
+ * __cn_map_bt_init
+ *
+ * Description:
+ *     Switches a freshly made (empty) CN_Map over to a B+ tree. Nodes hold
+ *     about CNM_BT_NODE_BYTES worth of keys, so a search only touches a few
+ *     cache lines per level, and there are far fewer levels than in a binary
+ *     tree. If "int_keys" is true, the keys are "int"s and are searched with
+ *     SIMD comparisons where available.
+ */
+
+void __cn_map_bt_init(CN_MAP obj, CNM_BYTE int_keys) {
+	CNM_BTREE *bt = (CNM_BTREE *) malloc(sizeof(CNM_BTREE));
+	CNM_UINT   cap, align = sizeof(CNM_CHUNK);
+
+	cap = CNM_BT_NODE_BYTES / (obj->key_size ? obj->key_size : 1);
+	if (cap < CNM_BT_CAP_MIN) cap = CNM_BT_CAP_MIN;
+	if (cap > CNM_BT_CAP_MAX) cap = CNM_BT_CAP_MAX;
+
+	bt->root   = bt->first = bt->last = NULL;
+	bt->height = 0;
+
+	//A split leaves cap / 2 keys on each side of a leaf, and (cap - 1) / 2
+	//on each side of an internal node (the middle key goes up).
+	bt->cap       = cap;
+	bt->leaf_min  = cap / 2;
+	bt->inner_min = (cap - 1) / 2;
+	bt->int_keys  = int_keys;
+
+	//Node layouts
+	bt->leaf_key_offset  = CNM_ALIGN(
+		sizeof(CNM_BT_NODE) + cap * sizeof(CNM_BT_HANDLE), align
+	);
+	bt->val_offset       = CNM_ALIGN(
+		bt->leaf_key_offset + cap * obj->key_size, align
+	);
+	bt->inner_key_offset = CNM_ALIGN(
+		sizeof(CNM_BT_NODE) + (cap + 2) * sizeof(CNM_BT_NODE *), align
+	);
+
+	__cn_map_pool_init(&bt->leaves, bt->val_offset + cap * obj->elem_size);
+	__cn_map_pool_init(
+		&bt->inners, bt->inner_key_offset + (cap + 1) * obj->key_size
+	);
+
+	obj->bt = bt;
+}
+
+/*
+ * __cn_map_bt_new_leaf
+ *
+ * Description:
+ *     Grabs an empty leaf from the pool and points its handles at its slots.
+ */
+
+CNM_BT_NODE *__cn_map_bt_new_leaf(CN_MAP obj) {
+	CNM_BT_NODE   *leaf = (CNM_BT_NODE *) __cn_map_pool_alloc(&obj->bt->leaves);
+	CNM_BT_HANDLE *handle = CNM_BT_HANDLES(leaf);
+	CNM_UINT       i;
+
+	leaf->n    = 0;
+	leaf->prev = NULL;
+	leaf->next = NULL;
+
+	for (i = 0; i < obj->bt->cap; i++) {
+		handle[i].key  = CNM_BT_LEAF_KEY(obj, leaf, i);
+		handle[i].data = (obj->elem_size == 0)
+			? NULL
+			: CNM_BT_VAL(obj, leaf, i);
+	}
+
+	return leaf;
+}
+
+/*
+ * __cn_map_bt_new_inner
+ *
+ * Description:
+ *     Grabs an empty internal node from the pool.
+ */
+
+CNM_BT_NODE *__cn_map_bt_new_inner(CN_MAP obj) {
+	CNM_BT_NODE *node = (CNM_BT_NODE *) __cn_map_pool_alloc(&obj->bt->inners);
+
+	node->n    = 0;
+	node->prev = NULL;
+	node->next = NULL;
+
+	return node;
+}
+
+/*
+ * __cn_map_bt_cmp_int
+ *
+ * Description:
+ *     Comparison function for "int" keys, used by B+ tree CN_Maps made with
+ *     "new_cn_map_btree_int" for everything other than searching a node.
+ */
+
+CNC_COMP __cn_map_bt_cmp_int(void *a, void *b) {
+	int x = *(int *) a,
+	    y = *(int *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * __cn_map_bt_search
+ *
+ * Description:
+ *     Returns how many of the "n" keys starting at "keys" are less than "key"
+ *     (or less than or equal to it, if "upper" is true).
+ *
+ *     For "int" keys, 4 keys are compared at once with SSE2. The keys are
+ *     sorted, so the first group that isn't entirely less than "key" is where
+ *     the count stops. Other keys are binary searched.
+ */
+
+CNM_UINT __cn_map_bt_search(
+	CN_MAP    obj,
+	CNM_BYTE *keys,
+	CNM_UINT  n,
+	void     *key,
+	CNM_BYTE  upper
+) {
+	CNM_UINT lo = 0, hi = n, mid, i = 0;
+	CNC_COMP res;
+
+	if (obj->bt->int_keys) {
+		const int *k = (const int *) keys;
+		int        q = *(int *) key;
+
+#ifdef __SSE2__
+		__m128i    vq = _mm_set1_epi32(q), m;
+		int        mask;
+
+		//Find the first lane holding a key that is too big (greater than "q",
+		//or not less than it). The keys are sorted, so it ends the count.
+		for (; i + 4 <= n; i += 4) {
+			m = _mm_loadu_si128((const __m128i *) (k + i));
+
+			m    = upper ? _mm_cmpgt_epi32(m, vq) : _mm_cmplt_epi32(m, vq);
+			mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+
+			if (!upper)
+				mask ^= 0xF;
+
+			if (mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+#endif
+
+		while (i < n && (k[i] < q || (upper && k[i] == q)))
+			i++;
+
+		return i;
+	}
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		res = obj->func_compare(keys + (size_t) mid * obj->key_size, key);
+
+		if (res < 0 || (upper && res == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * __cn_map_bt_leaf_for
+ *
+ * Description:
+ *     Walks down from the root to the leaf that "key" belongs in. If "path"
+ *     isn't NULL, the internal nodes passed through (and which child was taken
+ *     from each) are written to "path" and "slots", from the root down.
+ */
+
+CNM_BT_NODE *__cn_map_bt_leaf_for(
+	CN_MAP        obj,
+	void         *key,
+	CNM_BT_NODE **path,
+	CNM_UINT     *slots
+) {
+	CNM_BT_NODE *node = obj->bt->root;
+	CNM_UINT     h, i;
+
+	for (h = 0; h < obj->bt->height; h++) {
+		i = __cn_map_bt_search(
+			obj, CNM_BT_INNER_KEY(obj, node, 0), node->n, key, 1
+		);
+
+		if (path != NULL) {
+			path [h] = node;
+			slots[h] = i;
+		}
+
+		node = CNM_BT_CHILDREN(node)[i];
+
+		//The next node's keys are the next thing to be searched.
+		CNM_PREFETCH((CNM_BYTE *) node + ((h + 1 < obj->bt->height)
+			? obj->bt->inner_key_offset
+			: obj->bt->leaf_key_offset));
+	}
+
+	return node;
+}
+
+/*
+ * __cn_map_bt_set_it
+ *
+ * Description:
+ *     Points "it" at slot "i" of "leaf", or at the end if "leaf" is NULL.
+ */
+
+void __cn_map_bt_set_it(CNM_ITERATOR *it, CNM_BT_NODE *leaf, CNM_UINT i) {
+	if (leaf == NULL) {
+		it->node  = it->prev = NULL;
+		it->count = 0;
+		return;
+	}
+
+	it->node  = (CNM_NODE *) &CNM_BT_HANDLES(leaf)[i];
+	it->prev  = (CNM_NODE *) leaf;
+	it->count = i;
+}
+
+/*
+ * __cn_map_bt_calibrate
+ *
+ * Description:
+ *     Points "it_least" and "it_most" at the ends of the leaf chain.
+ */
+
+void __cn_map_bt_calibrate(CN_MAP obj) {
+	if (obj->size == 0) {
+		obj->it_least = obj->it_most = obj->it_end;
+		return;
+	}
+
+	__cn_map_bt_set_it(&obj->it_least, obj->bt->first, 0);
+	__cn_map_bt_set_it(&obj->it_most , obj->bt->last , obj->bt->last->n - 1);
+}
+
+/*
+ * __cn_map_bt_find
+ *
+ * Description:
+ *     Points "it" at the element with "key", or at the end if there isn't one.
+ */
+
+void __cn_map_bt_find(CN_MAP obj, CNM_ITERATOR *it, void *key) {
+	CNM_BT_NODE *leaf;
+	CNM_UINT     i;
+
+	if (obj->size == 0) {
+		*it = obj->it_end;
+		return;
+	}
+
+	leaf = __cn_map_bt_leaf_for(obj, key, NULL, NULL);
+	i    = __cn_map_bt_search(
+		obj, CNM_BT_LEAF_KEY(obj, leaf, 0), leaf->n, key, 0
+	);
+
+	if (i < leaf->n &&
+		obj->func_compare(key, CNM_BT_LEAF_KEY(obj, leaf, i)) == 0
+	)
+		__cn_map_bt_set_it(it, leaf, i);
+	else
+		*it = obj->it_end;
+}
+
+/*
+ * __cn_map_bt_bound
+ *
+ * Description:
+ *     Points "it" at the first element not less than "key" (or greater than
+ *     "key", if "upper" is true), or at the end if there isn't one.
+ */
+
+void __cn_map_bt_bound(
+	CN_MAP        obj,
+	CNM_ITERATOR *it,
+	void         *key,
+	CNM_BYTE      upper
+) {
+	CNM_BT_NODE *leaf;
+	CNM_UINT     i;
+
+	if (obj->size == 0) {
+		*it = obj->it_end;
+		return;
+	}
+
+	leaf = __cn_map_bt_leaf_for(obj, key, NULL, NULL);
+	i    = __cn_map_bt_search(
+		obj, CNM_BT_LEAF_KEY(obj, leaf, 0), leaf->n, key, upper
+	);
+
+	//Everything in this leaf is smaller. The answer starts the next one.
+	if (i == leaf->n) {
+		leaf = leaf->next;
+		i    = 0;
+	}
+
+	__cn_map_bt_set_it(it, leaf, i);
+}
 
 /*
- * cn_map_erase
+ * __cn_map_bt_insert
  *
  * Description:
- *     Removes a node from the CN_Map. It performs a BST delete, and then
- *     reorders the tree so that it remains balanced.
+ *     B+ tree version of "cn_map_try_insert". The key goes in its leaf, after
+ *     shifting the bigger keys over. A full leaf is split in half, with the
+ *     first key of the new right half added to the parent. Full parents are
+ *     split the same way, all the way up to the root if need be.
  */
 
-void cn_map_erase(CN_MAP obj, CNM_ITERATOR *it) {
-	CNM_UINT    result;
-	CNM_NODE   *x, *y, *new_node;
-	CNM_NODE   *node, *target, *t_sibling, *t_parent, *double_blk, *x_parent;
-	CNM_BYTE    c;
-	CNM_COLOUR  uc, vc;
-	CNM_BYTE    res_case;
+CNM_UINT __cn_map_bt_insert(
+	CN_MAP        obj,
+	CNM_ITERATOR *it,
+	void         *key,
+	void         *value
+) {
+	CNM_BTREE   *bt = obj->bt;
+	CNM_BT_NODE *path[CNM_BT_MAX_HEIGHT], *leaf, *right, *node, *child;
+	CNM_UINT     slots[CNM_BT_MAX_HEIGHT], i, h, half, n;
+	CNM_BYTE    *sep_key;
+
+	//First element. The root starts out as a lone leaf.
+	if (bt->root == NULL) {
+		bt->root = bt->first = bt->last = __cn_map_bt_new_leaf(obj);
+		bt->height = 0;
+	}
 
-	node = it->node;
+	leaf = __cn_map_bt_leaf_for(obj, key, path, slots);
+	i    = __cn_map_bt_search(
+		obj, CNM_BT_LEAF_KEY(obj, leaf, 0), leaf->n, key, 0
+	);
 
-	//If it is the head, and the size is 1, just delete it.
-	if (obj->size == 1 && node == obj->head) {
-		__cn_map_free_node(obj, node);
-		obj->head = NULL;
-		obj->size--;
-		return;
+	if (i < leaf->n &&
+		obj->func_compare(key, CNM_BT_LEAF_KEY(obj, leaf, i)) == 0
+	) {
+		__cn_map_bt_set_it(it, leaf, i);
+		return 0;
 	}
 
-	//Determine what the target is
-	c  = 0;
-	c |= (node->left  != NULL) << 0x0;
-	c |= (node->right != NULL) << 0x1;
-	
-	//Determine the case
-	switch (c) {
-		case 0x0:
-			//Leaf node (this should be impossible)
-			target = node;
-			break;
+	//A full leaf gives its top half to a new leaf on its right first.
+	right = NULL;
 
-		case 0x1:
-			//Has left child
-			target = node->left;
-			break;
+	if (leaf->n == bt->cap) {
+		right = __cn_map_bt_new_leaf(obj);
+		half  = (bt->cap + 1) / 2;
 
-		case 0x2:
-			//Has right child
-			target = node->right;
-			break;
+		__cn_map_bt_leaf_move(obj, right, 0, leaf, half, bt->cap - half);
+		right->n = bt->cap - half;
+		leaf->n  = half;
 
-		case 0x3:
-			//Has 2 children
-			target = node->left;
-			while (target->right != NULL)
-				target = target->right;
-			break;
+		right->prev = leaf;
+		right->next = leaf->next;
+
+		if (leaf->next != NULL)
+			leaf->next->prev = right;
+		else
+			bt->last = right;
+
+		leaf->next = right;
+
+		if (i > half) {
+			leaf = right;
+			i   -= half;
+		}
 	}
 
-	//Grab the parent and sibling to the target node.
-	t_parent = target->up;
+	//Make room for the new pair and copy it in.
+	__cn_map_bt_leaf_move(obj, leaf, i + 1, leaf, i, leaf->n - i);
+	leaf->n++;
 
-	if (t_parent == NULL)
-		t_sibling = target;
+	if (key == NULL)
+		memset(CNM_BT_LEAF_KEY(obj, leaf, i), 0, obj->key_size);
 	else
-		t_sibling = (t_parent->left == target)
-			? t_parent->right
-			: t_parent->left;
+		memcpy(CNM_BT_LEAF_KEY(obj, leaf, i), key, obj->key_size);
 
-	//Initially there is no Double Black
-	double_blk = NULL;
+	if (obj->elem_size != 0) {
+		if (value == NULL)
+			memset(CNM_BT_VAL(obj, leaf, i), 0, obj->elem_size);
+		else
+			memcpy(CNM_BT_VAL(obj, leaf, i), value, obj->elem_size);
+	}
 
-	if (node->left == NULL || node->right == NULL)
-		y = node;
-	else 
-		y = target;
+	__cn_map_bt_set_it(it, leaf, i);
+	obj->size++;
 
-	if (y->left != NULL)
-		x = y->left;
-	else
-		x = y->right;
+	//Hand the split up the tree. "sep_key" and "child" are the key and right
+	//node to add to the next level up. "sep_key" points at a key left behind
+	//in the node below, which isn't touched again.
+	if (right != NULL) {
+		child   = right;
+		sep_key = CNM_BT_LEAF_KEY(obj, right, 0);
+
+		for (h = bt->height; child != NULL; h--) {
+			//The root split. Grow a new root above it.
+			if (h == 0) {
+				node = __cn_map_bt_new_inner(obj);
+				CNM_BT_CHILDREN(node)[0] = bt->root;
+				CNM_BT_CHILDREN(node)[1] = child;
+				memcpy(CNM_BT_INNER_KEY(obj, node, 0), sep_key, obj->key_size);
+				node->n = 1;
+
+				bt->root = node;
+				bt->height++;
+				break;
+			}
 
-	if (x != NULL)
-		x->up = y->up;
+			node = path [h - 1];
+			i    = slots[h - 1];
 
-	x_parent = y->up;
+			//Make room after child "i" for the new key and child.
+			memmove(
+				CNM_BT_INNER_KEY(obj, node, i + 1),
+				CNM_BT_INNER_KEY(obj, node, i),
+				(size_t) (node->n - i) * obj->key_size
+			);
 
-	CNM_BYTE y_is_left = 0;
-	if (y->up == NULL) {
-		obj->head = x;
-	}
-	else {
-		if (y == y->up->left) {
-			y->up->left = x;
-			y_is_left = 1;
+			memmove(
+				CNM_BT_CHILDREN(node) + i + 2,
+				CNM_BT_CHILDREN(node) + i + 1,
+				(node->n - i) * sizeof(CNM_BT_NODE *)
+			);
+
+			memcpy(CNM_BT_INNER_KEY(obj, node, i), sep_key, obj->key_size);
+			CNM_BT_CHILDREN(node)[i + 1] = child;
+			node->n++;
+
+			if (node->n <= bt->cap) {
+				child = NULL;
+				break;
+			}
+
+			//Overfull by one. Keep the bottom half, send the middle key up,
+			//and move the top half into a new node.
+			n       = node->n;
+			half    = n / 2;
+			right   = __cn_map_bt_new_inner(obj);
+			sep_key = CNM_BT_INNER_KEY(obj, node, half);
+
+			memcpy(
+				CNM_BT_INNER_KEY(obj, right, 0),
+				CNM_BT_INNER_KEY(obj, node, half + 1),
+				(size_t) (n - half - 1) * obj->key_size
+			);
+
+			memcpy(
+				CNM_BT_CHILDREN(right),
+				CNM_BT_CHILDREN(node) + half + 1,
+				(n - half) * sizeof(CNM_BT_NODE *)
+			);
+
+			right->n = n - half - 1;
+			node->n  = half;
+			child    = right;
 		}
-		else
-			y->up->right = x;
 	}
 
-	if (y != node) {
-		//Move pointers over
-		if (obj->func_destruct != NULL)
-			obj->func_destruct(node);
+	__cn_map_bt_calibrate(obj);
+	return 1;
+}
+
+/*
+ * __cn_map_bt_leaf_move
+ *
+ * Description:
+ *     Moves "n" keys and values from slot "si" of "src" to slot "di" of "dst".
+ *     The ranges may overlap.
+ */
+
+void __cn_map_bt_leaf_move(
+	CN_MAP       obj,
+	CNM_BT_NODE *dst,
+	CNM_UINT     di,
+	CNM_BT_NODE *src,
+	CNM_UINT     si,
+	CNM_UINT     n
+) {
+	if (n == 0)
+		return;
+
+	memmove(
+		CNM_BT_LEAF_KEY(obj, dst, di),
+		CNM_BT_LEAF_KEY(obj, src, si),
+		(size_t) n * obj->key_size
+	);
+
+	if (obj->elem_size != 0)
+		memmove(
+			CNM_BT_VAL(obj, dst, di),
+			CNM_BT_VAL(obj, src, si),
+			(size_t) n * obj->elem_size
+		);
+}
+
+/*
+ * __cn_map_bt_erase
+ *
+ * Description:
+ *     B+ tree version of "cn_map_erase". The pair is shifted out of its leaf.
+ *     If that leaves the leaf less than half full, it is topped up from a
+ *     neighbour or merged into one (see "__cn_map_bt_rebalance").
+ */
 
-		free(node->key);
-		free(node->data);
+void __cn_map_bt_erase(CN_MAP obj, CNM_ITERATOR *it) {
+	CNM_BTREE   *bt   = obj->bt;
+	CNM_BT_NODE *leaf = (CNM_BT_NODE *) it->prev;
+	CNM_BT_NODE *path[CNM_BT_MAX_HEIGHT];
+	CNM_UINT     slots[CNM_BT_MAX_HEIGHT], i = it->count;
 
-		node->key  = y->key;
-		node->data = y->data;
+	//Find the way down to the leaf again, for rebalancing afterwards.
+	__cn_map_bt_leaf_for(obj, CNM_BT_LEAF_KEY(obj, leaf, i), path, slots);
+
+	if (obj->func_destruct != NULL)
+		obj->func_destruct(it->node);
+
+	__cn_map_bt_leaf_move(obj, leaf, i, leaf, i + 1, leaf->n - i - 1);
+	leaf->n--;
+	obj->size--;
 
-		y->key = y->data = NULL;
+	if (bt->height > 0)
+		__cn_map_bt_rebalance(obj, path, slots, bt->height);
+	else if (leaf->n == 0) {
+		__cn_map_pool_release(&bt->leaves, leaf);
+		bt->root = bt->first = bt->last = NULL;
 	}
 
-	if (y->colour == CNM_BLACK) {
-		//Make a blank node if null
-		if (x == NULL) {
-			double_blk = __cn_map_create_node(
-				NULL, NULL, obj->key_size, obj->elem_size
-			);
+	__cn_map_bt_calibrate(obj);
+}
 
-			x = double_blk;
+/*
+ * __cn_map_bt_rebalance
+ *
+ * Description:
+ *     Fixes up the node at depth "h" along "path" (a leaf, if "h" is the
+ *     height) after it lost a key. If it is under half full, it takes a key
+ *     from a neighbour with keys to spare. Otherwise it is merged with a
+ *     neighbour, which takes a key out of the parent, so the parent is checked
+ *     next. If the root ends up with a single child, that child is the root.
+ */
+
+void __cn_map_bt_rebalance(
+	CN_MAP        obj,
+	CNM_BT_NODE **path,
+	CNM_UINT     *slots,
+	CNM_UINT      h
+) {
+	CNM_BTREE    *bt = obj->bt;
+	CNM_BT_NODE  *parent, *node, *left, *right, *a, *b;
+	CNM_BT_NODE **pc, **nc, **sc;
+	CNM_UINT      ci, min, s;
+	CNM_UINT      ks = obj->key_size;
+	CNM_BYTE      leaf;
+
+	for (; h > 0; h--) {
+		parent = path [h - 1];
+		ci     = slots[h - 1];
+		pc     = CNM_BT_CHILDREN(parent);
+		node   = pc[ci];
+		leaf   = (h == bt->height);
+		min    = leaf ? bt->leaf_min : bt->inner_min;
+
+		if (node->n >= min)
+			break;
+
+		left  = (ci > 0        ) ? pc[ci - 1] : NULL;
+		right = (ci < parent->n) ? pc[ci + 1] : NULL;
+		nc    = CNM_BT_CHILDREN(node);
+
+		//Borrow the left neighbour's biggest key.
+		if (left != NULL && left->n > min) {
+			sc = CNM_BT_CHILDREN(left);
+
+			if (leaf) {
+				__cn_map_bt_leaf_move(obj, node, 1, node, 0, node->n);
+				__cn_map_bt_leaf_move(obj, node, 0, left, left->n - 1, 1);
+				memcpy(
+					CNM_BT_INNER_KEY(obj, parent, ci - 1),
+					CNM_BT_LEAF_KEY (obj, node, 0), ks
+				);
+			}
+			else {
+				//The parent's key comes down, and the neighbour's goes up.
+				memmove(
+					CNM_BT_INNER_KEY(obj, node, 1),
+					CNM_BT_INNER_KEY(obj, node, 0), (size_t) node->n * ks
+				);
+				memmove(nc + 1, nc, (node->n + 1) * sizeof(CNM_BT_NODE *));
+
+				memcpy(
+					CNM_BT_INNER_KEY(obj, node, 0),
+					CNM_BT_INNER_KEY(obj, parent, ci - 1), ks
+				);
+				nc[0] = sc[left->n];
+
+				memcpy(
+					CNM_BT_INNER_KEY(obj, parent, ci - 1),
+					CNM_BT_INNER_KEY(obj, left, left->n - 1), ks
+				);
+			}
+
+			node->n++;
+			left->n--;
+			break;
+		}
+
+		//Borrow the right neighbour's smallest key.
+		if (right != NULL && right->n > min) {
+			sc = CNM_BT_CHILDREN(right);
+
+			if (leaf) {
+				__cn_map_bt_leaf_move(obj, node, node->n, right, 0, 1);
+				__cn_map_bt_leaf_move(obj, right, 0, right, 1, right->n - 1);
+				memcpy(
+					CNM_BT_INNER_KEY(obj, parent, ci),
+					CNM_BT_LEAF_KEY (obj, right, 0), ks
+				);
+			}
+			else {
+				memcpy(
+					CNM_BT_INNER_KEY(obj, node, node->n),
+					CNM_BT_INNER_KEY(obj, parent, ci), ks
+				);
+				nc[node->n + 1] = sc[0];
+
+				memcpy(
+					CNM_BT_INNER_KEY(obj, parent, ci),
+					CNM_BT_INNER_KEY(obj, right, 0), ks
+				);
+
+				memmove(
+					CNM_BT_INNER_KEY(obj, right, 0),
+					CNM_BT_INNER_KEY(obj, right, 1),
+					(size_t) (right->n - 1) * ks
+				);
+				memmove(sc, sc + 1, right->n * sizeof(CNM_BT_NODE *));
+			}
+
+			node->n++;
+			right->n--;
+			break;
+		}
+
+		//Neither neighbour can spare a key. Merge "b" into "a", where "s" is
+		//the parent's key between them.
+		if (left != NULL) {
+			a = left;
+			b = node;
+			s = ci - 1;
+		}
+		else {
+			a = node;
+			b = right;
+			s = ci;
+		}
+
+		if (leaf) {
+			__cn_map_bt_leaf_move(obj, a, a->n, b, 0, b->n);
+			a->n += b->n;
 
-			if (target->up->left == NULL)
-				target->up->left = x;
+			a->next = b->next;
+			if (b->next != NULL)
+				b->next->prev = a;
 			else
-				target->up->right = x;
+				bt->last = a;
 
-			x->up = target->up;
-			x->colour = CNM_BLACK;
+			__cn_map_pool_release(&bt->leaves, b);
+		}
+		else {
+			memcpy(
+				CNM_BT_INNER_KEY(obj, a, a->n),
+				CNM_BT_INNER_KEY(obj, parent, s), ks
+			);
+			memcpy(
+				CNM_BT_INNER_KEY(obj, a, a->n + 1),
+				CNM_BT_INNER_KEY(obj, b, 0), (size_t) b->n * ks
+			);
+			memcpy(
+				CNM_BT_CHILDREN(a) + a->n + 1,
+				CNM_BT_CHILDREN(b), (b->n + 1) * sizeof(CNM_BT_NODE *)
+			);
+
+			a->n += b->n + 1;
+			__cn_map_pool_release(&bt->inners, b);
 		}
 
-		//Let's fix the tree up
-		__cn_map_delete_fixup(
-			obj,
-			x,
-			x_parent,
-			y_is_left,
-			y
+		//Take key "s" and child "s + 1" (which was "b") out of the parent.
+		memmove(
+			CNM_BT_INNER_KEY(obj, parent, s),
+			CNM_BT_INNER_KEY(obj, parent, s + 1),
+			(size_t) (parent->n - s - 1) * ks
+		);
+		memmove(
+			pc + s + 1, pc + s + 2,
+			(parent->n - s - 1) * sizeof(CNM_BT_NODE *)
 		);
 
-		//Clean up Double Black
-		if (double_blk != NULL) {
-			if (double_blk->up != NULL) {
-				if (double_blk->up->left == double_blk)
-					double_blk->up->left = NULL;
-				else
-					double_blk->up->right = NULL;
-			}
+		parent->n--;
+	}
 
-			__cn_map_free_node(obj, double_blk);
-		}
+	//Shrink the tree if the root is down to one child.
+	if (bt->height > 0 && bt->root->n == 0) {
+		node     = bt->root;
+		bt->root = CNM_BT_CHILDREN(node)[0];
+		bt->height--;
+
+		__cn_map_pool_release(&bt->inners, node);
 	}
+}
 
-	obj->size--;
+/*
+ * __cn_map_bt_next
+ *
+ * Description:
+ *     Moves "it" to the next slot, hopping to the next leaf at the end of one.
+ */
 
-	__cn_map_free_node(obj, y);
-	__cn_map_calibrate(obj);
+void __cn_map_bt_next(CNM_ITERATOR *it) {
+	CNM_BT_NODE *leaf = (CNM_BT_NODE *) it->prev;
+
+	if (it->node == NULL) {
+		it->prev = NULL;
+		return;
+	}
+
+	if (it->count + 1 < leaf->n)
+		__cn_map_bt_set_it(it, leaf, it->count + 1);
+	else
+		__cn_map_bt_set_it(it, leaf->next, 0);
 }
 
 /*
- * cn_map_clear
+ * __cn_map_bt_prev
  *
  * Description:
- *     Deletes all nodes in the graph. This is done by calling erase on the
- *     head node until the tree is emptied.
+ *     Mirror of "__cn_map_bt_next".
  */
 
-void cn_map_clear(CN_MAP obj) {
-	//Aggressively delete by recursion.
-	if (obj->head != NULL)
-		__cn_map_clear_nested(obj, obj->head);
+void __cn_map_bt_prev(CNM_ITERATOR *it) {
+	CNM_BT_NODE *leaf = (CNM_BT_NODE *) it->prev;
 
-	//Reset stats
-	obj->size = 0;
-	obj->head = NULL;
+	if (it->node == NULL) {
+		it->prev = NULL;
+		return;
+	}
+
+	if (it->count > 0)
+		__cn_map_bt_set_it(it, leaf, it->count - 1);
+	else if (leaf->prev != NULL)
+		__cn_map_bt_set_it(it, leaf->prev, leaf->prev->n - 1);
+	else
+		__cn_map_bt_set_it(it, NULL, 0);
 }
 
 /*
- * cn_map_free
+ * __cn_map_bt_clear
  *
  * Description:
- *     Frees the CN_Map from memory. Deletes all nodes. Call this when you are
- *     done using the data structure.
+ *     Runs the destructor (if there is one) on every pair, leaf by leaf, and
+ *     gives all nodes back to the system.
  */
 
-void cn_map_free(CN_MAP obj) {
-	//Free all nodes
-	cn_map_clear(obj);
+void __cn_map_bt_clear(CN_MAP obj) {
+	CNM_BTREE   *bt = obj->bt;
+	CNM_BT_NODE *leaf;
+	CNM_UINT     i;
 
-	//Free the map itself
-	free(obj);
+	if (obj->func_destruct != NULL)
+		for (leaf = bt->first; leaf != NULL; leaf = leaf->next)
+			for (i = 0; i < leaf->n; i++)
+				obj->func_destruct((CNM_NODE *) &CNM_BT_HANDLES(leaf)[i]);
+
+	__cn_map_pool_clear(&bt->leaves);
+	__cn_map_pool_clear(&bt->inners);
+
+	bt->root   = bt->first = bt->last = NULL;
+	bt->height = 0;
 }
 
 // ----------------------------------------------------------------------------
-// Private/Implementation Helper Functions                                 {{{1
+// Parallel Sort                                                           {{{1
 // ----------------------------------------------------------------------------
 
 /*
- * __cn_map_create_node
+ * Sort Job Struct
  *
- * Description:
- *     Creates a node to be attached in the CN_Map internal tree structure.
+ * A slice of work handed to one thread. For the first pass, each job sorts
+ * "src[lo..hi)" in place. For the merge passes, each job merges its share of
+ * the runs "a" and "b" into "dst[out_lo..out_hi)".
  */
 
-CNM_NODE *__cn_map_create_node(
-	void     *key,
-	void     *value,
-	CNM_UINT  ksize,
-	CNM_UINT  vsize
-) {
-	CNM_NODE *node = (CNM_NODE *) malloc(sizeof(struct cnm_node));
+typedef struct cnm_sort_job {
+	CN_MAP    obj;
+	CNM_BYTE *keys;
 
-	//Allocate memory for the keys and values.
-	node->key  = (void *) malloc(ksize);
-	node->data = (void *) malloc(vsize);
-
-	//Setup the pointers
-	node->left  = NULL;
-	node->right = NULL;
-	node->up    = NULL;
+	CNM_UINT *src, *tmp, lo, hi;
 
-	//Set the colour to black by default
-	node->colour = CNM_RED;
+	CNM_UINT *a, *b, *dst, na, nb, out_lo, out_hi;
+} CNM_SORT_JOB;
 
-	/*
-	 * Copy over the key and values
-	 *
-	 * If the parameter passed in is NULL, make the element blank instead of
-	 * a segfault.
-	 */
-	if (key == NULL)
-		memset(node->key , 0  , ksize);
-	else
-		memcpy(node->key , key, ksize);
+#define CNM_SORT_KEY(job, i) ((job)->keys + (size_t) (i) * (job)->obj->key_size)
+#define CNM_SORT_CMP(job, i, j) \
+	((job)->obj->func_compare(CNM_SORT_KEY(job, i), CNM_SORT_KEY(job, j)))
 
-	if (value == NULL)
-		memset(node->data, 0    , vsize);
-	else
-		memcpy(node->data, value, vsize);
+//Where run "r" of length "len" starts, clamped to the end of the input
+#define CNM_SORT_RUN(r, len, n) \
+	(((CNM_U64) (r) * (len) < (n)) ? (CNM_UINT) ((CNM_U64) (r) * (len)) : (n))
 
-	return node;
-}
+void      __cn_map_sort_run_jobs(CNM_SORT_JOB *, pthread_t *, CNM_UINT,
+                                 void *(*)(void *));
+void     *__cn_map_sort_thread  (void *);
+void      __cn_map_sort_nested  (CNM_SORT_JOB *, CNM_UINT, CNM_UINT);
+void     *__cn_map_merge_thread (void *);
+CNM_UINT  __cn_map_merge_corank (CNM_SORT_JOB *, CNM_UINT);
 
-void __cn_map_free_node(CN_MAP obj, CNM_NODE *node) {
-	//Call the destructor... if it exists.
-	if (obj->func_destruct != NULL)
-		obj->func_destruct(node);
+/*
+ * __cn_map_sort_index
+ *
+ * Description:
+ *     Returns a malloc'd array holding 0 through "n - 1", stably sorted by the
+ *     keys they index into. The input is split into one run per core, each run
+ *     is sorted on its own thread, and then the runs are merged pairwise. Every
+ *     merge is split up across threads as well, so all cores stay busy until
+ *     the very last pass.
+ */
 
-	if (node->key  != NULL) free(node->key);
-	if (node->data != NULL) free(node->data);
+CNM_UINT *__cn_map_sort_index(CN_MAP obj, CNM_BYTE *keys, CNM_UINT n) {
+	CNM_UINT     *src, *dst, *swap, threads, runs, run_len, i, r, t, k;
+	CNM_UINT      per_pair, pairs;
+	CNM_SORT_JOB *jobs;
+	pthread_t    *tids;
+	long          cores;
 
-	free(node);
-}
+	src = (CNM_UINT *) malloc(sizeof(CNM_UINT) * n);
+	dst = (CNM_UINT *) malloc(sizeof(CNM_UINT) * n);
 
-void __cn_map_fix_colours(CN_MAP obj, CNM_NODE *node) {
-	//If root, set the colour to black
-	if (node == obj->head) {
-		node->colour = CNM_BLACK;
-		return;
-	}
+	for (i = 0; i < n; i++)
+		src[i] = i;
 
-	//If node's parent is black or node is root, back out.
-	if (node->up->colour == CNM_BLACK && node->up != obj->head)
-		return;
+	//Figure out how many threads are worth starting.
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = (cores < 1) ? 1 : (CNM_UINT) cores;
 
-	//Find out who is who
-	CNM_NODE *parent      = node->up;
-	CNM_NODE *grandparent = parent->up;
-	CNM_NODE *uncle;
+	if (threads > CNM_SORT_THREADS_MAX)
+		threads = CNM_SORT_THREADS_MAX;
 
-	if (parent->up == NULL)
-		return;
+	if (n < CNM_SORT_PARALLEL_MIN)
+		threads = 1;
 
-	//Find out the uncle
-	if (grandparent->left == parent)
-		uncle = grandparent->right;
-	else
-		uncle = grandparent->left;
+	//A merge pass may need one extra job to carry an odd run over.
+	jobs = (CNM_SORT_JOB *) malloc(sizeof(CNM_SORT_JOB) * (threads + 1));
+	tids = (pthread_t    *) malloc(sizeof(pthread_t   ) * (threads + 1));
 
-	if (uncle != NULL && uncle->colour == CNM_RED) {
-		//If the uncle is red...
-		//Change colour of parent and uncle to black
-		uncle->colour = CNM_BLACK;
-		parent->colour = CNM_BLACK;
-		
-		//Change colour of grandparent to red.
-		grandparent->colour = CNM_RED;
+	//Pass 1: Each thread sorts its own run.
+	runs    = threads;
+	run_len = (n + runs - 1) / runs;
 
-		//Call this on the grandparent
-		__cn_map_fix_colours(obj, grandparent);
+	for (t = 0; t < runs; t++) {
+		jobs[t].obj  = obj;
+		jobs[t].keys = keys;
+		jobs[t].src  = src;
+		jobs[t].tmp  = dst;
+		jobs[t].lo   = CNM_SORT_RUN(t    , run_len, n);
+		jobs[t].hi   = CNM_SORT_RUN(t + 1, run_len, n);
 	}
-	else
-	if (uncle == NULL || uncle->colour == CNM_BLACK) {
-		//If the uncle is black...
-		if (parent == grandparent->left && node == parent->left)
-			__cn_map_l_l(obj, node, parent, grandparent, uncle);
-		else
-		if (parent == grandparent->left && node == parent->right)
-			__cn_map_l_r(obj, node, parent, grandparent, uncle);
-		else
-		if (parent == grandparent->right && node == parent->left)
-			__cn_map_r_l(obj, node, parent, grandparent, uncle);
-		else
-		if (parent == grandparent->right && node == parent->right)
-			__cn_map_r_r(obj, node, parent, grandparent, uncle);
+
+	__cn_map_sort_run_jobs(jobs, tids, runs, __cn_map_sort_thread);
+
+	//Pass 2+: Merge pairs of runs until only one is left.
+	while (runs > 1) {
+		pairs    = runs / 2;
+		per_pair = threads / pairs;
+		k        = 0;
+
+		for (r = 0; r < runs; r += 2) {
+			CNM_UINT lo  = CNM_SORT_RUN(r    , run_len, n);
+			CNM_UINT mid = CNM_SORT_RUN(r + 1, run_len, n);
+			CNM_UINT hi  = CNM_SORT_RUN(r + 2, run_len, n);
+			CNM_UINT pieces = (r + 1 < runs) ? per_pair : 1;
+
+			//Split the output of this merge evenly across its threads.
+			for (t = 0; t < pieces; t++) {
+				jobs[k].obj    = obj;
+				jobs[k].keys   = keys;
+				jobs[k].a      = src + lo;
+				jobs[k].na     = mid - lo;
+				jobs[k].b      = src + mid;
+				jobs[k].nb     = hi - mid;
+				jobs[k].dst    = dst + lo;
+				jobs[k].out_lo = (CNM_UINT) ((CNM_U64) (hi - lo) * t / pieces);
+				jobs[k].out_hi = (CNM_UINT) ((CNM_U64) (hi - lo) * (t + 1) / pieces);
+				k++;
+			}
+		}
+
+		__cn_map_sort_run_jobs(jobs, tids, k, __cn_map_merge_thread);
+
+		swap = src;
+		src  = dst;
+		dst  = swap;
+
+		runs    = (runs + 1) / 2;
+		run_len = run_len * 2;
 	}
+
+	free(dst);
+	free(jobs);
+	free(tids);
+
+	return src;
 }
 
 /*
- * __cn_map_delete_fixup
+ * __cn_map_sort_run_jobs
  *
  * Description:
- *     Fixes the Red-Black tree post-BST deletion. This may involve multiple
- *     recolours and/or rotations depending on which node was deleted, what
- *     colour it was, and where it was in the tree at the time of deletion.
- *
- *     These fixes occur up and down the path of the tree, and each rotation is
- *     guaranteed constant time. As such, there is a maximum of O(lg n)
- *     operations taking place during the fixup procedure.
+ *     Runs "func" on each of the "n" jobs, each on its own thread, and waits
+ *     for all of them. The first job runs on the calling thread. If a thread
+ *     can't be made, that job and every one after it run on the calling
+ *     thread too.
  */
 
-void __cn_map_delete_fixup(
-	CN_MAP    obj,
-	CNM_NODE *node,
-	CNM_NODE *p,
-	CNM_BYTE  y_is_left,
-	CNM_NODE *y
+void __cn_map_sort_run_jobs(
+	CNM_SORT_JOB  *jobs,
+	pthread_t     *tids,
+	CNM_UINT       n,
+	void        *(*func)(void *)
 ) {
-	CNM_NODE   *w;
-	CNM_COLOUR  lc, rc;
-
-	if (node == NULL)
-		return;
-
-	while (node != obj->head && node->colour == CNM_BLACK) {
-		//If left child
-		if (y_is_left) {
-			w = p->right;
+	CNM_UINT i, spawned;
 
-			if (w->colour == CNM_RED) {
-				w->colour = CNM_BLACK;
-				p->colour = CNM_RED;
-				p = __cn_map_rotate_left(obj, p)->left;
-				w = p->right;
-			}
+	for (i = 1; i < n; i++)
+		if (pthread_create(&tids[i], NULL, func, &jobs[i]) != 0)
+			break;
 
-			lc = (w->left  == NULL) ? CNM_BLACK : w->left->colour;
-			rc = (w->right == NULL) ? CNM_BLACK : w->right->colour;
+	spawned = i;
 
-			if (lc == CNM_BLACK && rc == CNM_BLACK) {
-				w->colour = CNM_RED;
-				node = node->up;
-				p = node->up;
+	for (; i < n; i++)
+		func(&jobs[i]);
 
-				if (p != NULL)
-					y_is_left = (node == p->left);
-			}
-			else {
-				if (rc == CNM_BLACK) {
-					w->left->colour = CNM_BLACK;
-					w->colour = CNM_RED;
-					w = __cn_map_rotate_right(obj, w);
-					w = p->right;
-				}
+	func(&jobs[0]);
 
-				w->colour = p->colour;
-				p->colour = CNM_BLACK;
+	for (i = 1; i < spawned; i++)
+		pthread_join(tids[i], NULL);
+}
 
-				if (w->right != NULL)
-					w->right->colour = CNM_BLACK;
+/*
+ * __cn_map_sort_thread
+ *
+ * Description:
+ *     Thread entry for the first pass. Sorts one run.
+ */
 
-				p = __cn_map_rotate_left(obj, p);
-				node = obj->head;
-				p = NULL;
-			}
-		}
-		else {
-			/* Same except flipped "left" and "right" */
-			w = p->left;
+void *__cn_map_sort_thread(void *arg) {
+	CNM_SORT_JOB *job = (CNM_SORT_JOB *) arg;
 
-			if (w->colour == CNM_RED) {
-				w->colour = CNM_BLACK;
-				p->colour = CNM_RED;
-				p = __cn_map_rotate_right(obj, p)->right;
-				w = p->left;
-			}
+	__cn_map_sort_nested(job, job->lo, job->hi);
 
-			lc = (w->left  == NULL) ? CNM_BLACK : w->left->colour;
-			rc = (w->right == NULL) ? CNM_BLACK : w->right->colour;
+	return NULL;
+}
 
-			if (lc == CNM_BLACK && rc == CNM_BLACK) {
-				w->colour = CNM_RED;
-				node = node->up;
-				p = node->up;
-				if (p != NULL)
-					y_is_left = (node == p->left);
-			}
-			else {
-				if (lc == CNM_BLACK) {
-					w->right->colour = CNM_BLACK;
-					w->colour = CNM_RED;
-					w = __cn_map_rotate_left(obj, w);
-					w = p->left;
-				}
+/*
+ * __cn_map_sort_nested
+ *
+ * Description:
+ *     Stable top-down merge sort of "src[lo..hi)", using "tmp" as scratch.
+ *     Short runs are insertion sorted, and halves that are already in order
+ *     relative to each other are not merged at all, which makes nearly sorted
+ *     input cheap.
+ */
 
-				w->colour = p->colour;
-				p->colour = CNM_BLACK;
+void __cn_map_sort_nested(CNM_SORT_JOB *job, CNM_UINT lo, CNM_UINT hi) {
+	CNM_UINT *src = job->src,
+	         *tmp = job->tmp;
+	CNM_UINT  mid, i, j, k, v;
 
-				if (w->left != NULL)
-					w->left->colour = CNM_BLACK;
+	if (hi - lo <= CNM_SORT_INSERTION) {
+		for (i = lo + 1; i < hi; i++) {
+			v = src[i];
+			for (j = i; j > lo && CNM_SORT_CMP(job, src[j - 1], v) > 0; j--)
+				src[j] = src[j - 1];
 
-				p = __cn_map_rotate_right(obj, p);
-				node = obj->head;
-				p = NULL;
-			}
+			src[j] = v;
 		}
+
+		return;
 	}
 
-	node->colour = CNM_BLACK;
-}
+	mid = lo + (hi - lo) / 2;
+	__cn_map_sort_nested(job, lo , mid);
+	__cn_map_sort_nested(job, mid, hi );
 
-void __cn_map_l_l(
-	CN_MAP obj,
-	CNM_NODE *node,
-	CNM_NODE *parent,
-	CNM_NODE *grandparent,
-	CNM_NODE *uncle
-) {
-	//Rotate to the right according to grandparent
-	grandparent = __cn_map_rotate_right(obj, grandparent);
+	//Already in order?
+	if (CNM_SORT_CMP(job, src[mid - 1], src[mid]) <= 0)
+		return;
 
-	//Swap grandparent and uncle's colours
-	CNM_COLOUR c1, c2;
-	c1 = grandparent->colour;
-	c2 = grandparent->right->colour;
+	//Merge into the scratch space, then copy back.
+	i = lo;
+	j = mid;
+	k = lo;
 
-	grandparent->colour = c2;
-	grandparent->right->colour = c1;
-}
+	while (i < mid && j < hi)
+		tmp[k++] = (CNM_SORT_CMP(job, src[j], src[i]) < 0) ? src[j++] : src[i++];
 
-void __cn_map_l_r(
-	CN_MAP obj,
-	CNM_NODE *node,
-	CNM_NODE *parent,
-	CNM_NODE *grandparent,
-	CNM_NODE *uncle
-) {
-	//Rotate to the left according to parent
-	parent = __cn_map_rotate_left(obj, parent);
+	while (i < mid)
+		tmp[k++] = src[i++];
 
-	//Refigure out who is who
-	node = parent->left;
-	grandparent = parent->up;
-	uncle = (grandparent->left == parent)
-		? grandparent->right
-		: grandparent->left;
+	while (j < hi)
+		tmp[k++] = src[j++];
 
-	//Apply left-left case
-	__cn_map_l_l(obj, node, parent, grandparent, uncle);
+	memcpy(src + lo, tmp + lo, sizeof(CNM_UINT) * (hi - lo));
 }
 
-void __cn_map_r_r(
-	CN_MAP obj,
-	CNM_NODE *node,
-	CNM_NODE *parent,
-	CNM_NODE *grandparent,
-	CNM_NODE *uncle
-) {
-	//Rotate to the left according to grandparent
-	grandparent = __cn_map_rotate_left(obj, grandparent);
+/*
+ * __cn_map_merge_thread
+ *
+ * Description:
+ *     Thread entry for the merge passes. Writes out elements "out_lo" through
+ *     "out_hi" of the stable merge of "a" and "b". The matching spots in "a"
+ *     and "b" are found by binary search (co-ranking), so any number of
+ *     threads can work on the same merge without talking to each other.
+ */
 
-	//Swap grandparent and uncle's colours
-	CNM_COLOUR c1, c2;
-	c1 = grandparent->colour;
-	c2 = grandparent->left->colour;
+void *__cn_map_merge_thread(void *arg) {
+	CNM_SORT_JOB *job = (CNM_SORT_JOB *) arg;
+	CNM_UINT      i, j, i_end, j_end, k;
 
-	grandparent->colour = c2;
-	grandparent->left->colour = c1;
-}
+	i     = __cn_map_merge_corank(job, job->out_lo);
+	j     = job->out_lo - i;
+	i_end = __cn_map_merge_corank(job, job->out_hi);
+	j_end = job->out_hi - i_end;
 
-void __cn_map_r_l(
-	CN_MAP obj,
-	CNM_NODE *node,
-	CNM_NODE *parent,
-	CNM_NODE *grandparent,
-	CNM_NODE *uncle
-) {
-	//Rotate to the right according to parent
-	parent = __cn_map_rotate_right(obj, parent);
+	k = job->out_lo;
 
-	//Refigure out who is who
-	node = parent->right;
-	grandparent = parent->up;
-	uncle = (grandparent->left == parent)
-		? grandparent->right
-		: grandparent->left;
+	while (i < i_end && j < j_end) {
+		if (CNM_SORT_CMP(job, job->b[j], job->a[i]) < 0)
+			job->dst[k++] = job->b[j++];
+		else
+			job->dst[k++] = job->a[i++];
+	}
 
-	//Apply right-right case
-	__cn_map_r_r(obj, node, parent, grandparent, uncle);
+	while (i < i_end)
+		job->dst[k++] = job->a[i++];
+
+	while (j < j_end)
+		job->dst[k++] = job->b[j++];
+
+	return NULL;
 }
 
 /*
- * __cn_map_rotate_left
+ * __cn_map_merge_corank
  *
  * Description:
- *     Performs a left rotation with "node". The following happens (with
- *     respect to "C":
- *
- *         B                C
- *        / \              / \
- *       A   C     =>     B   D
- *            \          /
- *             D        A
- *
- *     Returns the new node pointing in the spot of the original node.
+ *     Returns how many of the first "k" elements of the stable merge of "a"
+ *     and "b" come from "a". Ties go to "a", which keeps the merge stable.
  */
 
-CNM_NODE *__cn_map_rotate_left(CN_MAP obj, CNM_NODE *node) {
-	CNM_NODE *top, *r, *rr, *rl, *up;
-
-	top = node;
-	r   = node->right;
-	rl  = r->left;
-	rr  = r->right;
-	up  = node->up;
-
-	//Adjust
-	r->up = up;
-	r->left = node;
+CNM_UINT __cn_map_merge_corank(CNM_SORT_JOB *job, CNM_UINT k) {
+	CNM_UINT lo, hi, i;
 
-	node->right = rl;
-	node->up = r;
+	lo = (k > job->nb) ? k - job->nb : 0;
+	hi = (k < job->na) ? k : job->na;
 
-	if (node->right != NULL)
-		node->right->up = node;
+	//Find the smallest "i" where b[k - i - 1] comes strictly before a[i].
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
 
-	if (up != NULL) {
-		if (up->right == node)
-			up->right = r;
+		if (CNM_SORT_CMP(job, job->b[k - i - 1], job->a[i]) >= 0)
+			lo = i + 1;
 		else
-			up->left = r;
+			hi = i;
 	}
 
-	if (node == obj->head)
-		obj->head = r;
-
-	return r;
+	return lo;
 }
 
+// ----------------------------------------------------------------------------
+// String Keys                                                             {{{1
+// ----------------------------------------------------------------------------
+
 /*
- * __cn_map_rotate_right
+ * __cn_map_str_cmp
  *
  * Description:
- *     Performs a right rotation with "node". The following happens (with
- *     respect to "C":
- *
- *         C                B
- *        / \              / \
- *       B   D     =>     A   C
- *      /                      \
- *     A                        D
+ *     Comparison function for string key CN_Maps, for everything that doesn't
+ *     go through the cached prefix. Same as "cn_cmp_cstr".
+ */
+
+CNC_COMP __cn_map_str_cmp(void *a, void *b) {
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+ * __cn_map_str_query
  *
- *     Returns the new node pointing in the spot of the original node.
+ * Description:
+ *     Sets up "q" to search for "key" (a pointer to a "char *"). Unless the
+ *     CN_Map keeps lengths, "q->length" stops counting at 8.
  */
 
-CNM_NODE *__cn_map_rotate_right(CN_MAP obj, CNM_NODE *node) {
-	CNM_NODE *top, *l, *ll, *lr, *up;
+void __cn_map_str_query(CN_MAP obj, CNM_STR_QUERY *q, void *key) {
+	const CNM_BYTE *str = *(const CNM_BYTE **) key;
+	CNM_U64         prefix = 0;
+	size_t          i;
 
-	top = node;
-	l   = node->left;
-	lr  = l->right;
-	ll  = l->left;
-	up  = node->up;
+	q->str = str;
 
-	//Adjust
-	l->up = up;
-	l->right = node;
+	if (str == NULL) {
+		q->prefix = 0;
+		q->length = 0;
+		return;
+	}
 
-	node->left = lr;
-	node->up = l;
+	//Pack the first 8 bytes, most significant first, padded out with 0's.
+	for (i = 0; i < 8 && str[i] != 0; i++)
+		prefix |= (CNM_U64) str[i] << (56 - 8 * i);
 
-	if (node->left != NULL)
-		node->left->up = node;
+	q->prefix = prefix;
+	q->length = (i == 8 && (obj->str_keys & CNM_STR_LENGTH))
+		? 8 + strlen((const char *) str + 8)
+		: i;
+}
 
-	if (up != NULL) {
-		if (up->right == node)
-			up->right = l;
-		else
-			up->left = l;
-	}
+/*
+ * __cn_map_str_cache
+ *
+ * Description:
+ *     Fills in the cached prefix (and length) of a freshly copied key. If the
+ *     CN_Map owns its keys, the string is copied into the arena first.
+ */
 
-	if (node == obj->head)
-		obj->head = l;
+void __cn_map_str_cache(CN_MAP obj, CNM_NODE *node) {
+	CNM_STR_QUERY q;
+	char        **key = (char **) node->key;
 
-	return l;
+	if ((obj->str_keys & CNM_STR_OWNED) && *key != NULL)
+		*key = __cn_map_arena_copy(&obj->arena, *key, strlen(*key) + 1);
+
+	__cn_map_str_query(obj, &q, node->key);
+	CNM_STR_PREFIX_OF(node) = q.prefix;
+
+	if (obj->str_keys & CNM_STR_LENGTH)
+		CNM_STR_LENGTH_OF(node) = q.length;
 }
 
 /*
- * __cn_map_clear_nested
+ * __cn_map_str_size
  *
  * Description:
- *     Recursive wrapper for deleting nodes in a graph at an accelerated pace.
- *     Skips rotations. Just aggressively goes through all nodes and deletes.
+ *     Returns how many bytes the key of "node" takes up, including its null
+ *     terminator (or 0 for a NULL key).
  */
 
-void __cn_map_clear_nested(CN_MAP obj, CNM_NODE *node) {
-	//Free children
-	if (node->left  != NULL) __cn_map_clear_nested(obj, node->left );
-	if (node->right != NULL) __cn_map_clear_nested(obj, node->right);
+size_t __cn_map_str_size(CN_MAP obj, CNM_NODE *node) {
+	char *key = *(char **) node->key;
 
-	//Free self
-	__cn_map_free_node(obj, node);
+	if (key == NULL)
+		return 0;
+
+	if (obj->str_keys & CNM_STR_LENGTH)
+		return CNM_STR_LENGTH_OF(node) + 1;
+
+	return strlen(key) + 1;
 }
 
 /*
- * __cn_map_calibrate
+ * __cn_map_str_compare
  *
  * Description:
- *     Recalculate the positions of the "least" and "most" iterators in the
- *     tree. This is so iterators know where the beginning and end of the tree
- *     resides.
+ *     Compares the key in "q" against the key in "node", like "strcmp" would.
+ *     Comparing the prefixes as integers gives the same order as comparing
+ *     their bytes, so the strings are only read if the prefixes are equal.
  */
 
-void __cn_map_calibrate(CN_MAP obj) {
-	if (obj->head == NULL) {
-		obj->it_least.node = obj->it_most.node = NULL;
-		return;
-	}
+CNC_COMP __cn_map_str_compare(CN_MAP obj, CNM_STR_QUERY *q, CNM_NODE *node) {
+	CNM_U64         prefix = CNM_STR_PREFIX_OF(node);
+	const CNM_BYTE *str;
+	size_t          length, least;
+	int             res;
 
-	//Recompute it_least and it_most
-	obj->it_least.node = obj->it_most.node = obj->head;
+	if (q->prefix != prefix)
+		return (q->prefix < prefix) ? -1 : 1;
+
+	//The prefixes match. If "q" ended within them, the node's key did too.
+	if (q->length < 8)
+		return 0;
+
+	str = *(const CNM_BYTE **) node->key;
+
+	if (!(obj->str_keys & CNM_STR_LENGTH))
+		return strcmp((const char *) q->str + 8, (const char *) str + 8);
+
+	length = CNM_STR_LENGTH_OF(node);
+	least  = (q->length < length) ? q->length : length;
 
-	while (obj->it_least.node->left != NULL)
-		obj->it_least.node = obj->it_least.node->left;
+	res = memcmp(q->str + 8, str + 8, least - 8);
+	if (res != 0)
+		return res;
 
-	while (obj->it_most.node->right != NULL)
-		obj->it_most.node = obj->it_most.node->right;
+	return (q->length > length) - (q->length < length);
 }
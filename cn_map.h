@@ -23,6 +23,8 @@
 #ifndef __CN_MAP__
 #define __CN_MAP__
 
+#include <stddef.h>
+
 // ----------------------------------------------------------------------------
 // Typedefs/Enums                                                          {{{1
 // ----------------------------------------------------------------------------
@@ -37,6 +39,16 @@ typedef enum cnm_colour {
 	CNM_DOUBLE_BLACK
 } CNM_COLOUR;
 
+typedef enum cnm_dup {
+	CNM_KEEP_FIRST,
+	CNM_KEEP_LAST
+} CNM_DUP;
+
+//Flags for "new_cn_map_str"
+#define CNM_STR_PREFIX 1
+#define CNM_STR_LENGTH 2
+#define CNM_STR_OWNED  4
+
 //If CN_Comp hasn't been included, we still need to define the type.
 #ifndef __CN_COMP__
 	typedef int CNC_COMP;
@@ -51,6 +63,17 @@ typedef enum cnm_colour {
  *
  * Stores the key, data, and values of each element in the tree. This is the
  * main basis of the entire tree aside from the root struct.
+ *
+ * A node is one allocation. "key" and "data" point at the bytes stored inline
+ * right after the struct, so comparing a key never leaves the node's memory.
+ * "data" is NULL if the CN_Map was made without values (a set).
+ *
+ * "count" is the number of nodes in the subtree rooted here. It is only kept
+ * up to date while the CN_Map has order statistics turned on.
+ *
+ * In a persistent CN_Map (see "new_cn_map_persistent"), a node can be part of
+ * several versions of the tree at once. "count" is then how many links point
+ * at it, and "up" is the separate node its key and value belong to.
  */
 
 typedef struct cnm_node {
@@ -59,14 +82,57 @@ typedef struct cnm_node {
 
 	struct cnm_node *left, *right, *up;
 	CNM_COLOUR colour;
+	CNM_UINT   count;
 } CNM_NODE;
 
+/*
+ * Pool Struct
+ *
+ * Slab allocator used by a CN_Map for fixed-size blocks. Memory is grabbed
+ * from the system in large chunks and handed out one slot at a time. Freed
+ * slots are pushed onto a free list and recycled by the next allocation, so
+ * steady-state insertion and deletion never touch malloc or free.
+ */
+
+typedef struct cnm_pool {
+	void     *chunks;
+	void     *free_list;
+	CNM_BYTE *bump, *bump_end;
+
+	CNM_UINT  slot_size;
+	CNM_UINT  chunk_slots;
+} CNM_POOL;
+
+/*
+ * Arena Struct
+ *
+ * Append-only storage for the strings a CN_Map owns (see "CNM_STR_OWNED").
+ * Strings are copied in back to back and are only given back all at once.
+ * "live" and "dead" count the bytes of strings still in the CN_Map and of
+ * strings that have since been erased, so it knows when to compact.
+ */
+
+typedef struct cnm_arena {
+	void     *chunks;
+	CNM_BYTE *bump, *bump_end;
+
+	size_t    live, dead;
+} CNM_ARENA;
+
 /*
  * Iterator Struct
  *
  * Helps with traversal of the CN_Map. There will be helper functions that can
  * be used with CNM_ITERATORs to iterate through the interior of the structure
  * without having to look at the implementation.
+ *
+ * "node" is the element the iterator is on (NULL at the end). Moving with
+ * "cn_map_next" or "cn_map_prev" sets "prev" to the element it was on before.
+ * Traversal only follows links in the tree, so "prev" is never needed.
+ *
+ * In a B+ tree CN_Map, "node" points at a handle whose "key" and "data" are
+ * the only valid fields (which is all "cn_map_iterator_key/value" use).
+ * "prev" is the leaf the element is in, and "count" is its slot there.
  */
 
 typedef struct cnm_iterator {
@@ -90,15 +156,77 @@ typedef struct cn_map {
 	CNM_UINT key_size;
 	CNM_UINT elem_size;
 	CNM_UINT size;
+	CNM_UINT data_offset;
+	CNM_BYTE order_stats;
+	CNM_BYTE str_keys;
 
 	/* Dummy variables */
 	CNM_ITERATOR it_end, it_most, it_least;
 
+	/* Node allocator */
+	CNM_POOL pool;
+
+	/* Owned string keys */
+	CNM_ARENA arena;
+
+	/* B+ tree backend (NULL for a red-black tree) */
+	struct cnm_btree *bt;
+
+	/* Readers that take no locks (NULL unless turned on) */
+	struct cnm_epoch *epoch;
+
+	/* Persistent tree, shared with snapshots (NULL unless persistent) */
+	struct cnm_persist *ps;
+	CNM_U64             ps_stamp;
+
+	/* Node memory shared with CN_Maps nodes were moved to or from */
+	struct cnm_share   *share;
+
 	/* Function Pointers */
 	CNC_COMP (*func_compare )(void *, void *);
 	void     (*func_destruct)(CNM_NODE *);
 } *CN_MAP;
 
+/*
+ * Frozen Snapshot Struct
+ *
+ * Read-only copy of a CN_Map, made by "cn_map_freeze". The keys (and values)
+ * are each in one contiguous array, in Eytzinger (breadth-first) order: index
+ * 1 is the root of a perfectly balanced tree, and index "i" has its children
+ * at "2i" and "2i + 1". Slot 0 is unused, and index 0 stands for the end.
+ */
+
+typedef struct cnm_frozen {
+	CNM_BYTE *keys, *values;
+	CNM_UINT  size, key_size, elem_size;
+	CNM_UINT  first, last;
+
+	CNC_COMP (*func_compare)(void *, void *);
+} *CNM_FROZEN;
+
+/*
+ * Sharded Map
+ *
+ * A CN_Map that is safe to use from many threads at once (see
+ * "new_cn_map_sharded"). Its key space is split into ranges, each one held in
+ * an ordinary CN_Map with a lock of its own. The struct itself is private.
+ */
+
+typedef struct cnm_sharded *CNM_SHARDED;
+
+/*
+ * Sharded Iterator Struct
+ *
+ * Walks a CNM_SHARDED in order. "it" is an iterator into shard number
+ * "shard", which stays read-locked for as long as the iterator is in it. Once
+ * the iterator reaches the end, nothing is locked anymore.
+ */
+
+typedef struct cnm_sharded_iterator {
+	CNM_ITERATOR it;
+	CNM_UINT     shard;
+} CNM_SHARDED_ITERATOR;
+
 //For you C++ people...
 typedef CN_MAP MAP;
 
@@ -108,21 +236,47 @@ typedef CN_MAP MAP;
 
 //Constructor
 CN_MAP       new_cn_map (CNM_UINT, CNM_UINT, CNC_COMP(*)(void *, void *));
+CN_MAP       new_cn_map_str(CNM_UINT, CNM_BYTE);
+CN_MAP       new_cn_map_btree(CNM_UINT, CNM_UINT, CNC_COMP(*)(void *, void *));
+CN_MAP       new_cn_map_btree_int(CNM_UINT);
+CN_MAP       new_cn_map_persistent(CNM_UINT, CNM_UINT,
+                                   CNC_COMP(*)(void *, void *));
 
 //Function Pointer Management
 void         cn_map_set_func_comparison(CN_MAP, CNC_COMP(*)(void *, void *));
 void         cn_map_set_func_destructor(CN_MAP, void(*)(CNM_NODE *));
 
+//Optional Features
+void         cn_map_set_order_statistics(CN_MAP, CNM_BYTE);
+void         cn_map_set_concurrent_reads(CN_MAP, CNM_BYTE);
+
 //Add Functions
 CNM_UINT     cn_map_insert             (CN_MAP, void*, void*);
+CNM_UINT     cn_map_try_insert         (CN_MAP, CNM_ITERATOR *, void*, void*);
+CNM_UINT     cn_map_insert_hint        (CN_MAP, CNM_ITERATOR *, void*, void*);
+CNM_UINT     cn_map_build_sorted       (CN_MAP, void*, void*, CNM_UINT);
+CNM_UINT     cn_map_build_unsorted     (CN_MAP, void*, void*, CNM_UINT, CNM_DUP);
+CNM_UINT     cn_map_insert_batch       (CN_MAP, void*, void*, CNM_UINT);
 
 //Get Functions
 void         cn_map_find               (CN_MAP, CNM_ITERATOR *, void*);
+void         cn_map_find_batch         (CN_MAP, void*, CNM_UINT, CNM_ITERATOR *);
+void         cn_map_find_batch_sorted  (CN_MAP, void*, CNM_UINT, CNM_ITERATOR *);
+void         cn_map_lower_bound        (CN_MAP, CNM_ITERATOR *, void*);
+void         cn_map_upper_bound        (CN_MAP, CNM_ITERATOR *, void*);
+void         cn_map_equal_range        (CN_MAP, CNM_ITERATOR *, CNM_ITERATOR *,
+                                        void*);
 CNM_UINT     cn_map_size               (CN_MAP);
 CNM_BYTE     cn_map_empty              (CN_MAP);
 CNM_UINT     cn_map_key_size           (CN_MAP);
 CNM_UINT     cn_map_value_size         (CN_MAP);
 
+//Order Statistics
+CNM_UINT     cn_map_rank               (CN_MAP, void*);
+void         cn_map_select             (CN_MAP, CNM_ITERATOR *, CNM_UINT);
+CNM_UINT     cn_map_count_range        (CN_MAP, void*, void*);
+void         cn_map_advance            (CN_MAP, CNM_ITERATOR *, long);
+
 //Iteration
 void         cn_map_begin              (CN_MAP, CNM_ITERATOR *);
 void         cn_map_end                (CN_MAP, CNM_ITERATOR *);
@@ -137,8 +291,68 @@ CNM_BYTE     cn_map_at_end             (CN_MAP, CNM_ITERATOR *);
 CNM_BYTE     cn_map_at_rbegin          (CN_MAP, CNM_ITERATOR *);
 CNM_BYTE     cn_map_at_rend            (CN_MAP, CNM_ITERATOR *);
 
+//String Keys
+void         cn_map_compact_keys       (CN_MAP);
+
+//Frozen Snapshots
+CNM_FROZEN   cn_map_freeze             (CN_MAP);
+CNM_UINT     cn_map_frozen_find        (CNM_FROZEN, void*);
+CNM_UINT     cn_map_frozen_lower_bound (CNM_FROZEN, void*);
+CNM_UINT     cn_map_frozen_upper_bound (CNM_FROZEN, void*);
+CNM_UINT     cn_map_frozen_begin       (CNM_FROZEN);
+CNM_UINT     cn_map_frozen_rbegin      (CNM_FROZEN);
+CNM_UINT     cn_map_frozen_next        (CNM_FROZEN, CNM_UINT);
+CNM_UINT     cn_map_frozen_prev        (CNM_FROZEN, CNM_UINT);
+CNM_UINT     cn_map_frozen_size        (CNM_FROZEN);
+void         cn_map_frozen_free        (CNM_FROZEN);
+
+//Persistent Maps
+CN_MAP       cn_map_snapshot           (CN_MAP);
+
+//Concurrent Readers
+CNM_UINT     cn_map_read_lock          (CN_MAP);
+void         cn_map_read_unlock        (CN_MAP, CNM_UINT);
+
+//Sharded Maps
+CNM_SHARDED  new_cn_map_sharded        (CNM_UINT, CNM_UINT,
+                                        CNC_COMP(*)(void *, void *), CNM_UINT);
+CNM_UINT     cn_map_sharded_insert     (CNM_SHARDED, void*, void*);
+CNM_BYTE     cn_map_sharded_find       (CNM_SHARDED, void*, void*);
+CNM_UINT     cn_map_sharded_erase      (CNM_SHARDED, void*);
+CNM_UINT     cn_map_sharded_size       (CNM_SHARDED);
+void         cn_map_sharded_begin      (CNM_SHARDED, CNM_SHARDED_ITERATOR *);
+void         cn_map_sharded_lower_bound(CNM_SHARDED, CNM_SHARDED_ITERATOR *,
+                                        void*);
+void         cn_map_sharded_upper_bound(CNM_SHARDED, CNM_SHARDED_ITERATOR *,
+                                        void*);
+void         cn_map_sharded_next       (CNM_SHARDED, CNM_SHARDED_ITERATOR *);
+CNM_BYTE     cn_map_sharded_at_end     (CNM_SHARDED, CNM_SHARDED_ITERATOR *);
+void         cn_map_sharded_release    (CNM_SHARDED, CNM_SHARDED_ITERATOR *);
+void         cn_map_sharded_free       (CNM_SHARDED);
+
+//Set Operations
+void         cn_map_union              (CN_MAP, CN_MAP,
+                                        void(*)(CNM_NODE *, CNM_NODE *));
+void         cn_map_intersection       (CN_MAP, CN_MAP,
+                                        void(*)(CNM_NODE *, CNM_NODE *));
+void         cn_map_difference         (CN_MAP, CN_MAP);
+
+//Split and Join
+//"cn_map_split" is O(lg N) only with order statistics on. Otherwise, it also
+//counts the smaller half, making it O(lg N + min(K, N - K)) for K keys left.
+void         cn_map_split              (CN_MAP, void*, CN_MAP *, CN_MAP *);
+CNM_UINT     cn_map_join               (CN_MAP, CN_MAP);
+
+//Node Splicing
+void         cn_map_merge              (CN_MAP, CN_MAP);
+CNM_UINT     cn_map_splice             (CN_MAP, CN_MAP, CNM_ITERATOR *);
+CNM_NODE    *cn_map_extract            (CN_MAP, CNM_ITERATOR *);
+CNM_UINT     cn_map_insert_node        (CN_MAP, CNM_ITERATOR *, CNM_NODE *);
+void         cn_map_free_node          (CN_MAP, CNM_NODE *);
+
 //Remove Functions
 void      cn_map_erase                 (CN_MAP, CNM_ITERATOR *);
+void      cn_map_erase_range           (CN_MAP, CNM_ITERATOR *, CNM_ITERATOR *);
 void      cn_map_clear                 (CN_MAP);
 
 //Cleanup/Destructor
@@ -148,8 +362,12 @@ void      cn_map_free                  (CN_MAP);
 // Private/Implementation Helper Functions                                 {{{1
 // ----------------------------------------------------------------------------
 
-CNM_NODE *__cn_map_create_node (void*, void*, CNM_UINT, CNM_UINT);
+CNM_NODE *__cn_map_create_node (CN_MAP, void*, void*);
 void      __cn_map_free_node   (CN_MAP, CNM_NODE *);
+void      __cn_map_attach      (CN_MAP, CNM_NODE *, CNM_BYTE, CNM_NODE *);
+void      __cn_map_detach      (CN_MAP, CNM_NODE *);
+CNM_NODE *__cn_map_move        (CN_MAP, CN_MAP, CNM_NODE *);
+void      __cn_map_replace_node(CN_MAP, CNM_NODE *, CNM_NODE *);
 void      __cn_map_fix_colours (CN_MAP, CNM_NODE *);
 void      __cn_map_delete_fixup(CN_MAP, CNM_NODE *, CNM_NODE *, CNM_BYTE,
                                 CNM_NODE *);
@@ -159,10 +377,98 @@ void      __cn_map_l_r(CN_MAP, CNM_NODE *, CNM_NODE *, CNM_NODE *, CNM_NODE *);
 void      __cn_map_r_l(CN_MAP, CNM_NODE *, CNM_NODE *, CNM_NODE *, CNM_NODE *);
 void      __cn_map_r_r(CN_MAP, CNM_NODE *, CNM_NODE *, CNM_NODE *, CNM_NODE *);
 
+CNM_NODE *__cn_map_rotate      (CNM_NODE *, CNM_BYTE, CNM_BYTE);
 CNM_NODE *__cn_map_rotate_left (CN_MAP, CNM_NODE *);
 CNM_NODE *__cn_map_rotate_right(CN_MAP, CNM_NODE *);
 
+CNM_UINT  __cn_map_black_height(CNM_NODE *);
+CNM_NODE *__cn_map_join        (CN_MAP, CNM_NODE *, CNM_UINT, CNM_NODE *,
+                                CNM_NODE *, CNM_UINT, CNM_UINT *);
+CNM_NODE *__cn_map_join_side   (CN_MAP, CNM_NODE *, CNM_UINT, CNM_NODE *,
+                                CNM_NODE *, CNM_UINT, CNM_BYTE);
+CNM_NODE *__cn_map_join2       (CN_MAP, CNM_NODE *, CNM_UINT, CNM_NODE *,
+                                CNM_UINT, CNM_UINT *);
+CNM_NODE *__cn_map_split       (CN_MAP, CNM_NODE *, CNM_UINT, void *,
+                                CNM_NODE **, CNM_UINT *, CNM_NODE **,
+                                CNM_UINT *);
+CNM_NODE *__cn_map_split_last  (CN_MAP, CNM_NODE *, CNM_UINT, CNM_UINT *,
+                                CNM_NODE **);
+
 void      __cn_map_clear_nested(CN_MAP, CNM_NODE *);
+CNM_UINT  __cn_map_erase_nested(CN_MAP, CNM_NODE *);
+void      __cn_map_erase_slow  (CN_MAP, CNM_ITERATOR *, CNM_ITERATOR *);
+
+void      __cn_map_pool_init   (CNM_POOL *, CNM_UINT);
+void     *__cn_map_pool_alloc  (CNM_POOL *);
+void      __cn_map_pool_release(CNM_POOL *, void *);
+void      __cn_map_pool_clear  (CNM_POOL *);
+void      __cn_map_pool_merge  (CNM_POOL *, CNM_POOL *);
+
+void      __cn_map_arena_init  (CNM_ARENA *);
+char     *__cn_map_arena_copy  (CNM_ARENA *, const char *, size_t);
+void      __cn_map_arena_grow  (CNM_ARENA *, size_t);
+void      __cn_map_arena_clear (CNM_ARENA *);
+
+CNM_UINT *__cn_map_sort_index  (CN_MAP, CNM_BYTE *, CNM_UINT);
+CNM_UINT  __cn_map_insert_array(CN_MAP, CNM_BYTE *, CNM_BYTE *, CNM_UINT,
+                                CNM_BYTE);
+
+void      __cn_map_bt_init     (CN_MAP, CNM_BYTE);
+CNM_UINT  __cn_map_bt_insert   (CN_MAP, CNM_ITERATOR *, void *, void *);
+void      __cn_map_bt_find     (CN_MAP, CNM_ITERATOR *, void *);
+void      __cn_map_bt_bound    (CN_MAP, CNM_ITERATOR *, void *, CNM_BYTE);
+void      __cn_map_bt_erase    (CN_MAP, CNM_ITERATOR *);
+void      __cn_map_bt_next     (CNM_ITERATOR *);
+void      __cn_map_bt_prev     (CNM_ITERATOR *);
+void      __cn_map_bt_clear    (CN_MAP);
+void      __cn_map_bt_calibrate(CN_MAP);
+CNC_COMP  __cn_map_bt_cmp_int  (void *, void *);
+
+CNM_NODE *__cn_map_descend       (CN_MAP, CNM_NODE *, void *, CNC_COMP *);
+CNM_NODE *__cn_map_bound         (CN_MAP, void *, CNM_BYTE);
+CNM_NODE *__cn_map_finger_descend(CN_MAP, CNM_NODE *, void *, CNC_COMP *);
+void      __cn_map_flatten       (CNM_NODE *, CNM_NODE **);
+
+void      __cn_map_build_tree  (CN_MAP, CNM_NODE *, CNM_UINT);
+CNM_NODE *__cn_map_build_nested(CNM_NODE **, CNM_UINT, CNM_UINT, CNM_UINT);
+
+void      __cn_map_update_count(CNM_NODE *);
+CNM_UINT  __cn_map_recount     (CNM_NODE *);
+CNM_UINT  __cn_map_node_rank   (CNM_NODE *);
+
+CNM_UINT  __cn_map_frozen_bound(CNM_FROZEN, void *, CNM_BYTE);
+
+CNM_UINT  __cn_map_read_begin  (CN_MAP);
+CNM_BYTE  __cn_map_read_retry  (CN_MAP, CNM_UINT);
+CNM_NODE *__cn_map_read_bound  (CN_MAP, void *, CNM_BYTE);
+CNM_NODE *__cn_map_read_end    (CN_MAP, CNM_BYTE);
+void      __cn_map_write_begin (CN_MAP);
+void      __cn_map_write_end   (CN_MAP);
+void      __cn_map_epoch_retire(CN_MAP, CNM_NODE *);
+void      __cn_map_epoch_sync  (CN_MAP);
+void      __cn_map_epoch_reclaim(CN_MAP, CNM_U64);
+
+CNM_BYTE  __cn_map_ps_lock     (CN_MAP);
+void      __cn_map_ps_unlock   (CN_MAP, CNM_BYTE);
+CNM_UINT  __cn_map_ps_insert   (CN_MAP, CNM_ITERATOR *, void *, void *);
+void      __cn_map_ps_erase    (CN_MAP, CNM_ITERATOR *);
+void      __cn_map_ps_clear    (CN_MAP);
+CNM_NODE *__cn_map_ps_own      (CN_MAP, CNM_NODE **);
+void      __cn_map_ps_release  (CN_MAP, CNM_NODE *);
+void      __cn_map_ps_rotate   (CNM_NODE **, CNM_BYTE);
+CNM_NODE *__cn_map_ps_step     (CN_MAP, CNM_NODE *, CNM_BYTE);
+
+CN_MAP    __cn_map_new_like    (CN_MAP);
+CNM_BYTE  __cn_map_can_move    (CN_MAP, CN_MAP);
+CNM_BYTE  __cn_map_share       (CN_MAP, CN_MAP);
+CNM_BYTE  __cn_map_share_lock  (CN_MAP);
+void      __cn_map_share_unlock(CN_MAP, CNM_BYTE);
+void      __cn_map_share_release(CN_MAP, CNM_NODE *);
+void      __cn_map_hand_over   (CN_MAP);
+void      __cn_map_merge_slow  (CN_MAP, CN_MAP);
+
+CNM_NODE *__cn_map_successor   (CNM_NODE *);
+CNM_NODE *__cn_map_predecessor (CNM_NODE *);
 
 void      __cn_map_calibrate   (CN_MAP);
 
@@ -173,12 +479,78 @@ void      __cn_map_calibrate   (CN_MAP);
 #define cn_map_init(key_type, elem_type, __func) \
 	new_cn_map(sizeof(key_type), sizeof(elem_type), __func)
 
+#define cn_map_init_set(key_type, __func) \
+	new_cn_map(sizeof(key_type), 0, __func)
+
+#define cn_map_init_btree(key_type, elem_type, __func) \
+	new_cn_map_btree(sizeof(key_type), sizeof(elem_type), __func)
+
+#define cn_map_init_btree_int(elem_type) \
+	new_cn_map_btree_int(sizeof(elem_type))
+
+#define cn_map_init_persistent(key_type, elem_type, __func) \
+	new_cn_map_persistent(sizeof(key_type), sizeof(elem_type), __func)
+
+#define cn_map_init_sharded(key_type, elem_type, __func, shards) \
+	new_cn_map_sharded(sizeof(key_type), sizeof(elem_type), __func, shards)
+
+#define cn_map_init_str(elem_type) \
+	new_cn_map_str(sizeof(elem_type), 0)
+
+#define cn_map_init_str_len(elem_type) \
+	new_cn_map_str(sizeof(elem_type), CNM_STR_LENGTH)
+
+#define cn_map_init_str_owned(elem_type) \
+	new_cn_map_str(sizeof(elem_type), CNM_STR_OWNED | CNM_STR_LENGTH)
+
+/*
+ * Nodes are a single allocation. The key sits right after the link fields
+ * (padded out to the strictest alignment any type needs), and the value (if
+ * there is one) right after the key. "cn_map_node_key" reads a node's key in
+ * place, without going through its "key" pointer.
+ */
+
+#define CNM_MAX_ALIGN \
+	sizeof(union { void *p; long double ld; CNM_U64 u; })
+
+#define CNM_KEY_OFFSET \
+	((sizeof(CNM_NODE) + CNM_MAX_ALIGN - 1) / CNM_MAX_ALIGN * CNM_MAX_ALIGN)
+
+#define cn_map_node_key(node, type) \
+	(*(type*)((CNM_BYTE *)(node) + CNM_KEY_OFFSET))
+
 #define cn_map_iterator_key(it, type) \
 	(*(type*)(it)->node->key)
 
 #define cn_map_iterator_value(it, type) \
 	(*(type*)(it)->node->data)
 
+#define cn_map_frozen_key(fz, i, type) \
+	(*(type*)((fz)->keys + (size_t) (i) * (fz)->key_size))
+
+#define cn_map_frozen_value(fz, i, type) \
+	(*(type*)((fz)->values + (size_t) (i) * (fz)->elem_size))
+
+#define cn_map_frozen_traverse(fz, i) \
+	for ( \
+		i = cn_map_frozen_begin(fz); \
+		i != 0; \
+		i = cn_map_frozen_next(fz, i) \
+	)
+
+#define cn_map_sharded_iterator_key(sit, type) \
+	cn_map_iterator_key(&(sit)->it, type)
+
+#define cn_map_sharded_iterator_value(sit, type) \
+	cn_map_iterator_value(&(sit)->it, type)
+
+#define cn_map_sharded_traverse(map, psit) \
+	for ( \
+		 cn_map_sharded_begin  (map, psit); \
+		!cn_map_sharded_at_end (map, psit); \
+		 cn_map_sharded_next   (map, psit)  \
+	)
+
 #define cn_map_traverse(map, pit) \
 	for ( \
 		 cn_map_begin  (map, pit); \
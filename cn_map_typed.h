@@ -0,0 +1,250 @@
+/*
+ * CN_Map Library - Type-Specialised Maps
+ *
+ * Description:
+ *     Generates a typed front end for a CN_Map whose key and value types are
+ *     known at compile time. A regular CN_Map compares keys by calling
+ *     "func_compare" through a function pointer and reaches every key through
+ *     a "void *". The functions generated here compare with an expression
+ *     that the compiler can inline, and read keys by value straight out of
+ *     the node.
+ *
+ *     CN_MAP_DEFINE(name, K, V, CMP) generates a map from "K" to "V", and
+ *     CN_MAP_DEFINE_SET(name, K, CMP) generates a set of "K". "CMP(a, b)"
+ *     must compare two keys by value, returning a negative number, 0, or a
+ *     positive number, like the CN_Cmp functions. CN_CMP_NUM works for any
+ *     real type, and CN_CMP_CSTR for "char *" keys.
+ *
+ *     The generated functions work on a plain CN_MAP, so everything else in
+ *     the library (iteration, bounds, order statistics, bulk loading, etc.)
+ *     works on the same map as usual. They walk the red-black tree directly,
+ *     so they can't be used on a B+ tree CN_Map ("new_cn_map_btree") or a
+ *     persistent one ("new_cn_map_persistent"). They also read the tree with
+ *     plain loads and never check whether it changed under them, so threads
+ *     reading a CN_Map with concurrent reads on (see
+ *     "cn_map_set_concurrent_reads") can't use them either, and have to stick
+ *     to "cn_map_find" and the like. The thread that writes to it still can.
+ *
+ *     As an example, CN_MAP_DEFINE(imap, int, double, CN_CMP_NUM) gives:
+ *
+ *         CN_MAP    imap_new          (void);
+ *         CNM_UINT  imap_insert       (CN_MAP, int, double);
+ *         CNM_UINT  imap_try_insert   (CN_MAP, CNM_ITERATOR *, int, double);
+ *         double   *imap_get          (CN_MAP, int);
+ *         void      imap_find         (CN_MAP, CNM_ITERATOR *, int);
+ *         CNM_BYTE  imap_contains     (CN_MAP, int);
+ *         CNM_UINT  imap_erase        (CN_MAP, int);
+ *         void      imap_lower_bound  (CN_MAP, CNM_ITERATOR *, int);
+ *         void      imap_upper_bound  (CN_MAP, CNM_ITERATOR *, int);
+ *         int       imap_iterator_key (CNM_ITERATOR *);
+ *         double   *imap_iterator_value(CNM_ITERATOR *);
+ *
+ * Author:
+ *     Clara Nguyen (@iDestyKK)
+ */
+
+#ifndef __CN_MAP_TYPED__
+#define __CN_MAP_TYPED__
+
+#include "cn_map.h"
+
+// ----------------------------------------------------------------------------
+// Shared Functions                                                        {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * Functions every typed map and set gets. "name##_descend" is the typed
+ * version of "__cn_map_descend", and is what everything else is built on.
+ */
+
+#define __CN_MAP_DEFINE_COMMON(name, K, CMP)                                   \
+                                                                               \
+static inline CNC_COMP name##_compare(void *a, void *b) {                      \
+	return CMP(*(K *) a, *(K *) b);                                            \
+}                                                                              \
+                                                                               \
+static inline CNM_NODE *name##_descend(CN_MAP obj, K key, CNC_COMP *res) {     \
+	CNM_NODE *node = obj->head,                                                \
+	         *next;                                                            \
+                                                                               \
+	*res = 0;                                                                  \
+                                                                               \
+	while (node != NULL) {                                                     \
+		*res = CMP(key, cn_map_node_key(node, K));                             \
+                                                                               \
+		if (*res == 0)                                                         \
+			break;                                                             \
+                                                                               \
+		next = (*res < 0) ? node->left : node->right;                          \
+		if (next == NULL)                                                      \
+			break;                                                             \
+                                                                               \
+		node = next;                                                           \
+	}                                                                          \
+                                                                               \
+	return node;                                                               \
+}                                                                              \
+                                                                               \
+static inline void name##_find(CN_MAP obj, CNM_ITERATOR *it, K key) {          \
+	CNC_COMP  res;                                                             \
+	CNM_NODE *node = name##_descend(obj, key, &res);                           \
+                                                                               \
+	it->node = (node != NULL && res == 0) ? node : NULL;                       \
+	it->prev = (it->node != NULL) ? it->node->up : NULL;                       \
+}                                                                              \
+                                                                               \
+static inline CNM_BYTE name##_contains(CN_MAP obj, K key) {                    \
+	CNC_COMP  res;                                                             \
+	CNM_NODE *node = name##_descend(obj, key, &res);                           \
+                                                                               \
+	return (node != NULL && res == 0);                                         \
+}                                                                              \
+                                                                               \
+static inline CNM_UINT name##_erase(CN_MAP obj, K key) {                       \
+	CNM_ITERATOR it;                                                           \
+                                                                               \
+	name##_find(obj, &it, key);                                                \
+	if (it.node == NULL)                                                       \
+		return 0;                                                              \
+                                                                               \
+	cn_map_erase(obj, &it);                                                    \
+	return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static inline void name##_bound(                                               \
+	CN_MAP        obj,                                                         \
+	CNM_ITERATOR *it,                                                          \
+	K             key,                                                         \
+	CNM_BYTE      upper                                                        \
+) {                                                                            \
+	CNM_NODE *node = obj->head,                                                \
+	         *best = NULL;                                                     \
+	CNC_COMP  res;                                                             \
+                                                                               \
+	while (node != NULL) {                                                     \
+		res = CMP(key, cn_map_node_key(node, K));                              \
+                                                                               \
+		if (res < 0 || (res == 0 && !upper)) {                                 \
+			best = node;                                                       \
+			node = node->left;                                                 \
+		}                                                                      \
+		else                                                                   \
+			node = node->right;                                                \
+	}                                                                          \
+                                                                               \
+	it->node = best;                                                           \
+	it->prev = (best != NULL) ? best->up : NULL;                               \
+}                                                                              \
+                                                                               \
+static inline void name##_lower_bound(CN_MAP obj, CNM_ITERATOR *it, K key) {   \
+	name##_bound(obj, it, key, 0);                                             \
+}                                                                              \
+                                                                               \
+static inline void name##_upper_bound(CN_MAP obj, CNM_ITERATOR *it, K key) {   \
+	name##_bound(obj, it, key, 1);                                             \
+}                                                                              \
+                                                                               \
+static inline K name##_iterator_key(CNM_ITERATOR *it) {                        \
+	return cn_map_node_key(it->node, K);                                       \
+}                                                                              \
+                                                                               \
+static inline CNM_UINT name##_attach(                                          \
+	CN_MAP        obj,                                                         \
+	CNM_ITERATOR *it,                                                          \
+	K             key,                                                         \
+	void         *value                                                        \
+) {                                                                            \
+	CNC_COMP  res;                                                             \
+	CNM_NODE *node = name##_descend(obj, key, &res);                           \
+	CNM_NODE *new_node;                                                        \
+                                                                               \
+	if (node != NULL && res == 0) {                                            \
+		it->node = node;                                                       \
+		it->prev = node->up;                                                   \
+		return 0;                                                              \
+	}                                                                          \
+                                                                               \
+	new_node = __cn_map_create_node(obj, &key, value);                         \
+	__cn_map_attach(obj, node, (res < 0), new_node);                           \
+                                                                               \
+	it->node = new_node;                                                       \
+	it->prev = new_node->up;                                                   \
+	return 1;                                                                  \
+}
+
+// ----------------------------------------------------------------------------
+// Map and Set Generators                                                  {{{1
+// ----------------------------------------------------------------------------
+
+/*
+ * CN_MAP_DEFINE
+ *
+ * Description:
+ *     Generates the typed functions for a map from "K" to "V". Insertion
+ *     searches before it allocates (like "cn_map_try_insert"), so a key that
+ *     is already there is not copied and the destructor is not called.
+ */
+
+#define CN_MAP_DEFINE(name, K, V, CMP)                                         \
+                                                                               \
+__CN_MAP_DEFINE_COMMON(name, K, CMP)                                           \
+                                                                               \
+static inline CN_MAP name##_new(void) {                                        \
+	return new_cn_map(sizeof(K), sizeof(V), name##_compare);                   \
+}                                                                              \
+                                                                               \
+static inline CNM_UINT name##_try_insert(                                      \
+	CN_MAP        obj,                                                         \
+	CNM_ITERATOR *it,                                                          \
+	K             key,                                                         \
+	V             value                                                        \
+) {                                                                            \
+	return name##_attach(obj, it, key, &value);                                \
+}                                                                              \
+                                                                               \
+static inline CNM_UINT name##_insert(CN_MAP obj, K key, V value) {             \
+	CNM_ITERATOR it;                                                           \
+	return name##_attach(obj, &it, key, &value);                               \
+}                                                                              \
+                                                                               \
+static inline V *name##_get(CN_MAP obj, K key) {                               \
+	CNC_COMP  res;                                                             \
+	CNM_NODE *node = name##_descend(obj, key, &res);                           \
+                                                                               \
+	return (node != NULL && res == 0) ? (V *) node->data : NULL;               \
+}                                                                              \
+                                                                               \
+static inline V *name##_iterator_value(CNM_ITERATOR *it) {                     \
+	return (V *) it->node->data;                                               \
+}
+
+/*
+ * CN_MAP_DEFINE_SET
+ *
+ * Description:
+ *     Generates the typed functions for a set of "K" (a CN_Map with no value
+ *     storage at all).
+ */
+
+#define CN_MAP_DEFINE_SET(name, K, CMP)                                        \
+                                                                               \
+__CN_MAP_DEFINE_COMMON(name, K, CMP)                                           \
+                                                                               \
+static inline CN_MAP name##_new(void) {                                        \
+	return new_cn_map(sizeof(K), 0, name##_compare);                           \
+}                                                                              \
+                                                                               \
+static inline CNM_UINT name##_try_insert(                                      \
+	CN_MAP        obj,                                                         \
+	CNM_ITERATOR *it,                                                          \
+	K             key                                                          \
+) {                                                                            \
+	return name##_attach(obj, it, key, NULL);                                  \
+}                                                                              \
+                                                                               \
+static inline CNM_UINT name##_insert(CN_MAP obj, K key) {                      \
+	CNM_ITERATOR it;                                                           \
+	return name##_attach(obj, &it, key, NULL);                                 \
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * CN_Map Benchmark - B+ Tree Backend
+ *
+ * Compares a regular (red-black tree) CN_Map of "int" keys against a B+ tree
+ * CN_Map using "cn_cmp_int" and one made with "cn_map_init_btree_int" (which
+ * searches nodes with SIMD). Each one gets the same random keys inserted,
+ * then looked up in a different random order, then traversed.
+ *
+ * Usage: ./btree_benchmark [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * bench
+ *
+ * Description:
+ *     Times inserting "keys", finding "order", and a forward traversal.
+ */
+
+void bench(const char *name, CN_MAP map, int *keys, int *order, unsigned n) {
+	CNM_ITERATOR it;
+	unsigned int i;
+	long long    sum;
+	double       t_insert, t_find, t_scan;
+
+	t_insert = now();
+	for (i = 0; i < n; i++)
+		cn_map_insert(map, &keys[i], &i);
+
+	t_insert = now() - t_insert;
+
+	sum    = 0;
+	t_find = now();
+	for (i = 0; i < n; i++) {
+		cn_map_find(map, &it, &order[i]);
+		sum += cn_map_iterator_value(&it, int);
+	}
+
+	t_find = now() - t_find;
+
+	t_scan = now();
+	cn_map_traverse(map, &it)
+		sum += cn_map_iterator_key(&it, int);
+
+	t_scan = now() - t_scan;
+
+	printf(
+		"%-12s insert %7.3lf s, find %7.3lf s, traverse %7.3lf s (%lld)\n",
+		name, t_insert, t_find, t_scan, sum
+	);
+
+	cn_map_free(map);
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+	unsigned int i, j;
+	int         *keys, *order, swap;
+
+	keys  = (int *) malloc(sizeof(int) * n);
+	order = (int *) malloc(sizeof(int) * n);
+
+	//Distinct keys in random order, and a second shuffle to look them up in
+	srand(0);
+	for (i = 0; i < n; i++)
+		keys[i] = i * 2;
+
+	for (i = n - 1; i > 0; i--) {
+		j       = ((rand() << 8) ^ rand()) % (i + 1);
+		swap    = keys[i];
+		keys[i] = keys[j];
+		keys[j] = swap;
+	}
+
+	memcpy(order, keys, sizeof(int) * n);
+	for (i = n - 1; i > 0; i--) {
+		j        = ((rand() << 8) ^ rand()) % (i + 1);
+		swap     = order[i];
+		order[i] = order[j];
+		order[j] = swap;
+	}
+
+	printf("%u elements\n", n);
+
+	bench("red-black", cn_map_init(int, int, cn_cmp_int), keys, order, n);
+	bench("B+ tree", cn_map_init_btree(int, int, cn_cmp_int), keys, order, n);
+	bench("B+ tree int", cn_map_init_btree_int(int), keys, order, n);
+
+	free(keys);
+	free(order);
+}
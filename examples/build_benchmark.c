@@ -0,0 +1,84 @@
+/*
+ * CN_Map Benchmark - Bulk Loading
+ *
+ * Loads the same set of random key/value pairs into a CN_Map two ways. First,
+ * by calling "cn_map_insert" once per pair. Then, with a single call to
+ * "cn_map_build_unsorted", which sorts the pairs (on one thread per core) and
+ * links them into a tree in one pass. The number of cores is printed with the
+ * results. With one core, the whole difference comes from sorting an index
+ * and building the tree in one pass, rather than from the threads.
+ *
+ * Usage: ./build_benchmark [number of pairs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+	unsigned int i;
+	double       start, t_insert, t_build;
+
+	//Generate random pairs.
+	int *keys   = (int *) malloc(sizeof(int) * n);
+	int *values = (int *) malloc(sizeof(int) * n);
+
+	srand(0);
+	for (i = 0; i < n; i++) {
+		keys  [i] = (rand() << 8) ^ rand();
+		values[i] = i;
+	}
+
+	printf("%u pairs, %ld cores\n", n, sysconf(_SC_NPROCESSORS_ONLN));
+
+	//One at a time
+	CN_MAP map = cn_map_init(int, int, cn_cmp_int);
+
+	start = now();
+	for (i = 0; i < n; i++)
+		cn_map_insert(map, &keys[i], &values[i]);
+	t_insert = now() - start;
+
+	printf("cn_map_insert x N      : %8.3lf s (%u elements)\n",
+		t_insert, cn_map_size(map));
+
+	cn_map_free(map);
+
+	//All at once
+	map = cn_map_init(int, int, cn_cmp_int);
+
+	start = now();
+	cn_map_build_unsorted(map, keys, values, n, CNM_KEEP_FIRST);
+	t_build = now() - start;
+
+	printf("cn_map_build_unsorted  : %8.3lf s (%u elements)\n",
+		t_build, cn_map_size(map));
+
+	printf("Speedup                : %8.2lfx\n", t_insert / t_build);
+
+	//Cleanup
+	cn_map_free(map);
+	free(keys);
+	free(values);
+
+	return 0;
+}
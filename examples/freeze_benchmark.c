@@ -0,0 +1,121 @@
+/*
+ * CN_Map Benchmark - Frozen Snapshots
+ *
+ * Builds a CN_Map of random "int" keys, freezes it with "cn_map_freeze", and
+ * times the same random lookups on both, followed by a lower bound search for
+ * keys that mostly aren't there, and a full traversal of each.
+ *
+ * Usage: ./freeze_benchmark [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4000000;
+	unsigned int i, idx;
+	int         *keys, *queries;
+	long long    sum;
+	double       start;
+	CNM_ITERATOR it;
+	CN_MAP       map;
+	CNM_FROZEN   fz;
+
+	keys    = (int *) malloc(sizeof(int) * n);
+	queries = (int *) malloc(sizeof(int) * n);
+
+	srand(0);
+	for (i = 0; i < n; i++)
+		keys[i] = (rand() << 8) ^ rand();
+
+	for (i = 0; i < n; i++)
+		queries[i] = keys[((rand() << 8) ^ rand()) % n];
+
+	map = cn_map_init(int, int, cn_cmp_int);
+	cn_map_build_unsorted(map, keys, keys, n, CNM_KEEP_FIRST);
+
+	start = now();
+	fz    = cn_map_freeze(map);
+	printf("%u elements, frozen in %.3lf s\n", cn_map_size(map), now() - start);
+
+	//Lookups
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		cn_map_find(map, &it, &queries[i]);
+		sum += cn_map_iterator_value(&it, int);
+	}
+
+	printf("CN_Map find         : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		idx  = cn_map_frozen_find(fz, &queries[i]);
+		sum += cn_map_frozen_value(fz, idx, int);
+	}
+
+	printf("Frozen find         : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	//Lower bounds of keys that (likely) aren't in there
+	for (i = 0; i < n; i++)
+		queries[i]++;
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		cn_map_lower_bound(map, &it, &queries[i]);
+		if (it.node != NULL)
+			sum += cn_map_iterator_key(&it, int);
+	}
+
+	printf("CN_Map lower_bound  : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		idx = cn_map_frozen_lower_bound(fz, &queries[i]);
+		if (idx != 0)
+			sum += cn_map_frozen_key(fz, idx, int);
+	}
+
+	printf("Frozen lower_bound  : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	//Traversal
+	sum   = 0;
+	start = now();
+	cn_map_traverse(map, &it)
+		sum += cn_map_iterator_key(&it, int);
+
+	printf("CN_Map traversal    : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	sum   = 0;
+	start = now();
+	cn_map_frozen_traverse(fz, idx)
+		sum += cn_map_frozen_key(fz, idx, int);
+
+	printf("Frozen traversal    : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	cn_map_frozen_free(fz);
+	cn_map_free(map);
+	free(keys);
+	free(queries);
+}
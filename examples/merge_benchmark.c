@@ -0,0 +1,173 @@
+/*
+ * CN_Map Benchmark - Node Splicing
+ *
+ * Moves every pair of one CN_Map of M "int" keys into another of N keys.
+ * Done by copying each pair over with "cn_map_insert" and erasing it with
+ * "cn_map_erase", by moving each node with "cn_map_splice", and with
+ * "cn_map_merge". Run once with the keys of both CN_Maps mixed together, and
+ * once with every moved key after the others, like rotating a log. Last, the
+ * same with "char *" keys in CN_Maps that own them ("owned"), which can't
+ * move nodes, so "cn_map_merge" copies each pair over and erases it.
+ *
+ * Usage: ./merge_benchmark [N] [M]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * make
+ *
+ * Description:
+ *     Makes a CN_Map of "n" keys, starting from "first" and "step" apart.
+ */
+
+CN_MAP make(unsigned int n, int first, int step) {
+	CN_MAP       map = cn_map_init(int, int, cn_cmp_int);
+	CNM_ITERATOR hint;
+	unsigned int i;
+	int          key;
+
+	cn_map_end(map, &hint);
+
+	for (i = 0; i < n; i++) {
+		key = first + (int) i * step;
+		cn_map_insert_hint(map, &hint, &key, &key);
+	}
+
+	return map;
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Times moving a CN_Map of "m" keys into one of "n", with the keys mixed
+ *     together ("mixed" is true) or the moved ones after the rest. "mode" is 0
+ *     to copy, 1 to splice one node at a time, and 2 to merge.
+ */
+
+void run(unsigned int n, unsigned int m, int mixed, int mode) {
+	CN_MAP       dst, src;
+	CNM_ITERATOR it, next;
+	double       start, elapsed;
+
+	dst = mixed ? make(n, 0, 2) : make(n, 0, 1);
+	src = mixed ? make(m, 1, 2) : make(m, (int) n, 1);
+
+	start = now();
+
+	if (mode == 2)
+		cn_map_merge(dst, src);
+	else
+	for (cn_map_begin(src, &it); it.node != NULL; it = next) {
+		next = it;
+		cn_map_next(src, &next);
+
+		if (mode == 1)
+			cn_map_splice(dst, src, &it);
+		else {
+			cn_map_insert(dst, it.node->key, it.node->data);
+			cn_map_erase(src, &it);
+		}
+	}
+
+	elapsed = now() - start;
+
+	printf("  %8.3lf s (%u, %u)", elapsed, cn_map_size(dst), cn_map_size(src));
+
+	cn_map_free(dst);
+	cn_map_free(src);
+}
+
+/*
+ * make_str
+ *
+ * Description:
+ *     Makes a CN_Map that owns its "char *" keys, with "n" keys numbered from
+ *     "first" and "step" apart.
+ */
+
+CN_MAP make_str(unsigned int n, int first, int step) {
+	CN_MAP       map = cn_map_init_str_owned(int);
+	CNM_ITERATOR hint;
+	unsigned int i;
+	int          num;
+	char         buf[32], *key = buf;
+
+	cn_map_end(map, &hint);
+
+	for (i = 0; i < n; i++) {
+		num = first + (int) i * step;
+		sprintf(buf, "key-number-%08d-padding", num);
+		cn_map_insert_hint(map, &hint, &key, &num);
+	}
+
+	return map;
+}
+
+/*
+ * run_str
+ *
+ * Description:
+ *     Times merging a CN_Map of "m" owned string keys into one of "n", with
+ *     the keys mixed together ("mixed" is true) or the moved ones after the
+ *     rest.
+ */
+
+void run_str(unsigned int n, unsigned int m, int mixed) {
+	CN_MAP dst, src;
+	double start, elapsed;
+
+	dst = mixed ? make_str(n, 0, 2) : make_str(n, 0, 1);
+	src = mixed ? make_str(m, 1, 2) : make_str(m, (int) n, 1);
+
+	start = now();
+	cn_map_merge(dst, src);
+	elapsed = now() - start;
+
+	printf("  %8.3lf s (%u, %u)", elapsed, cn_map_size(dst), cn_map_size(src));
+
+	cn_map_free(dst);
+	cn_map_free(src);
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int m = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+	const char  *names[3] = { "copy  ", "splice", "merge " };
+	int          mode;
+
+	printf("N = %u, M = %u\n", n, m);
+	printf("                   mixed keys                  appended keys\n");
+
+	for (mode = 0; mode < 3; mode++) {
+		printf("%s", names[mode]);
+		run(n, m, 1, mode);
+		run(n, m, 0, mode);
+		printf("\n");
+	}
+
+	printf("owned ");
+	run_str(n, m, 1);
+	run_str(n, m, 0);
+	printf("\n");
+}
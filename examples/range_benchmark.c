@@ -0,0 +1,86 @@
+/*
+ * CN_Map Benchmark - Range Erase
+ *
+ * Makes a CN_Map of N "int" keys and drops every key below a cutoff, K keys
+ * in all, like expiring old entries. Done one node at a time with
+ * "cn_map_erase", and all at once with "cn_map_erase_range". Only the erasing
+ * is timed.
+ *
+ * Usage: ./range_benchmark [N] [K]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Times erasing the first "k" of "n" keys, one at a time ("loop" is true)
+ *     or as one range.
+ */
+
+void run(unsigned int n, unsigned int k, int loop) {
+	CN_MAP       map = cn_map_init(int, int, cn_cmp_int);
+	CNM_ITERATOR it, last;
+	int          key, cutoff = (int) k;
+	double       start, elapsed;
+
+	cn_map_end(map, &it);
+
+	for (key = 0; key < (int) n; key++)
+		cn_map_insert_hint(map, &it, &key, &key);
+
+	start = now();
+
+	if (loop) {
+		for (cn_map_begin(map, &it); it.node != NULL; cn_map_begin(map, &it)) {
+			if (cn_map_iterator_key(&it, int) >= cutoff)
+				break;
+
+			cn_map_erase(map, &it);
+		}
+	}
+	else {
+		cn_map_begin(map, &it);
+		cn_map_lower_bound(map, &last, &cutoff);
+		cn_map_erase_range(map, &it, &last);
+	}
+
+	elapsed = now() - start;
+
+	printf("  %10.6lf s (%u left)", elapsed, cn_map_size(map));
+
+	cn_map_free(map);
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int k = (argc > 2) ? strtoul(argv[2], NULL, 10) : 100000;
+
+	printf("N = %u, K = %u\n", n, k);
+
+	printf("one at a time     ");
+	run(n, k, 1);
+	printf("\nerase_range       ");
+	run(n, k, 0);
+	printf("\n");
+}
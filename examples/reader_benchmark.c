@@ -0,0 +1,225 @@
+/*
+ * CN_Map Benchmark - Concurrent Readers
+ *
+ * Fills a CN_Map with random "int" keys, then has 1 to N reader threads look
+ * up random keys while one writer thread inserts and erases, at 1 write for
+ * every 1000 reads. This is done once with a read/write lock around every
+ * call, and once with "cn_map_set_concurrent_reads" on and no locks at all.
+ *
+ * Usage: ./reader_benchmark [max threads] [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+#define READS_PER_THREAD 1000000
+#define READS_PER_WRITE  1000
+
+/*
+ * Job Struct
+ *
+ * What each thread is told to do. If "lock" is NULL, the CN_Map has
+ * concurrent reads on, and the readers use "cn_map_read_lock" instead.
+ */
+
+typedef struct job {
+	CN_MAP            map;
+	pthread_rwlock_t *lock;
+
+	unsigned int      seed, range, ops;
+	long long         sum;
+} JOB;
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * xorshift
+ *
+ * Description:
+ *     Small per-thread random number generator, since "rand" takes a lock.
+ */
+
+unsigned int xorshift(unsigned int *state) {
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+void *run_reader(void *arg) {
+	JOB          *job = (JOB *) arg;
+	CNM_ITERATOR  it;
+	CNM_UINT      slot;
+	unsigned int  i;
+	int           key;
+
+	for (i = 0; i < job->ops; i++) {
+		key = (int) (xorshift(&job->seed) % job->range);
+
+		if (job->lock != NULL) {
+			pthread_rwlock_rdlock(job->lock);
+			cn_map_find(job->map, &it, &key);
+			if (it.node != NULL)
+				job->sum += cn_map_iterator_value(&it, int);
+			pthread_rwlock_unlock(job->lock);
+		}
+		else {
+			slot = cn_map_read_lock(job->map);
+			cn_map_find(job->map, &it, &key);
+			if (it.node != NULL)
+				job->sum += cn_map_iterator_value(&it, int);
+			cn_map_read_unlock(job->map, slot);
+		}
+	}
+
+	return NULL;
+}
+
+void *run_writer(void *arg) {
+	JOB          *job = (JOB *) arg;
+	CNM_ITERATOR  it;
+	unsigned int  i;
+	int           key;
+
+	for (i = 0; i < job->ops; i++) {
+		key = (int) (xorshift(&job->seed) % job->range);
+
+		if (job->lock != NULL)
+			pthread_rwlock_wrlock(job->lock);
+
+		cn_map_find(job->map, &it, &key);
+		if (it.node != NULL)
+			cn_map_erase(job->map, &it);
+		else
+			cn_map_insert(job->map, &key, &key);
+
+		if (job->lock != NULL)
+			pthread_rwlock_unlock(job->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Runs "threads" readers and one writer at once, and returns how many
+ *     millions of reads were done per second.
+ */
+
+double run(
+	CN_MAP            map,
+	pthread_rwlock_t *lock,
+	unsigned int      threads,
+	unsigned int      range
+) {
+	JOB          *jobs;
+	pthread_t    *tids;
+	unsigned int  t;
+	double        start, elapsed;
+
+	//One more than "threads", for the writer.
+	jobs = (JOB       *) malloc(sizeof(JOB      ) * (threads + 1));
+	tids = (pthread_t *) malloc(sizeof(pthread_t) * (threads + 1));
+
+	for (t = 0; t <= threads; t++) {
+		jobs[t].map   = map;
+		jobs[t].lock  = lock;
+		jobs[t].seed  = t * 2654435761u + 1;
+		jobs[t].range = range;
+		jobs[t].ops   = READS_PER_THREAD;
+		jobs[t].sum   = 0;
+	}
+
+	//The last job is the writer.
+	jobs[threads].ops = READS_PER_THREAD / READS_PER_WRITE * threads;
+
+	start = now();
+
+	for (t = 0; t < threads; t++)
+		pthread_create(&tids[t], NULL, run_reader, &jobs[t]);
+
+	pthread_create(&tids[threads], NULL, run_writer, &jobs[threads]);
+
+	for (t = 0; t <= threads; t++)
+		pthread_join(tids[t], NULL);
+
+	elapsed = now() - start;
+
+	free(jobs);
+	free(tids);
+
+	return (double) READS_PER_THREAD * threads / elapsed / 1e6;
+}
+
+main(int argc, char **argv) {
+	unsigned int     max_threads, n, i, t;
+	int              key;
+	long             cores;
+	CN_MAP           map;
+	pthread_rwlock_t lock;
+
+	cores       = sysconf(_SC_NPROCESSORS_ONLN);
+	max_threads = (cores < 1) ? 1 : (unsigned int) cores;
+	n           = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+
+	if (argc > 1)
+		max_threads = strtoul(argv[1], NULL, 10);
+
+	map = cn_map_init(int, int, cn_cmp_int);
+	pthread_rwlock_init(&lock, NULL);
+
+	//Keys are drawn from twice the size, so about half of lookups hit.
+	srand(0);
+	for (i = 0; i < n; i++) {
+		key = (int) ((((unsigned int) rand() << 8) ^ rand()) % (2 * n));
+		cn_map_insert(map, &key, &key);
+	}
+
+	printf(
+		"%u elements, 1 write per %u reads\n",
+		cn_map_size(map), READS_PER_WRITE
+	);
+
+	printf("Mreads/s  readers  rwlock  no locks\n");
+
+	//1, 2, 4, ... readers, and then the maximum.
+	for (t = 1; ; t *= 2) {
+		if (t > max_threads)
+			t = max_threads;
+
+		printf("          %7u  %6.2lf", t, run(map, &lock, t, 2 * n));
+
+		cn_map_set_concurrent_reads(map, 1);
+		printf("  %8.2lf\n", run(map, NULL, t, 2 * n));
+		cn_map_set_concurrent_reads(map, 0);
+
+		if (t == max_threads)
+			break;
+	}
+
+	pthread_rwlock_destroy(&lock);
+	cn_map_free(map);
+}
@@ -0,0 +1,97 @@
+/*
+ * CN_Map Benchmark - Re-keying
+ *
+ * Keeps a CN_Map of N deadlines (as "int" keys) and pushes R random ones back,
+ * like a scheduler would. Done with "cn_map_erase" followed by
+ * "cn_map_insert", and with "cn_map_extract", changing the key in place, and
+ * "cn_map_insert_node".
+ *
+ * Usage: ./rekey_benchmark [N] [R]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Times "r" re-keyings in a CN_Map of "n" keys, by erasing and inserting
+ *     ("extract" is false) or by extracting and inserting the node.
+ */
+
+void run(unsigned int n, unsigned int r, int extract) {
+	CN_MAP       map = cn_map_init(int, int, cn_cmp_int);
+	CNM_ITERATOR it;
+	CNM_NODE    *node;
+	unsigned int i;
+	int          key, value, last = (int) n;
+	double       start, elapsed;
+
+	cn_map_end(map, &it);
+
+	for (key = 0; key < last; key++)
+		cn_map_insert_hint(map, &it, &key, &key);
+
+	srand(1);
+	start = now();
+
+	for (i = 0; i < r; i++) {
+		//Every deadline is unique, so pushing one back can't collide.
+		key = rand() % last;
+		cn_map_lower_bound(map, &it, &key);
+
+		if (it.node == NULL)
+			cn_map_rbegin(map, &it);
+
+		key = ++last;
+
+		if (extract) {
+			node = cn_map_extract(map, &it);
+			*(int *) node->key = key;
+			cn_map_insert_node(map, &it, node);
+		}
+		else {
+			value = cn_map_iterator_value(&it, int);
+			cn_map_erase(map, &it);
+			cn_map_insert(map, &key, &value);
+		}
+	}
+
+	elapsed = now() - start;
+
+	printf("  %8.3lf s (%u keys)", elapsed, cn_map_size(map));
+
+	cn_map_free(map);
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int r = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+
+	printf("N = %u, R = %u\n", n, r);
+
+	printf("erase + insert        ");
+	run(n, r, 0);
+	printf("\nextract + insert_node ");
+	run(n, r, 1);
+	printf("\n");
+}
@@ -0,0 +1,146 @@
+/*
+ * CN_Map Benchmark - Set Operations
+ *
+ * Makes two CN_Maps of random "int" keys, one with N keys and one with M, and
+ * combines them both ways: one element at a time with "cn_map_insert",
+ * "cn_map_find" and "cn_map_erase", and with "cn_map_union",
+ * "cn_map_intersection" and "cn_map_difference". Only the combining is timed.
+ * Run with M equal to N, and with M much smaller.
+ *
+ * Usage: ./set_benchmark [N] [M]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * make
+ *
+ * Description:
+ *     Makes a CN_Map of "n" random keys (fewer, after repeats) below "range",
+ *     inserted one at a time.
+ */
+
+CN_MAP make(unsigned int n, unsigned int range) {
+	CN_MAP       map = cn_map_init(int, int, cn_cmp_int);
+	unsigned int i;
+	int          key;
+
+	for (i = 0; i < n; i++) {
+		key = (int) ((((unsigned int) rand() << 8) ^ rand()) % range);
+		cn_map_insert(map, &key, &key);
+	}
+
+	return map;
+}
+
+/*
+ * add
+ *
+ * Description:
+ *     Merges two values by adding them.
+ */
+
+void add(CNM_NODE *dst, CNM_NODE *src) {
+	*(int *) dst->data += *(int *) src->data;
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Times set operation "op" (0: union, 1: intersection, 2: difference) on
+ *     a fresh pair of CN_Maps, done one element at a time ("loop" is true) or
+ *     all at once. Prints the time and the size of the result.
+ */
+
+void run(unsigned int n, unsigned int m, int op, int loop) {
+	CN_MAP       a, b;
+	CNM_ITERATOR it, next, found;
+	double       start, elapsed;
+
+	srand(op);
+	a = make(n, 2 * (n > m ? n : m));
+	b = make(m, 2 * (n > m ? n : m));
+
+	start = now();
+
+	if (!loop) {
+		if (op == 0)
+			cn_map_union(a, b, add);
+		else
+		if (op == 1)
+			cn_map_intersection(a, b, add);
+		else
+			cn_map_difference(a, b);
+	}
+	else
+	if (op == 0) {
+		cn_map_traverse(b, &it) {
+			if (!cn_map_try_insert(a, &found, it.node->key, it.node->data))
+				add(found.node, it.node);
+		}
+	}
+	else
+	if (op == 1) {
+		for (cn_map_begin(a, &it); !cn_map_at_end(a, &it); it = next) {
+			next = it;
+			cn_map_next(a, &next);
+
+			cn_map_find(b, &found, it.node->key);
+			if (found.node == NULL)
+				cn_map_erase(a, &it);
+			else
+				add(it.node, found.node);
+		}
+	}
+	else {
+		cn_map_traverse(b, &it) {
+			cn_map_find(a, &found, it.node->key);
+			if (found.node != NULL)
+				cn_map_erase(a, &found);
+		}
+	}
+
+	elapsed = now() - start;
+
+	printf("  %8.3lf s (%u left)", elapsed, cn_map_size(a));
+
+	cn_map_free(a);
+	cn_map_free(b);
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int m = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+	const char  *names[3] = { "union       ", "intersection", "difference  " };
+	int          op;
+
+	printf("N = %u, M = %u\n", n, m);
+	printf("                one at a time                  all at once\n");
+
+	for (op = 0; op < 3; op++) {
+		printf("%s", names[op]);
+		run(n, m, op, 1);
+		run(n, m, op, 0);
+		printf("\n");
+	}
+}
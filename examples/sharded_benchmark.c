@@ -0,0 +1,229 @@
+/*
+ * CN_Map Benchmark - Sharded Maps
+ *
+ * Fills a CN_Map behind one global mutex and a CNM_SHARDED with the same
+ * random "int" keys, then has 1 to N threads hammer each of them with a mix
+ * of lookups, insertions and erasures. Writes are half insertions and half
+ * erasures of random keys, so the size stays about the same. Throughput is
+ * printed for every thread count and read ratio, along with how many times
+ * faster the sharded map is. Rows with more threads than online cores are
+ * marked with "*", as their threads only take turns and can't show scaling.
+ *
+ * Usage: ./sharded_benchmark [max threads] [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+#define OPS_PER_THREAD 500000
+#define SHARDS         64
+
+/*
+ * Job Struct
+ *
+ * What each thread is told to do. If "map" is NULL, "sharded" is used.
+ * Otherwise, every operation on "map" is done holding "lock".
+ */
+
+typedef struct job {
+	CN_MAP           map;
+	pthread_mutex_t *lock;
+	CNM_SHARDED      sharded;
+
+	unsigned int     seed, range, read_pct;
+	long long        sum;
+} JOB;
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * xorshift
+ *
+ * Description:
+ *     Small per-thread random number generator, since "rand" takes a lock.
+ */
+
+unsigned int xorshift(unsigned int *state) {
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+void *run_job(void *arg) {
+	JOB          *job = (JOB *) arg;
+	CNM_ITERATOR  it;
+	unsigned int  i, r;
+	int           key, value;
+
+	for (i = 0; i < OPS_PER_THREAD; i++) {
+		r   = xorshift(&job->seed);
+		key = (int) (xorshift(&job->seed) % job->range);
+
+		if (r % 100 < job->read_pct) {
+			if (job->map == NULL) {
+				if (cn_map_sharded_find(job->sharded, &key, &value))
+					job->sum += value;
+			}
+			else {
+				pthread_mutex_lock(job->lock);
+				cn_map_find(job->map, &it, &key);
+				if (it.node != NULL)
+					job->sum += cn_map_iterator_value(&it, int);
+				pthread_mutex_unlock(job->lock);
+			}
+		}
+		else if (r & 0x80000000) {
+			if (job->map == NULL)
+				cn_map_sharded_insert(job->sharded, &key, &key);
+			else {
+				pthread_mutex_lock(job->lock);
+				cn_map_insert(job->map, &key, &key);
+				pthread_mutex_unlock(job->lock);
+			}
+		}
+		else {
+			if (job->map == NULL)
+				cn_map_sharded_erase(job->sharded, &key);
+			else {
+				pthread_mutex_lock(job->lock);
+				cn_map_find(job->map, &it, &key);
+				if (it.node != NULL)
+					cn_map_erase(job->map, &it);
+				pthread_mutex_unlock(job->lock);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Runs "threads" jobs at once against "map" (or "sharded", if "map" is
+ *     NULL) and returns the throughput in millions of operations per second.
+ */
+
+double run(
+	CN_MAP           map,
+	pthread_mutex_t *lock,
+	CNM_SHARDED      sharded,
+	unsigned int     threads,
+	unsigned int     range,
+	unsigned int     read_pct
+) {
+	JOB          *jobs = (JOB       *) malloc(sizeof(JOB      ) * threads);
+	pthread_t    *tids = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+	unsigned int  t;
+	double        start, elapsed;
+
+	for (t = 0; t < threads; t++) {
+		jobs[t].map      = map;
+		jobs[t].lock     = lock;
+		jobs[t].sharded  = sharded;
+		jobs[t].seed     = t * 2654435761u + 1;
+		jobs[t].range    = range;
+		jobs[t].read_pct = read_pct;
+		jobs[t].sum      = 0;
+	}
+
+	start = now();
+
+	for (t = 0; t < threads; t++)
+		pthread_create(&tids[t], NULL, run_job, &jobs[t]);
+
+	for (t = 0; t < threads; t++)
+		pthread_join(tids[t], NULL);
+
+	elapsed = now() - start;
+
+	free(jobs);
+	free(tids);
+
+	return (double) OPS_PER_THREAD * threads / elapsed / 1e6;
+}
+
+main(int argc, char **argv) {
+	unsigned int    max_threads, n, i, t, r;
+	unsigned int    read_pcts[] = { 50, 90, 99 };
+	int             key;
+	double          start, mutex_ops, sharded_ops;
+	long            cores;
+	CN_MAP          map;
+	CNM_SHARDED     sharded;
+	pthread_mutex_t lock;
+
+	cores       = sysconf(_SC_NPROCESSORS_ONLN);
+	max_threads = (cores < 1) ? 1 : (unsigned int) cores;
+	n           = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+
+	if (argc > 1)
+		max_threads = strtoul(argv[1], NULL, 10);
+
+	map     = cn_map_init(int, int, cn_cmp_int);
+	sharded = cn_map_init_sharded(int, int, cn_cmp_int, SHARDS);
+	pthread_mutex_init(&lock, NULL);
+
+	//Keys are drawn from twice the size, so about half of lookups hit.
+	srand(0);
+	start = now();
+	for (i = 0; i < n; i++) {
+		key = (int) ((((unsigned int) rand() << 8) ^ rand()) % (2 * n));
+		cn_map_insert(map, &key, &key);
+		cn_map_sharded_insert(sharded, &key, &key);
+	}
+
+	printf(
+		"%u elements, %u shards, %ld cores, filled in %.3lf s\n",
+		cn_map_sharded_size(sharded), SHARDS, cores, now() - start
+	);
+
+	printf("Mops/s     threads  global mutex  sharded  speedup\n");
+
+	for (r = 0; r < sizeof(read_pcts) / sizeof(read_pcts[0]); r++) {
+		//1, 2, 4, ... threads, and then the maximum.
+		for (t = 1; ; t *= 2) {
+			if (t > max_threads)
+				t = max_threads;
+
+			mutex_ops   = run(map, &lock, NULL, t, 2 * n, read_pcts[r]);
+			sharded_ops = run(NULL, NULL, sharded, t, 2 * n, read_pcts[r]);
+
+			printf(
+				"%2u%% reads  %7u%c %12.2lf  %7.2lf  %6.2lfx\n",
+				read_pcts[r], t, ((long) t > cores) ? '*' : ' ',
+				mutex_ops, sharded_ops, sharded_ops / mutex_ops
+			);
+
+			if (t == max_threads)
+				break;
+		}
+	}
+
+	pthread_mutex_destroy(&lock);
+	cn_map_sharded_free(sharded);
+	cn_map_free(map);
+}
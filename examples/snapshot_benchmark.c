@@ -0,0 +1,177 @@
+/*
+ * CN_Map Benchmark - Persistent Snapshots
+ *
+ * Fills a regular CN_Map and a persistent one with the same random "int"
+ * keys. Then, a point-in-time copy of each is made over and over while random
+ * keys are inserted and erased in between: a full copy of the regular CN_Map
+ * (with "cn_map_build_sorted"), and "cn_map_snapshot" of the persistent one.
+ * Every copy is walked in full once, to be read like a report would.
+ *
+ * Usage: ./snapshot_benchmark [number of elements] [writes between copies]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+#define COPIES 20
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * churn
+ *
+ * Description:
+ *     Inserts or erases "writes" random keys (about half each) in "map".
+ */
+
+void churn(CN_MAP map, unsigned int writes, unsigned int range) {
+	CNM_ITERATOR it;
+	unsigned int i;
+	int          key;
+
+	for (i = 0; i < writes; i++) {
+		key = (int) ((((unsigned int) rand() << 8) ^ rand()) % range);
+
+		cn_map_find(map, &it, &key);
+		if (it.node != NULL)
+			cn_map_erase(map, &it);
+		else
+			cn_map_insert(map, &key, &key);
+	}
+}
+
+/*
+ * walk
+ *
+ * Description:
+ *     Adds up every value in "map", in order.
+ */
+
+long long walk(CN_MAP map) {
+	CNM_ITERATOR it;
+	long long    sum = 0;
+
+	cn_map_traverse(map, &it)
+		sum += cn_map_iterator_value(&it, int);
+
+	return sum;
+}
+
+main(int argc, char **argv) {
+	unsigned int n      = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int writes = (argc > 2) ? strtoul(argv[2], NULL, 10) : 10000;
+	unsigned int i, j, size;
+	int         *keys, key;
+	long long    sum;
+	double       start, t_copy, t_walk, t_write;
+	CNM_ITERATOR it;
+	CN_MAP       map, pmap, copy;
+
+	map  = cn_map_init(int, int, cn_cmp_int);
+	pmap = cn_map_init_persistent(int, int, cn_cmp_int);
+	keys = (int *) malloc(sizeof(int) * 2 * n);
+
+	//Keys are drawn from twice the size, so erasing and inserting are even.
+	srand(0);
+	start = now();
+	for (i = 0; i < n; i++) {
+		key = (int) ((((unsigned int) rand() << 8) ^ rand()) % (2 * n));
+		cn_map_insert(map, &key, &key);
+	}
+
+	printf("%u elements, %u writes between copies\n", cn_map_size(map), writes);
+	printf("CN_Map filled in            %8.3lf s\n", now() - start);
+
+	srand(0);
+	start = now();
+	for (i = 0; i < n; i++) {
+		key = (int) ((((unsigned int) rand() << 8) ^ rand()) % (2 * n));
+		cn_map_insert(pmap, &key, &key);
+	}
+
+	printf("Persistent CN_Map filled in %8.3lf s\n\n", now() - start);
+
+	printf("                   copy (s)  walk (s)  writes (s)\n");
+
+	//Full copies of the regular CN_Map.
+	srand(1);
+	t_copy = t_walk = t_write = 0;
+	sum    = 0;
+
+	for (j = 0; j < COPIES; j++) {
+		start = now();
+		churn(map, writes, 2 * n);
+		t_write += now() - start;
+
+		start = now();
+		size  = 0;
+		cn_map_traverse(map, &it)
+			keys[size++] = cn_map_iterator_key(&it, int);
+
+		copy = cn_map_init(int, int, cn_cmp_int);
+		cn_map_build_sorted(copy, keys, keys, size);
+		t_copy += now() - start;
+
+		start = now();
+		sum  += walk(copy);
+		t_walk += now() - start;
+
+		cn_map_free(copy);
+	}
+
+	printf(
+		"Full copy        %10.3lf  %8.3lf  %10.3lf  (sum %lld)\n",
+		t_copy, t_walk, t_write, sum
+	);
+
+	//Snapshots of the persistent CN_Map. The snapshot is kept while the next
+	//round of writes happens, so they have to copy paths.
+	srand(1);
+	t_copy = t_walk = t_write = 0;
+	sum    = 0;
+	copy   = NULL;
+
+	for (j = 0; j < COPIES; j++) {
+		start = now();
+		churn(pmap, writes, 2 * n);
+		t_write += now() - start;
+
+		if (copy != NULL)
+			cn_map_free(copy);
+
+		start = now();
+		copy  = cn_map_snapshot(pmap);
+		t_copy += now() - start;
+
+		start = now();
+		sum  += walk(copy);
+		t_walk += now() - start;
+	}
+
+	cn_map_free(copy);
+
+	printf(
+		"Snapshot         %10.3lf  %8.3lf  %10.3lf  (sum %lld)\n",
+		t_copy, t_walk, t_write, sum
+	);
+
+	free(keys);
+	cn_map_free(map);
+	cn_map_free(pmap);
+}
@@ -0,0 +1,142 @@
+/*
+ * CN_Map Benchmark - Split and Join
+ *
+ * Makes a CN_Map of N "int" keys, then splits it in two around a random key
+ * and joins the halves back together, R times over. Done by copying the pairs
+ * into fresh CN_Maps with "cn_map_insert_hint", and with "cn_map_split" and
+ * "cn_map_join" (with order statistics off, then on).
+ *
+ * Usage: ./split_benchmark [N] [R]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * copy_split
+ *
+ * Description:
+ *     Splits "map" around "key" the slow way, copying every pair into one of
+ *     two new CN_Maps.
+ */
+
+void copy_split(CN_MAP map, int key, CN_MAP *left, CN_MAP *right) {
+	CNM_ITERATOR it, hl, hr;
+
+	*left  = cn_map_init(int, int, cn_cmp_int);
+	*right = cn_map_init(int, int, cn_cmp_int);
+
+	cn_map_end(*left , &hl);
+	cn_map_end(*right, &hr);
+
+	cn_map_traverse(map, &it) {
+		if (cn_map_iterator_key(&it, int) < key)
+			cn_map_insert_hint(*left , &hl, it.node->key, it.node->data);
+		else
+			cn_map_insert_hint(*right, &hr, it.node->key, it.node->data);
+	}
+
+	cn_map_clear(map);
+}
+
+/*
+ * copy_join
+ *
+ * Description:
+ *     Joins "right" onto the end of "left" the slow way, copying every pair.
+ */
+
+void copy_join(CN_MAP left, CN_MAP right) {
+	CNM_ITERATOR it, hint;
+
+	cn_map_end(left, &hint);
+
+	cn_map_traverse(right, &it)
+		cn_map_insert_hint(left, &hint, it.node->key, it.node->data);
+
+	cn_map_clear(right);
+}
+
+/*
+ * run
+ *
+ * Description:
+ *     Times "r" rounds of splitting a CN_Map of "n" keys and joining it back
+ *     together. "mode" is 0 to copy, 1 to relink nodes, and 2 to relink nodes
+ *     with order statistics on.
+ */
+
+void run(unsigned int n, unsigned int r, int mode) {
+	CN_MAP       map = cn_map_init(int, int, cn_cmp_int), left, right;
+	CNM_ITERATOR hint;
+	unsigned int i;
+	int          key;
+	double       start, elapsed;
+
+	cn_map_end(map, &hint);
+
+	for (key = 0; key < (int) n; key++)
+		cn_map_insert_hint(map, &hint, &key, &key);
+
+	if (mode == 2)
+		cn_map_set_order_statistics(map, 1);
+
+	srand(1);
+	start = now();
+
+	for (i = 0; i < r; i++) {
+		key = rand() % n;
+
+		if (mode == 0) {
+			copy_split(map, key, &left, &right);
+			copy_join(left, right);
+		}
+		else {
+			cn_map_split(map, &key, &left, &right);
+			cn_map_join(left, right);
+		}
+
+		cn_map_free(map);
+		cn_map_free(right);
+		map = left;
+	}
+
+	elapsed = now() - start;
+
+	printf("  %10.6lf s (%u keys)", elapsed / r, cn_map_size(map));
+
+	cn_map_free(map);
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int r = (argc > 2) ? strtoul(argv[2], NULL, 10) : 10;
+
+	printf("N = %u, per split and join:\n", n);
+
+	printf("copied              ");
+	run(n, r, 0);
+	printf("\nrelinked            ");
+	run(n, r, 1);
+	printf("\nrelinked (counted)  ");
+	run(n, r, 2);
+	printf("\n");
+}
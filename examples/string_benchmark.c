@@ -0,0 +1,115 @@
+/*
+ * CN_Map Benchmark - String Keys
+ *
+ * Compares lookups in a CN_Map made with "cn_cmp_cstr" against string key
+ * CN_Maps (see "new_cn_map_str"), which cache the first 8 bytes of every key
+ * (and optionally its length) in the node. Two sets of keys are tried: random
+ * words, and URLs that all start with the same 8 bytes ("https://"), where
+ * the cached prefix can never tell two keys apart.
+ *
+ * Usage: ./string_benchmark [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * make_key
+ *
+ * Description:
+ *     Returns a malloc'd random string. If "url" is true, it looks like a URL.
+ */
+
+char *make_key(int url) {
+	char buf[64];
+	int  len = 0, n, i;
+
+	if (url)
+		len = sprintf(buf, "https://site%d.com/", rand() % 16);
+
+	n = 6 + rand() % 10;
+	for (i = 0; i < n; i++)
+		buf[len++] = 'a' + rand() % 26;
+
+	buf[len] = 0;
+	return strdup(buf);
+}
+
+/*
+ * bench
+ *
+ * Description:
+ *     Inserts "keys" into "map", then looks all of them up in shuffled order.
+ */
+
+void bench(const char *name, CN_MAP map, char **keys, char **order, int n) {
+	CNM_ITERATOR it;
+	double       start;
+	long long    sum = 0;
+	int          i;
+
+	for (i = 0; i < n; i++)
+		cn_map_insert(map, &keys[i], &i);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		cn_map_find(map, &it, &order[i]);
+		sum += cn_map_iterator_value(&it, int);
+	}
+
+	printf("  %-16s: %8.3lf s (sum %lld)\n", name, now() - start, sum);
+	cn_map_free(map);
+}
+
+main(int argc, char **argv) {
+	int    n = (argc > 1) ? atoi(argv[1]) : 1000000;
+	int    url, i, j;
+	char **keys, **order, *swap;
+
+	keys  = (char **) malloc(sizeof(char *) * n);
+	order = (char **) malloc(sizeof(char *) * n);
+
+	for (url = 0; url < 2; url++) {
+		srand(0);
+		for (i = 0; i < n; i++)
+			keys[i] = order[i] = make_key(url);
+
+		for (i = n - 1; i > 0; i--) {
+			j        = rand() % (i + 1);
+			swap     = order[i];
+			order[i] = order[j];
+			order[j] = swap;
+		}
+
+		printf("%s (%d keys)\n", url ? "URLs" : "Words", n);
+
+		bench("cn_cmp_cstr"   , cn_map_init(char *, int, cn_cmp_cstr),
+			keys, order, n);
+		bench("prefix"        , cn_map_init_str(int), keys, order, n);
+		bench("prefix + length", cn_map_init_str_len(int), keys, order, n);
+
+		for (i = 0; i < n; i++)
+			free(keys[i]);
+	}
+
+	free(keys);
+	free(order);
+}
@@ -36,27 +36,10 @@ void gen_string(char* buffer, size_t size) {
 	buffer[size - 1] = 0;
 }
 
-/*
- * destruct_key
- *
- * Description:
- *     Custom Destructor to free the c-string upon node destruction. This demos
- *     that CN_Maps can take custom destructors to handle complex datatypes as
- *     keys or values.
- */
-
-void destruct_key(CNM_NODE *node) {
-	if (*(char**)node->key != NULL)
-		free(*(char**)node->key);
-}
-
 main() {
-	//Set up the CN_Map
-	CN_MAP map = cn_map_init(char*, int, cn_cmp_cstr);
-
-	//Give our CN_Map a custom destructor function to free the c-string upon
-	//deletion.
-	cn_map_set_func_destructor(map, destruct_key);
+	//Set up a CN_Map with string keys. It keeps its own copy of every key, so
+	//there is no need to strdup them or to free them with a destructor.
+	CN_MAP map = cn_map_init_str_owned(int);
 
 	char *key = (char *) malloc(20);
 	int  value;
@@ -74,9 +57,8 @@ main() {
 
 		//Set some value and insert into the CN_Map
 		value = rand() % 1000;
-		char *tmp = strdup(key);
-		printf("Inserting \"%s\"\n", tmp);
-		cn_map_insert(map, &tmp, &value);
+		printf("Inserting \"%s\"\n", key);
+		cn_map_insert(map, &key, &value);
 	}
 
 	//We don't need the key anymore.
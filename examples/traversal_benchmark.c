@@ -0,0 +1,83 @@
+/*
+ * CN_Map Benchmark - Traversal
+ *
+ * Times a full forward and a full reverse traversal of a CN_Map, as well as
+ * a round of (up to a million) lookups with "cn_map_find". Both directions
+ * step through parent links, so they should take about the same time.
+ *
+ * Usage: ./traversal_benchmark [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+main(int argc, char **argv) {
+	unsigned int n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+	unsigned int i, lookups;
+	long long    sum;
+	double       start;
+	CNM_ITERATOR it;
+
+	//Fill up a CN_Map with keys in random order
+	int *keys = (int *) malloc(sizeof(int) * n);
+
+	srand(0);
+	for (i = 0; i < n; i++)
+		keys[i] = (rand() << 8) ^ rand();
+
+	CN_MAP map = cn_map_init(int, int, cn_cmp_int);
+	cn_map_build_unsorted(map, keys, keys, n, CNM_KEEP_FIRST);
+
+	printf("%u elements\n", cn_map_size(map));
+
+	//Forward
+	sum   = 0;
+	start = now();
+	cn_map_traverse(map, &it)
+		sum += cn_map_iterator_value(&it, int);
+
+	printf("Forward traversal : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	//Reverse
+	sum   = 0;
+	start = now();
+	cn_map_rtraverse(map, &it)
+		sum += cn_map_iterator_value(&it, int);
+
+	printf("Reverse traversal : %8.3lf s (sum %lld)\n", now() - start, sum);
+
+	//Lookups
+	lookups = (n < 1000000) ? n : 1000000;
+	sum     = 0;
+	start   = now();
+	for (i = 0; i < lookups; i++) {
+		cn_map_find(map, &it, &keys[i]);
+		sum += cn_map_iterator_value(&it, int);
+	}
+
+	printf("cn_map_find x %u : %8.3lf s (sum %lld)\n", lookups, now() - start, sum);
+
+	//Cleanup
+	cn_map_free(map);
+	free(keys);
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * CN_Map Benchmark - Typed Maps
+ *
+ * Compares a regular CN_Map against one generated by CN_MAP_DEFINE, for both
+ * "int" and "unsigned long long" keys. The generic map calls "cn_cmp_int"
+ * through a function pointer for every comparison. The typed map compares
+ * inline.
+ *
+ * Usage: ./typed_benchmark [number of elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cn_cmp.h"
+#include "../cn_map.h"
+#include "../cn_map_typed.h"
+
+CN_MAP_DEFINE(imap, int               , int, CN_CMP_NUM)
+CN_MAP_DEFINE(umap, unsigned long long, int, CN_CMP_NUM)
+
+/*
+ * now
+ *
+ * Description:
+ *     Returns wall clock time in seconds.
+ */
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+main(int argc, char **argv) {
+	unsigned int        n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned int        i;
+	long long           sum;
+	double              start;
+	int                *keys;
+	unsigned long long *ukeys;
+	CNM_ITERATOR        it;
+	CN_MAP              map;
+
+	keys  = (int *) malloc(sizeof(int) * n);
+	ukeys = (unsigned long long *) malloc(sizeof(unsigned long long) * n);
+
+	srand(0);
+	for (i = 0; i < n; i++) {
+		keys [i] = (rand() << 8) ^ rand();
+		ukeys[i] = ((unsigned long long) keys[i] << 32) ^ rand();
+	}
+
+	// ------------------------------------------------------------------------
+	// int keys
+	// ------------------------------------------------------------------------
+
+	//Generic insert and find
+	map   = cn_map_init(int, int, cn_cmp_int);
+	start = now();
+	for (i = 0; i < n; i++)
+		cn_map_insert(map, &keys[i], &i);
+
+	printf("int  generic insert: %8.3lf s (%u elements)\n", now() - start,
+		cn_map_size(map));
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		cn_map_find(map, &it, &keys[i]);
+		sum += cn_map_iterator_value(&it, int);
+	}
+
+	printf("int  generic find  : %8.3lf s (sum %lld)\n", now() - start, sum);
+	cn_map_free(map);
+
+	//Typed insert and find
+	map   = imap_new();
+	start = now();
+	for (i = 0; i < n; i++)
+		imap_insert(map, keys[i], i);
+
+	printf("int  typed   insert: %8.3lf s (%u elements)\n", now() - start,
+		cn_map_size(map));
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++)
+		sum += *imap_get(map, keys[i]);
+
+	printf("int  typed   find  : %8.3lf s (sum %lld)\n", now() - start, sum);
+	cn_map_free(map);
+
+	// ------------------------------------------------------------------------
+	// unsigned long long keys
+	// ------------------------------------------------------------------------
+
+	//Generic insert and find
+	map   = cn_map_init(unsigned long long, int, cn_cmp_ll);
+	start = now();
+	for (i = 0; i < n; i++)
+		cn_map_insert(map, &ukeys[i], &i);
+
+	printf("u64  generic insert: %8.3lf s (%u elements)\n", now() - start,
+		cn_map_size(map));
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		cn_map_find(map, &it, &ukeys[i]);
+		sum += cn_map_iterator_value(&it, int);
+	}
+
+	printf("u64  generic find  : %8.3lf s (sum %lld)\n", now() - start, sum);
+	cn_map_free(map);
+
+	//Typed insert and find
+	map   = umap_new();
+	start = now();
+	for (i = 0; i < n; i++)
+		umap_insert(map, ukeys[i], i);
+
+	printf("u64  typed   insert: %8.3lf s (%u elements)\n", now() - start,
+		cn_map_size(map));
+
+	sum   = 0;
+	start = now();
+	for (i = 0; i < n; i++)
+		sum += *umap_get(map, ukeys[i]);
+
+	printf("u64  typed   find  : %8.3lf s (sum %lld)\n", now() - start, sum);
+	cn_map_free(map);
+
+	free(keys);
+	free(ukeys);
+}